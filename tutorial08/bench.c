@@ -0,0 +1,603 @@
+#ifdef _WINDOWS
+#include <windows.h> /* QueryPerformanceCounter() */
+#else
+#define _POSIX_C_SOURCE 200112L /* clock_gettime() */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "leptjson.h"
+
+/*
+ * Throughput of the main operations over a generated corpus shaped like the usual
+ * twitter.json, canada.json and citm_catalog.json, plus random doubles for number
+ * formatting and a deep and a wide tree, or over the files given, such as documents
+ * from leptjson_gen. Each document also gets its heap footprint in the layout this is
+ * built with and its CBOR and MessagePack sizes:
+ *
+ *   leptjson_bench [--json] [--time seconds] [--scale n] [file.json ...]
+ *
+ * This file is compiled together with its own copy of leptjson.c whose LEPT_MALLOC,
+ * LEPT_REALLOC and LEPT_FREE count the allocations made by each operation.
+ */
+
+static size_t allocs = 0;
+
+void* lept_bench_malloc(size_t size) {
+    allocs++;
+    return malloc(size);
+}
+
+void* lept_bench_realloc(void* p, size_t size) {
+    allocs++;
+    return realloc(p, size);
+}
+
+void lept_bench_free(void* p) {
+    free(p);
+}
+
+static double now() {
+#ifdef _WINDOWS
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (double)count.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+#endif
+}
+
+/* Corpus */
+
+typedef struct {
+    char* s;
+    size_t len, capacity;
+}buffer;
+
+static void put(buffer* b, const char* s, size_t len) {
+    if (b->len + len + 1 > b->capacity) {
+        while (b->len + len + 1 > b->capacity)
+            b->capacity = b->capacity == 0 ? 4096 : b->capacity * 2;
+        b->s = (char*)realloc(b->s, b->capacity);
+    }
+    memcpy(b->s + b->len, s, len);
+    b->s[b->len += len] = '\0';
+}
+
+static void puts_(buffer* b, const char* s) {
+    put(b, s, strlen(s));
+}
+
+static void putf(buffer* b, const char* format, double n) {
+    char number[32];
+    put(b, number, (size_t)sprintf(number, format, n));
+}
+
+static unsigned long seed = 1;
+
+static unsigned long next() { /* the C89 sample rand(), the same everywhere */
+    seed = seed * 1103515245 + 12345;
+    return (seed / 65536) % 32768;
+}
+
+static unsigned long pick(unsigned long n) {
+    return (next() * 32768 + next()) % n;
+}
+
+static void put_word(buffer* b) {
+    static const char* words[] = { "lorem", "ipsum", "dolor", "sit", "amet", "json", "parse", "value", "tutorial", "milo" };
+    puts_(b, words[pick(10)]);
+}
+
+static void put_text(buffer* b) {
+    /* mostly ASCII with some escapes, UTF-8 and \u sequences, like tweets */
+    static const char* pieces[] = { "\\n", "\\\"", "\\/", "\\u3042\\u3044", "\xE3\x81\x82\xE3\x81\x84\xE3\x81\x86", "\xF0\x9F\x98\x80", "#tag", "@user" };
+    size_t i, n = 5 + pick(20);
+    puts_(b, "\"");
+    for (i = 0; i < n; i++) {
+        if (i > 0)
+            puts_(b, " ");
+        if (pick(4) == 0)
+            puts_(b, pieces[pick(8)]);
+        else
+            put_word(b);
+    }
+    puts_(b, "\"");
+}
+
+static void put_id(buffer* b, int quoted) {
+    if (quoted)
+        puts_(b, "\"");
+    putf(b, "%.0f", 5.05874e17 + (double)pick(1000000) * 1e6);
+    if (quoted)
+        puts_(b, "\"");
+}
+
+static void put_user(buffer* b) {
+    puts_(b, "{\"id\":");
+    putf(b, "%.0f", (double)pick(3000000000u));
+    puts_(b, ",\"id_str\":\"");
+    putf(b, "%.0f", (double)pick(3000000000u));
+    puts_(b, "\",\"name\":");
+    put_text(b);
+    puts_(b, ",\"screen_name\":\"");
+    put_word(b);
+    puts_(b, "\",\"location\":\"\",\"description\":");
+    put_text(b);
+    puts_(b, ",\"url\":null,\"entities\":{\"description\":{\"urls\":[]}},\"protected\":false,\"followers_count\":");
+    putf(b, "%.0f", (double)pick(100000));
+    puts_(b, ",\"friends_count\":");
+    putf(b, "%.0f", (double)pick(5000));
+    puts_(b, ",\"created_at\":\"Mon Jul 28 10:09:54 +0000 2014\",\"favourites_count\":0,\"utc_offset\":null,"
+        "\"time_zone\":null,\"geo_enabled\":false,\"verified\":false,\"lang\":\"ja\","
+        "\"profile_background_color\":\"C0DEED\",\"profile_image_url\":\"http:\\/\\/pbs.twimg.com\\/profile_images\\/");
+    put_word(b);
+    puts_(b, "_normal.jpeg\",\"default_profile\":true,\"following\":false,\"notifications\":false}");
+}
+
+static void make_twitter(buffer* b, size_t scale) {
+    size_t i, n = 400 * scale;
+    puts_(b, "{\"statuses\":[");
+    for (i = 0; i < n; i++) {
+        if (i > 0)
+            puts_(b, ",");
+        puts_(b, "{\"metadata\":{\"result_type\":\"recent\",\"iso_language_code\":\"ja\"},"
+            "\"created_at\":\"Sun Aug 31 00:29:15 +0000 2014\",\"id\":");
+        put_id(b, 0);
+        puts_(b, ",\"id_str\":");
+        put_id(b, 1);
+        puts_(b, ",\"text\":");
+        put_text(b);
+        puts_(b, ",\"source\":\"<a href=\\\"https:\\/\\/mobile.twitter.com\\\" rel=\\\"nofollow\\\">Mobile Web<\\/a>\","
+            "\"truncated\":false,\"in_reply_to_status_id\":null,\"in_reply_to_user_id\":null,\"user\":");
+        put_user(b);
+        puts_(b, ",\"geo\":null,\"coordinates\":null,\"place\":null,\"contributors\":null,\"retweet_count\":");
+        putf(b, "%.0f", (double)pick(100));
+        puts_(b, ",\"favorite_count\":0,\"entities\":{\"hashtags\":[],\"symbols\":[],\"urls\":[],\"user_mentions\":[");
+        if (pick(2)) {
+            puts_(b, "{\"screen_name\":\"");
+            put_word(b);
+            puts_(b, "\",\"name\":");
+            put_text(b);
+            puts_(b, ",\"id\":");
+            putf(b, "%.0f", (double)pick(3000000000u));
+            puts_(b, ",\"indices\":[3,");
+            putf(b, "%.0f", (double)(4 + pick(12)));
+            puts_(b, "]}");
+        }
+        puts_(b, "]},\"favorited\":false,\"retweeted\":false,\"lang\":\"ja\"}");
+    }
+    puts_(b, "],\"search_metadata\":{\"completed_in\":0.087,\"max_id\":505874924095815681,"
+        "\"query\":\"%E4%B8%80\",\"count\":100,\"since_id\":0}}");
+}
+
+static void make_canada(buffer* b, size_t scale) {
+    /* a few polygons of long rings of coordinates with 15-17 significant digits */
+    size_t i, j, k, rings = 24 * scale;
+    double x = -65.613616999999977, y = 43.420273000000009;
+    puts_(b, "{\"type\":\"FeatureCollection\",\"features\":[{\"type\":\"Feature\",\"properties\":{\"name\":\"Canada\"},"
+        "\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[");
+    for (i = 0; i < rings; i++) {
+        size_t points = 200 + pick(4000);
+        puts_(b, i > 0 ? ",[" : "[");
+        for (j = 0; j < points; j++) {
+            x += ((double)pick(20001) - 10000.0) * 1.234567890123e-6;
+            y += ((double)pick(20001) - 10000.0) * 1.234567890123e-6;
+            puts_(b, j > 0 ? ",[" : "[");
+            for (k = 0; k < 2; k++) {
+                if (k > 0)
+                    puts_(b, ",");
+                putf(b, "%.17g", k == 0 ? x : y);
+            }
+            puts_(b, "]");
+        }
+        puts_(b, "]");
+    }
+    puts_(b, "]}}]}");
+}
+
+static void put_names(buffer* b, const char* key, size_t n) {
+    size_t i;
+    puts_(b, key);
+    puts_(b, ":{");
+    for (i = 0; i < n; i++) {
+        puts_(b, i > 0 ? ",\"" : "\"");
+        putf(b, "%.0f", 205705993.0 + (double)i * 7);
+        puts_(b, "\":");
+        put_text(b);
+    }
+    puts_(b, "}");
+}
+
+static void make_citm(buffer* b, size_t scale) {
+    /* numeric keys, many small objects with the same keys, integers and nulls */
+    size_t i, j, events = 184 * scale, performances = 1500 * scale;
+    puts_(b, "{");
+    put_names(b, "\"areaNames\"", 17);
+    puts_(b, ",\"audienceSubCategoryNames\":{\"337100890\":\"Abonn\xC3\xA9\"},\"blockNames\":{},\"events\":{");
+    for (i = 0; i < events; i++) {
+        double id = 138586341.0 + (double)i * 4;
+        puts_(b, i > 0 ? ",\"" : "\"");
+        putf(b, "%.0f", id);
+        puts_(b, "\":{\"description\":null,\"id\":");
+        putf(b, "%.0f", id);
+        puts_(b, ",\"logo\":");
+        if (pick(2))
+            puts_(b, "\"\\/images\\/UE0AAAAACEKo6QAAAAZDSVRN\"");
+        else
+            puts_(b, "null");
+        puts_(b, ",\"name\":");
+        put_text(b);
+        puts_(b, ",\"subTopicIds\":[337184269,337184283],\"subjectCode\":null,\"subtitle\":null,\"topicIds\":[324846099,107888604]}");
+    }
+    puts_(b, "},\"performances\":[");
+    for (i = 0; i < performances; i++) {
+        size_t prices = 1 + pick(6);
+        if (i > 0)
+            puts_(b, ",");
+        puts_(b, "{\"eventId\":");
+        putf(b, "%.0f", 138586341.0 + (double)pick(events) * 4);
+        puts_(b, ",\"id\":");
+        putf(b, "%.0f", 339887544.0 + (double)i);
+        puts_(b, ",\"logo\":null,\"name\":null,\"prices\":[");
+        for (j = 0; j < prices; j++) {
+            puts_(b, j > 0 ? ",{\"amount\":" : "{\"amount\":");
+            putf(b, "%.0f", (double)(10000 + pick(100) * 250));
+            puts_(b, ",\"audienceSubCategoryId\":337100890,\"seatCategoryId\":");
+            putf(b, "%.0f", 338937295.0 + (double)j);
+            puts_(b, "}");
+        }
+        puts_(b, "],\"seatCategories\":[");
+        for (j = 0; j < prices; j++) {
+            puts_(b, j > 0 ? ",{\"areas\":[{\"areaId\":205705999,\"blockIds\":[]},{\"areaId\":205705998,\"blockIds\":[]}],\"seatCategoryId\":"
+                : "{\"areas\":[{\"areaId\":205705999,\"blockIds\":[]},{\"areaId\":205705998,\"blockIds\":[]}],\"seatCategoryId\":");
+            putf(b, "%.0f", 338937295.0 + (double)j);
+            puts_(b, "}");
+        }
+        puts_(b, "],\"seatMapImage\":null,\"start\":");
+        putf(b, "%.0f", 1372701600000.0 + (double)pick(1000) * 86400000.0);
+        puts_(b, ",\"venueCode\":\"PLEYEL_PLEYEL\"}");
+    }
+    puts_(b, "]}");
+}
+
+static void make_numbers(buffer* b, size_t scale) {
+    /* doubles of every magnitude with all their digits, for the shortest round-trip formatting */
+    size_t i, k, n = 100000 * scale;
+    puts_(b, "[");
+    for (i = 0; i < n; i++) {
+        double x = ((double)pick(2000000001) - 1000000000.0) / 999983.0;
+        size_t e = pick(40);
+        for (k = 0; k < e; k++)
+            x = e < 20 ? x / 10.0 : x * 10.0;
+        if (i > 0)
+            puts_(b, ",");
+        putf(b, "%.17g", x);
+    }
+    puts_(b, "]");
+}
+
+static void make_deep(buffer* b, size_t scale) {
+    /* [{"a":[{"a":...0...,"b":1}],"b":1}], far deeper than recursion would allow */
+    size_t i, n = 20000 * scale;
+    for (i = 0; i < n; i++)
+        puts_(b, "[{\"a\":");
+    puts_(b, "0");
+    for (i = 0; i < n; i++)
+        puts_(b, ",\"b\":1}]");
+}
+
+static void make_wide(buffer* b, size_t scale) {
+    /* one object with many members and one array with many elements */
+    size_t i, n = 50000 * scale;
+    puts_(b, "{");
+    for (i = 0; i < n; i++) {
+        puts_(b, i > 0 ? ",\"k" : "\"k");
+        putf(b, "%.0f", (double)i);
+        puts_(b, "\":");
+        if (i % 2)
+            put_text(b);
+        else
+            putf(b, "%.0f", (double)pick(100000));
+    }
+    puts_(b, ",\"list\":[");
+    for (i = 0; i < n; i++) {
+        if (i > 0)
+            puts_(b, ",");
+        if (i % 3 == 0)
+            puts_(b, "null");
+        else
+            putf(b, "%.0f", (double)pick(1000));
+    }
+    puts_(b, "]}");
+}
+
+static int read_file(buffer* b, const char* path) {
+    FILE* fp;
+    char chunk[65536];
+    size_t n;
+    if ((fp = fopen(path, "rb")) == NULL)
+        return 0;
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+        put(b, chunk, n);
+    fclose(fp);
+    return b->s != NULL;
+}
+
+/* Operations */
+
+#define SCRATCH 8
+
+typedef struct {
+    const char* json;
+    size_t len;
+    lept_value v, other;    /* the document, and a separately parsed copy of it */
+    lept_value compact;     /* lept_compact() of the document */
+    char* cbor, *msgpack;
+    size_t cbor_len, msgpack_len;
+    lept_value scratch[SCRATCH];    /* trees to free */
+}document;
+
+static int write_buffer(void* sink, const char* data, size_t len) {
+    put((buffer*)sink, data, len);
+    return 0;
+}
+
+/* into a buffer grown by put(), so unlike lept_stringify() output it goes back with free() */
+static char* encode(const lept_value* v, int (*encoder)(const lept_value*, lept_write_fn, void*), size_t* len) {
+    buffer b;
+    memset(&b, 0, sizeof(b));
+    encoder(v, write_buffer, &b);
+    *len = b.len;
+    return b.s;
+}
+
+/* with a stack of the values still to count, deep documents are fine */
+static size_t count_values(const lept_value* v) {
+    const lept_value** stack = NULL;
+    size_t i, size, n = 0, top = 0, capacity = 0;
+    for (;;) {
+        n++;
+        if (lept_get_type(v) == LEPT_ARRAY && lept_get_array_doubles(v, &size) != NULL)
+            n += size;
+        else if (lept_get_type(v) == LEPT_ARRAY || lept_get_type(v) == LEPT_OBJECT) {
+            size = lept_get_type(v) == LEPT_ARRAY ? lept_get_array_size(v) : lept_get_object_size(v);
+            if (top + size > capacity) {
+                while (top + size > capacity)
+                    capacity = capacity == 0 ? 256 : capacity * 2;
+                stack = (const lept_value**)realloc((void*)stack, capacity * sizeof(const lept_value*));
+            }
+            for (i = 0; i < size; i++)
+                stack[top++] = lept_get_type(v) == LEPT_ARRAY ? lept_get_array_element(v, i) : lept_get_object_value(v, i);
+        }
+        if (top == 0)
+            break;
+        v = stack[--top];
+    }
+    free((void*)stack);
+    return n;
+}
+
+#define OP_PARSE            0
+#define OP_PARSE_PACKED     1
+#define OP_STRINGIFY        2
+#define OP_COPY             3
+#define OP_EQUAL            4
+#define OP_HASH             5
+#define OP_DIFF             6
+#define OP_FREE             7
+#define OP_CBOR_ENCODE      8
+#define OP_CBOR_DECODE      9
+#define OP_MSGPACK_ENCODE   10
+#define OP_MSGPACK_DECODE   11
+#define OP_COMPACT          12
+#define OP_HASH_COMPACT     13
+#define OP_STRINGIFY_COMPACT 14
+#define OP_COUNT            15
+
+static const char* op_names[OP_COUNT] = {
+    "parse", "parse_packed", "stringify", "copy", "is_equal", "hash", "diff", "free",
+    "cbor_encode", "cbor_decode", "msgpack_encode", "msgpack_decode",
+    "compact", "hash_compact", "stringify_compact"
+};
+
+/* Runs op count times, returning the seconds spent in the operation itself and the allocations it made */
+static double run(document* d, int op, size_t count, size_t* allocations) {
+    lept_parse_options options;
+    lept_value v;
+    size_t i, j, len, batch, before;
+    double start, elapsed = 0.0;
+    lept_init(&v);
+    lept_init_parse_options(&options);
+    options.flags = LEPT_PARSE_PACK_NUMBERS;
+    *allocations = 0;
+    for (i = 0; i < count; i += batch) {
+        batch = 1;
+        if (op == OP_FREE) {
+            /* the trees are built outside of the timed part */
+            batch = count - i < SCRATCH ? count - i : SCRATCH;
+            for (j = 0; j < batch; j++)
+                lept_parse(&d->scratch[j], d->json);
+        }
+        before = allocs;
+        start = now();
+        switch (op) {
+            case OP_PARSE:          lept_parse(&v, d->json); break;
+            case OP_PARSE_PACKED:   lept_parse_ex(&v, d->json, &options); break;
+            case OP_STRINGIFY:      lept_free_buffer(lept_stringify(&d->v, &len)); break;
+            case OP_COPY:           lept_copy(&v, &d->v); break;
+            case OP_EQUAL:          lept_is_equal(&d->v, &d->other); break;
+            case OP_HASH:           lept_hash(&d->v, 0); break;
+            case OP_DIFF:           lept_diff(&d->v, &d->other, &v); break;
+            case OP_FREE:           for (j = 0; j < batch; j++) lept_free(&d->scratch[j]); break;
+            case OP_CBOR_ENCODE:    free(encode(&d->v, lept_encode_cbor, &len)); break;
+            case OP_CBOR_DECODE:    lept_decode_cbor(&v, d->cbor, d->cbor_len); break;
+            case OP_MSGPACK_ENCODE: free(encode(&d->v, lept_encode_msgpack, &len)); break;
+            case OP_MSGPACK_DECODE: lept_decode_msgpack(&v, d->msgpack, d->msgpack_len); break;
+            case OP_COMPACT:        lept_compact(&v, &d->v); break;
+            case OP_HASH_COMPACT:   lept_hash(&d->compact, 0); break;
+            default:                lept_free_buffer(lept_stringify(&d->compact, &len)); break;
+        }
+        elapsed += now() - start;
+        *allocations += allocs - before;
+        if (op != OP_COPY && op != OP_DIFF && op != OP_COMPACT)
+            lept_free(&v);  /* lept_parse() does not free what it replaces */
+    }
+    lept_free(&v);
+    return elapsed;
+}
+
+typedef struct {
+    int json;
+    double time;
+    lept_value report;
+    lept_value corpora;
+}bench;
+
+/* Takes json, which is freed on every path; 0 if it does not parse */
+static int measure(bench* b, const char* name, char* json, size_t len) {
+    document d;
+    lept_memory_stats memory, compact;
+    size_t values, i;
+    int op;
+    lept_value* r;
+    memset(&d, 0, sizeof(d));
+    d.json = json;
+    d.len = len;
+    lept_init(&d.v);
+    lept_init(&d.other);
+    lept_init(&d.compact);
+    for (i = 0; i < SCRATCH; i++)
+        lept_init(&d.scratch[i]);
+    if (lept_parse(&d.v, json) != LEPT_PARSE_OK) {
+        fprintf(stderr, "%s: invalid JSON\n", name);
+        free(json);
+        return 0;
+    }
+    lept_parse(&d.other, json);
+    lept_compact(&d.compact, &d.v);
+    d.cbor = encode(&d.v, lept_encode_cbor, &d.cbor_len);
+    d.msgpack = encode(&d.v, lept_encode_msgpack, &d.msgpack_len);
+    values = count_values(&d.v);
+    lept_memory_usage(&d.v, &memory);
+    lept_memory_usage(&d.compact, &compact);
+    if (!b->json) {
+        printf("%s: %lu bytes, %lu values\n", name, (unsigned long)len, (unsigned long)values);
+        printf("  heap %lu bytes, %.1f per value (%lu, %.1f compacted); cbor %.1f%%, msgpack %.1f%% of the JSON size\n",
+            (unsigned long)memory.total, (double)memory.total / (double)values,
+            (unsigned long)compact.total, (double)compact.total / (double)values,
+            100.0 * (double)d.cbor_len / (double)len, 100.0 * (double)d.msgpack_len / (double)len);
+    }
+    r = lept_pushback_array_element(&b->corpora);
+    lept_set_object(r, 7);
+    lept_set_string(lept_set_object_value(r, "corpus", 6), name, strlen(name));
+    lept_set_number(lept_set_object_value(r, "bytes", 5), (double)len);
+    lept_set_number(lept_set_object_value(r, "values", 6), (double)values);
+    lept_set_number(lept_set_object_value(r, "heap_bytes", 10), (double)memory.total);
+    lept_set_number(lept_set_object_value(r, "compact_heap_bytes", 18), (double)compact.total);
+    lept_set_number(lept_set_object_value(r, "cbor_bytes", 10), (double)d.cbor_len);
+    lept_set_number(lept_set_object_value(r, "msgpack_bytes", 13), (double)d.msgpack_len);
+    for (op = 0; op < OP_COUNT; op++) {
+        size_t count = 1, allocations;
+        double elapsed, ns;
+        /* a warm-up run sizes the batch that is reported */
+        if ((elapsed = run(&d, op, count, &allocations)) < b->time) {
+            count = elapsed > 0.0 ? (size_t)(b->time / elapsed) + 1 : 1000000;
+            elapsed = run(&d, op, count, &allocations);
+        }
+        ns = elapsed * 1e9 / (double)count;
+        if (!b->json)
+            printf("  %-18s %10.1f MB/s %8.2f ns/value %10.1f allocs\n", op_names[op],
+                (double)len / (ns * 1e-9) / 1e6, ns / (double)values, (double)allocations / (double)count);
+        r = lept_pushback_array_element(&b->report);
+        lept_set_object(r, 8);
+        lept_set_string(lept_set_object_value(r, "corpus", 6), name, strlen(name));
+        lept_set_string(lept_set_object_value(r, "op", 2), op_names[op], strlen(op_names[op]));
+        lept_set_number(lept_set_object_value(r, "bytes", 5), (double)len);
+        lept_set_number(lept_set_object_value(r, "values", 6), (double)values);
+        lept_set_number(lept_set_object_value(r, "iterations", 10), (double)count);
+        lept_set_number(lept_set_object_value(r, "mb_per_s", 8), (double)len / (ns * 1e-9) / 1e6);
+        lept_set_number(lept_set_object_value(r, "ns_per_value", 12), ns / (double)values);
+        lept_set_number(lept_set_object_value(r, "allocs_per_op", 13), (double)allocations / (double)count);
+    }
+    lept_free(&d.v);
+    lept_free(&d.other);
+    lept_free(&d.compact);
+    free(d.cbor);
+    free(d.msgpack);
+    free(json);
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    bench b;
+    size_t scale = 1;
+    int i, files = 0, ret = 0;
+    b.json = 0;
+    b.time = 0.2;
+    lept_init(&b.report);
+    lept_set_array(&b.report, 0);
+    lept_init(&b.corpora);
+    lept_set_array(&b.corpora, 0);
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0)
+            b.json = 1;
+        else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc)
+            b.time = atof(argv[++i]);
+        else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc)
+            scale = (size_t)atol(argv[++i]);
+        else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [--json] [--time seconds] [--scale n] [file.json ...]\n", argv[0]);
+            return 1;
+        }
+        else {
+            buffer f;
+            memset(&f, 0, sizeof(f));
+            if (!read_file(&f, argv[i])) {
+                fprintf(stderr, "%s: cannot read\n", argv[i]);
+                return 1;
+            }
+            if (!measure(&b, argv[i], f.s, f.len))
+                ret = 1;
+            files++;
+        }
+    }
+    if (files == 0) {
+        static void (*makers[6])(buffer*, size_t) = { make_twitter, make_canada, make_citm, make_numbers, make_deep, make_wide };
+        static const char* names[6] = { "twitter", "canada", "citm_catalog", "numbers", "deep", "wide" };
+        for (i = 0; i < 6; i++) {
+            buffer corpus;
+            memset(&corpus, 0, sizeof(corpus));
+            seed = 1;
+            makers[i](&corpus, scale);
+            measure(&b, names[i], corpus.s, corpus.len);
+        }
+    }
+    if (b.json) {
+        lept_value out, *v;
+        char* s;
+        lept_init(&out);
+        lept_set_object(&out, 4);
+#ifdef LEPT_COMPACT_VALUE
+        lept_set_string(lept_set_object_value(&out, "layout", 6), "compact", 7);
+#else
+        lept_set_string(lept_set_object_value(&out, "layout", 6), "default", 7);
+#endif
+        lept_set_number(lept_set_object_value(&out, "value_size", 10), (double)sizeof(lept_value));
+        v = lept_set_object_value(&out, "corpora", 7);
+        lept_move(v, &b.corpora);
+        v = lept_set_object_value(&out, "results", 7);
+        lept_move(v, &b.report);
+        s = lept_stringify(&out, NULL);
+        printf("%s\n", s);
+        lept_free_buffer(s);
+        lept_free(&out);
+    }
+    lept_free(&b.report);
+    lept_free(&b.corpora);
+    return ret;
+}
@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/*
+ * Deterministic JSON generator: the same options and seed give the same bytes on every
+ * platform, so documents can be regenerated instead of shipped. The output is streamed,
+ * which keeps memory flat for GB-sized documents:
+ *
+ *   leptjson_gen [options] > corpus.json
+ *
+ * The root is an array of values, appended until the output reaches --size; the containers
+ * open at that point are closed early.
+ */
+
+typedef struct {
+    uint64_t seed;
+    uint64_t size;              /* bytes, exceeded by at most the closing brackets and the last scalar */
+    unsigned depth;             /* maximum nesting below the root array */
+    unsigned fanout;            /* mean number of elements / members, drawn from 0 .. 2 * fanout */
+    double containers;          /* chance for a value to be an array or an object while depth allows */
+    unsigned string_min, string_max;    /* string lengths in characters, log-uniform */
+    double escapes;             /* chance for a string character to be escaped */
+    double unicode;             /* chance for a string character to be non-ASCII UTF-8 */
+    unsigned ints, floats, exponents;   /* weights of the number forms */
+    unsigned keys;              /* size of the key vocabulary, 0 for unique keys */
+}options;
+
+static uint64_t state;
+
+static uint64_t next() { /* splitmix64 */
+    uint64_t z = (state += UINT64_C(0x9E3779B97F4A7C15));
+    z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+    return z ^ (z >> 31);
+}
+
+static uint64_t pick(uint64_t n) {
+    return n == 0 ? 0 : next() % n;
+}
+
+static double chance() {
+    return (double)(next() >> 11) / 9007199254740992.0;  /* [0, 1) */
+}
+
+/* Output */
+
+static char out[65536];
+static size_t out_len;
+static uint64_t written;
+
+static void flush() {
+    fwrite(out, 1, out_len, stdout);
+    out_len = 0;
+}
+
+static void put(const char* s, size_t len) {
+    if (out_len + len > sizeof(out))
+        flush();
+    memcpy(out + out_len, s, len);
+    out_len += len;
+    written += len;
+}
+
+static void putc_(char ch) {
+    if (out_len == sizeof(out))
+        flush();
+    out[out_len++] = ch;
+    written++;
+}
+
+static void puts_(const char* s) {
+    put(s, strlen(s));
+}
+
+static void put_digits(unsigned n, int first_nonzero) {
+    unsigned i;
+    for (i = 0; i < n; i++)
+        putc_((char)(i == 0 && first_nonzero ? '1' + pick(9) : '0' + pick(10)));
+}
+
+/* Values */
+
+static void put_number(const options* o) {
+    uint64_t form = pick(o->ints + o->floats + o->exponents);
+    if (pick(4) == 0)
+        putc_('-');
+    if (form < o->ints) {
+        /* magnitudes spread evenly over 1 to 18 digits */
+        unsigned digits = 1 + (unsigned)pick(18);
+        if (digits == 1)
+            putc_((char)('0' + pick(10)));
+        else
+            put_digits(digits, 1);
+    }
+    else if (form < o->ints + o->floats) {
+        if (pick(3) == 0)
+            putc_('0');
+        else
+            put_digits(1 + (unsigned)pick(6), 1);
+        putc_('.');
+        put_digits(1 + (unsigned)pick(17), 0);
+    }
+    else {
+        char exponent[8];
+        put_digits(1, 1);
+        if (pick(2)) {
+            putc_('.');
+            put_digits(1 + (unsigned)pick(16), 0);
+        }
+        putc_(pick(2) ? 'e' : 'E');
+        if (pick(2))
+            putc_(pick(2) ? '-' : '+');
+        put(exponent, (size_t)sprintf(exponent, "%u", (unsigned)pick(300)));
+    }
+}
+
+static unsigned string_length(const options* o) {
+    /* log-uniform without libm: a decade of lengths is picked first, then a length in it */
+    uint64_t lo = (uint64_t)o->string_min + 1, end = (uint64_t)o->string_max + 2, top, decades = 1;
+    for (top = lo; top * 10 < end; top *= 10)
+        decades++;
+    for (top = pick(decades); top > 0; top--)
+        lo *= 10;
+    top = lo * 10 < end ? lo * 10 : end;
+    return (unsigned)(lo + pick(top - lo) - 1);
+}
+
+static void put_utf8(unsigned u) {
+    if (u < 0x800) {
+        putc_((char)(0xC0 | (u >> 6)));
+    }
+    else if (u < 0x10000) {
+        putc_((char)(0xE0 | (u >> 12)));
+        putc_((char)(0x80 | ((u >> 6) & 0x3F)));
+    }
+    else {
+        putc_((char)(0xF0 | (u >> 18)));
+        putc_((char)(0x80 | ((u >> 12) & 0x3F)));
+        putc_((char)(0x80 | ((u >> 6) & 0x3F)));
+    }
+    putc_((char)(0x80 | (u & 0x3F)));
+}
+
+static void put_string(const options* o, unsigned len) {
+    static const char* escapes[] = { "\\\"", "\\\\", "\\/", "\\b", "\\f", "\\n", "\\r", "\\t" };
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789   ";
+    unsigned i;
+    char hex[16];
+    putc_('"');
+    for (i = 0; i < len; i++) {
+        double r = chance();
+        if (r < o->escapes) {
+            switch (pick(4)) {
+                case 0:
+                case 1:
+                    puts_(escapes[pick(8)]);
+                    break;
+                case 2:
+                    put(hex, (size_t)sprintf(hex, "\\u%04X", (unsigned)(0x20 + pick(0xD800 - 0x20))));
+                    break;
+                default:
+                    put(hex, (size_t)sprintf(hex, "\\u%04X\\u%04X", (unsigned)(0xD800 + pick(0x400)), (unsigned)(0xDC00 + pick(0x400))));
+                    break;
+            }
+        }
+        else if (r < o->escapes + o->unicode) {
+            switch (pick(3)) {
+                case 0:  put_utf8((unsigned)(0x80 + pick(0x800 - 0x80))); break;
+                case 1:  put_utf8((unsigned)(0x3040 + pick(0x9FFF - 0x3040))); break;  /* kana and CJK */
+                default: put_utf8((unsigned)(0x1F300 + pick(0x300))); break;           /* emoji */
+            }
+        }
+        else
+            putc_(alphabet[pick(sizeof(alphabet) - 1)]);
+    }
+    putc_('"');
+}
+
+static void put_key(uint64_t index) {
+    /* words spelled from the index, so that a vocabulary is the same for every seed */
+    static const char* syllables[] = { "id", "na", "me", "ur", "ti", "co", "lo", "va", "se", "ra", "de", "ta", "ex", "po", "ku", "mi" };
+    putc_('"');
+    do {
+        puts_(syllables[index % 16]);
+        index /= 16;
+    } while (index != 0);
+    putc_('"');
+}
+
+typedef struct {
+    int object;
+    uint64_t count, index;
+    uint64_t first_key;     /* members take consecutive words of the vocabulary, so keys are unique */
+}frame;
+
+static void generate(const options* o) {
+    frame* stack = (frame*)malloc((o->depth + 1) * sizeof(frame));
+    size_t top = 0;
+    uint64_t unique = 0;
+    putc_('[');
+    stack[0].object = 0;
+    stack[0].index = 0;
+    for (;;) {
+        frame* f = &stack[top];
+        /* once the size is reached every open container is closed */
+        if ((written >= o->size && (top > 0 || f->index > 0)) || (top > 0 && f->index == f->count)) {
+            putc_(f->object ? '}' : ']');
+            if (top-- == 0)
+                break;
+            continue;
+        }
+        if (f->index++ > 0)
+            putc_(',');
+        if (f->object) {
+            put_key(o->keys == 0 ? unique++ : (f->first_key + f->index - 1) % o->keys);
+            putc_(':');
+        }
+        if (top < o->depth && chance() < o->containers) {
+            frame* c = &stack[++top];
+            c->object = (int)pick(2);
+            c->count = pick(2 * (uint64_t)o->fanout + 1);
+            c->index = 0;
+            if (c->object && o->keys != 0) {
+                if (c->count > o->keys)
+                    c->count = o->keys;
+                c->first_key = pick(o->keys);
+            }
+            putc_(c->object ? '{' : '[');
+            continue;
+        }
+        switch (pick(8)) {
+            case 0:  puts_("null"); break;
+            case 1:  puts_(pick(2) ? "true" : "false"); break;
+            case 2:
+            case 3:
+            case 4:  put_number(o); break;
+            default: put_string(o, string_length(o)); break;
+        }
+    }
+    putc_('\n');
+    flush();
+    free(stack);
+}
+
+/* Options */
+
+static int parse_size(const char* s, uint64_t* size) {
+    char* end;
+    double n = strtod(s, &end);
+    switch (*end) {
+        case 'k': case 'K': n *= 1024.0; end++; break;
+        case 'm': case 'M': n *= 1024.0 * 1024.0; end++; break;
+        case 'g': case 'G': n *= 1024.0 * 1024.0 * 1024.0; end++; break;
+        default: break;
+    }
+    *size = (uint64_t)n;
+    return end != s && *end == '\0' && n >= 0.0;
+}
+
+static int parse_range(const char* s, unsigned* lo, unsigned* hi) {
+    return sscanf(s, "%u:%u", lo, hi) == 2 && *lo <= *hi;
+}
+
+static void usage(const char* name) {
+    static const char* lines[] = {
+        "  --seed N            random seed (1)",
+        "  --size N[K|M|G]     output size (1M)",
+        "  --depth N           maximum nesting (4)",
+        "  --fanout N          mean elements / members per container (8)",
+        "  --containers P      chance for a value to be an array or object (0.3)",
+        "  --string MIN:MAX    string length range, log-uniform (0:64)",
+        "  --escapes P         chance for a string character to be escaped (0.02)",
+        "  --unicode P         chance for a string character to be non-ASCII (0.05)",
+        "  --numbers I:F:E     weights of integers, fractions and exponents (6:3:1)",
+        "  --keys N            key vocabulary, 0 for unique keys (64)"
+    };
+    size_t i;
+    fprintf(stderr, "usage: %s [options] > corpus.json\n", name);
+    for (i = 0; i < sizeof(lines) / sizeof(lines[0]); i++)
+        fprintf(stderr, "%s\n", lines[i]);
+}
+
+int main(int argc, char* argv[]) {
+    options o;
+    int i, ok = 1;
+    o.seed = 1;
+    o.size = 1024 * 1024;
+    o.depth = 4;
+    o.fanout = 8;
+    o.containers = 0.3;
+    o.string_min = 0;
+    o.string_max = 64;
+    o.escapes = 0.02;
+    o.unicode = 0.05;
+    o.ints = 6;
+    o.floats = 3;
+    o.exponents = 1;
+    o.keys = 64;
+    for (i = 1; i < argc && ok; i++) {
+        const char* a = argv[i], *v = i + 1 < argc ? argv[i + 1] : NULL;
+        if (v == NULL)
+            ok = 0;
+        else if (strcmp(a, "--seed") == 0)
+            o.seed = (uint64_t)strtod(v, NULL);
+        else if (strcmp(a, "--size") == 0)
+            ok = parse_size(v, &o.size);
+        else if (strcmp(a, "--depth") == 0)
+            o.depth = (unsigned)atoi(v);
+        else if (strcmp(a, "--fanout") == 0)
+            o.fanout = (unsigned)atoi(v);
+        else if (strcmp(a, "--containers") == 0)
+            o.containers = atof(v);
+        else if (strcmp(a, "--string") == 0)
+            ok = parse_range(v, &o.string_min, &o.string_max);
+        else if (strcmp(a, "--escapes") == 0)
+            o.escapes = atof(v);
+        else if (strcmp(a, "--unicode") == 0)
+            o.unicode = atof(v);
+        else if (strcmp(a, "--numbers") == 0)
+            ok = sscanf(v, "%u:%u:%u", &o.ints, &o.floats, &o.exponents) == 3 && o.ints + o.floats + o.exponents > 0;
+        else if (strcmp(a, "--keys") == 0)
+            o.keys = (unsigned)atoi(v);
+        else
+            ok = 0;
+        i++;
+    }
+    if (!ok) {
+        usage(argv[0]);
+        return 1;
+    }
+    state = o.seed;
+    generate(&o);
+    return 0;
+}
@@ -1,14 +1,31 @@
 #ifdef _WINDOWS
 #define _CRTDBG_MAP_ALLOC
 #include <crtdbg.h>
+#else
+#define _POSIX_C_SOURCE 200112L /* posix_madvise(), sysconf() */
 #endif
 #include "leptjson.h"
 #include <assert.h>  /* assert() */
-#include <errno.h>   /* errno, ERANGE */
+#include <errno.h>   /* errno, ERANGE, EINTR */
+#include <float.h>   /* FLT_MAX */
 #include <math.h>    /* HUGE_VAL */
-#include <stdio.h>   /* sprintf() */
+#include <stdio.h>   /* sprintf(), fopen() */
 #include <stdlib.h>  /* NULL, malloc(), realloc(), free(), strtod() */
 #include <string.h>  /* memcpy() */
+#include <stdint.h>  /* uint64_t, UINT64_C() */
+#include <fcntl.h>   /* open() */
+#if defined(LEPT_PARSE_STATS_TIMING) && !defined(_WINDOWS)
+#include <time.h>    /* clock_gettime() */
+#endif
+#ifdef _WINDOWS
+#include <io.h>      /* _open(), _read(), _write(), _close() */
+#include <windows.h> /* CRITICAL_SECTION */
+#else
+#include <pthread.h> /* pthread_mutex_t */
+#include <sys/mman.h> /* mmap(), munmap(), posix_madvise() */
+#include <sys/stat.h> /* fstat() */
+#include <unistd.h>  /* read(), write(), close(), sysconf() */
+#endif
 
 #ifndef LEPT_PARSE_STACK_INIT_SIZE
 #define LEPT_PARSE_STACK_INIT_SIZE 256
@@ -18,16 +35,160 @@
 #define LEPT_PARSE_STRINGIFY_INIT_SIZE 256
 #endif
 
+#ifndef LEPT_STRINGIFY_FLUSH_SIZE
+#define LEPT_STRINGIFY_FLUSH_SIZE 4096
+#endif
+
+#ifndef LEPT_STRINGIFY_IOV_MIN
+#define LEPT_STRINGIFY_IOV_MIN 64
+#endif
+
+#ifndef LEPT_WALK_LOCAL_DEPTH
+#define LEPT_WALK_LOCAL_DEPTH 32
+#endif
+
+#ifndef LEPT_PARSE_FILE_CHUNK
+#define LEPT_PARSE_FILE_CHUNK (1 << 20)
+#endif
+
+#ifndef LEPT_EQUAL_HASH_THRESHOLD
+#define LEPT_EQUAL_HASH_THRESHOLD 16
+#endif
+
+/* allocator cost per block assumed by lept_memory_usage(): a size word, rounded up to the alignment */
+#ifndef LEPT_MALLOC_HEADER
+#define LEPT_MALLOC_HEADER sizeof(size_t)
+#endif
+
+#ifndef LEPT_MALLOC_ALIGN
+#define LEPT_MALLOC_ALIGN (2 * sizeof(void*))
+#endif
+
+/*
+ * allocator, overridden as a set, e.g. -DLEPT_MALLOC=my_malloc -DLEPT_REALLOC=my_realloc -DLEPT_FREE=my_free;
+ * buffers handed to the caller come from it too and go back through lept_free_buffer()
+ */
+#ifndef LEPT_MALLOC
+#define LEPT_MALLOC  malloc
+#define LEPT_REALLOC realloc
+#define LEPT_FREE    free
+#else
+void* LEPT_MALLOC(size_t size);
+void* LEPT_REALLOC(void* p, size_t size);
+void LEPT_FREE(void* p);
+#endif
+
+/* parse statistics, see lept_parse_stats; the timing implies the counters */
+#if defined(LEPT_PARSE_STATS_TIMING) && !defined(LEPT_PARSE_STATS)
+#define LEPT_PARSE_STATS
+#endif
+
+static void* lept_calloc(size_t count, size_t size) {
+    void* p = LEPT_MALLOC(count * size);
+    return memset(p, 0, count * size);
+}
+
+/*
+ * Strings and array / object buffers start after a size_t reference count, so that
+ * lept_copy() can share them. A buffer is copied before it is written while shared.
+ */
+#define LEPT_REFS(p)            (((size_t*)(p))[-1])
+#define LEPT_STRING_FREE(s)     LEPT_FREE((size_t*)(s) - 1)
+
+#ifdef LEPT_COMPACT_VALUE
+#define LEPT_STRING_LEN(v)      ((v)->size)
+#define LEPT_ARRAY_SIZE(v)      ((v)->size)
+#define LEPT_OBJECT_SIZE(v)     ((v)->size)
+/* array and object buffers also carry their capacity, just before the reference count */
+#define LEPT_BUFFER_WORDS       2
+#define LEPT_ARRAY_CAPACITY(v)  ((v)->u.a.e != NULL ? ((size_t*)(v)->u.a.e)[-2] : 0)
+#define LEPT_OBJECT_CAPACITY(v) ((v)->u.o.m != NULL ? ((size_t*)(v)->u.o.m)[-2] : 0)
+#else
+#define LEPT_STRING_LEN(v)      ((v)->u.s.len)
+#define LEPT_ARRAY_SIZE(v)      ((v)->u.a.size)
+#define LEPT_OBJECT_SIZE(v)     ((v)->u.o.size)
+#define LEPT_BUFFER_WORDS       1
+#define LEPT_ARRAY_CAPACITY(v)  ((v)->u.a.capacity)
+#define LEPT_OBJECT_CAPACITY(v) ((v)->u.o.capacity)
+#endif
+#define LEPT_BUFFER_FREE(p)     do { if ((p) != NULL) LEPT_FREE((size_t*)(p) - LEPT_BUFFER_WORDS); } while(0)
+
+#if !defined(LEPT_ATOMIC_REFCOUNT)
+#define LEPT_RETAIN(p)          ((void)++LEPT_REFS(p))
+#define LEPT_RELEASE(p)         (--LEPT_REFS(p))
+#define LEPT_REFS_LOAD(p)       LEPT_REFS(p)
+#elif defined(_WINDOWS) && defined(_WIN64)
+#define LEPT_RETAIN(p)          ((void)InterlockedIncrement64((LONG64 volatile*)&LEPT_REFS(p)))
+#define LEPT_RELEASE(p)         ((size_t)InterlockedDecrement64((LONG64 volatile*)&LEPT_REFS(p)))
+#define LEPT_REFS_LOAD(p)       (*(size_t volatile*)&LEPT_REFS(p))
+#elif defined(_WINDOWS)
+#define LEPT_RETAIN(p)          ((void)InterlockedIncrement((LONG volatile*)&LEPT_REFS(p)))
+#define LEPT_RELEASE(p)         ((size_t)InterlockedDecrement((LONG volatile*)&LEPT_REFS(p)))
+#define LEPT_REFS_LOAD(p)       (*(size_t volatile*)&LEPT_REFS(p))
+#else
+#define LEPT_RETAIN(p)          ((void)__atomic_add_fetch(&LEPT_REFS(p), 1, __ATOMIC_RELAXED))
+#define LEPT_RELEASE(p)         __atomic_sub_fetch(&LEPT_REFS(p), 1, __ATOMIC_ACQ_REL)
+#define LEPT_REFS_LOAD(p)       __atomic_load_n(&LEPT_REFS(p), __ATOMIC_ACQUIRE)
+#endif
+
+/*
+ * A lept_compact() block holds many buffers in one allocation, after a header of its size and its
+ * reference count. Each buffer inside has the usual header, preceded by its offset from the block,
+ * and LEPT_REFS_BLOCK as its reference count: references to it are counted by the block, and a mutator
+ * always finds it shared and copies out what it writes.
+ */
+#define LEPT_REFS_BLOCK         ((size_t)-1)
+#define LEPT_BLOCK_OF(p)        ((char*)(p) - ((size_t*)(p))[-1 - LEPT_BUFFER_WORDS])
+#define LEPT_BLOCK_SIZE(b)      (((size_t*)(b))[-2])
+#define LEPT_BLOCK_FREE(b)      LEPT_FREE((size_t*)(b) - 2)
+#define LEPT_BLOCK_ALIGN        (sizeof(double) > sizeof(size_t) ? sizeof(double) : sizeof(size_t))
+#define LEPT_BLOCK_ROUND(n)     (((n) + LEPT_BLOCK_ALIGN - 1) / LEPT_BLOCK_ALIGN * LEPT_BLOCK_ALIGN)
+#define LEPT_BLOCK_HEADER       LEPT_BLOCK_ROUND((LEPT_BUFFER_WORDS + 1) * sizeof(size_t))
+
+#define LEPT_FLAG_PACKED        0x1 /* array: elements are stored as a double[] */
+#define LEPT_IS_PACKED(v)       ((v)->type == LEPT_ARRAY && ((v)->flags & LEPT_FLAG_PACKED))
+#define LEPT_ARRAY_DOUBLES(v)   ((double*)(v)->u.a.e)
+#define LEPT_FLAG_NO_ESCAPE     0x2 /* string: contains no character that stringify must escape */
+#define LEPT_NO_ESCAPE(v)       (((v)->flags & LEPT_FLAG_NO_ESCAPE) != 0)
+
 #define EXPECT(c, ch)       do { assert(*c->json == (ch)); c->json++; } while(0)
 #define ISDIGIT(ch)         ((ch) >= '0' && (ch) <= '9')
 #define ISDIGIT1TO9(ch)     ((ch) >= '1' && (ch) <= '9')
 #define PUTC(c, ch)         do { *(char*)lept_context_push(c, sizeof(char)) = (ch); } while(0)
 #define PUTS(c, s, len)     memcpy(lept_context_push(c, len), s, len)
 
-typedef struct {
+#ifdef LEPT_PARSE_STATS
+#define STAT(c, stmt)       do { if ((c)->stats != NULL) { stmt; } } while(0)
+#define STAT_MAX(c, field, n)   STAT(c, if ((n) > (c)->stats->field) (c)->stats->field = (n))
+#define STAT_ALLOC(c, bytes)    STAT(c, (c)->stats->allocs++; (c)->stats->alloc_bytes += (bytes))
+#else
+#define STAT(c, stmt)       do { } while(0)
+#define STAT_MAX(c, field, n)   do { } while(0)
+#define STAT_ALLOC(c, bytes)    do { } while(0)
+#endif
+#ifdef LEPT_PARSE_STATS_TIMING
+#define STAT_START(c)       STAT(c, (c)->clock = lept_clock())
+#define STAT_STOP(c, field) STAT(c, (c)->stats->field += lept_clock() - (c)->clock)
+#else
+#define STAT_START(c)       do { } while(0)
+#define STAT_STOP(c, field) do { } while(0)
+#endif
+
+typedef struct lept_context {
     const char* json;
     char* stack;
     size_t size, top;
+    size_t frame, depth;    /* innermost open container, number of open containers */
+    unsigned flags;         /* LEPT_PARSE_* */
+    lept_write_fn write;    /* stringify: output sink, or NULL to keep everything on the stack */
+    void* sink;
+    int error;              /* stringify: first non-zero result of write */
+    struct lept_context* iov;   /* stringify: lept_iov_piece list, or NULL */
+    size_t mark;            /* stringify: start of the stack bytes not yet in the iov list */
+#ifdef LEPT_PARSE_STATS
+    lept_parse_stats* stats;    /* parse: statistics to fill in, or NULL */
+    double clock;           /* parse: start of the string or number being timed */
+#endif
 }lept_context;
 
 static void* lept_context_push(lept_context* c, size_t size) {
@@ -38,7 +199,7 @@ static void* lept_context_push(lept_context* c, size_t size) {
             c->size = LEPT_PARSE_STACK_INIT_SIZE;
         while (c->top + size >= c->size)
             c->size += c->size >> 1;  /* c->size * 1.5 */
-        c->stack = (char*)realloc(c->stack, c->size);
+        c->stack = (char*)LEPT_REALLOC(c->stack, c->size);
     }
     ret = c->stack + c->top;
     c->top += size;
@@ -50,6 +211,21 @@ static void* lept_context_pop(lept_context* c, size_t size) {
     return c->stack + (c->top -= size);
 }
 
+#ifdef LEPT_PARSE_STATS_TIMING
+static double lept_clock(void) {
+#ifdef _WINDOWS
+    LARGE_INTEGER t, f;
+    QueryPerformanceCounter(&t);
+    QueryPerformanceFrequency(&f);
+    return (double)t.QuadPart / (double)f.QuadPart;
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+#endif
+}
+#endif
+
 static void lept_parse_whitespace(lept_context* c) {
     const char *p = c->json;
     while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
@@ -70,6 +246,7 @@ static int lept_parse_literal(lept_context* c, lept_value* v, const char* litera
 
 static int lept_parse_number(lept_context* c, lept_value* v) {
     const char* p = c->json;
+    STAT_START(c);
     if (*p == '-') p++;
     if (*p == '0') p++;
     else {
@@ -89,6 +266,7 @@ static int lept_parse_number(lept_context* c, lept_value* v) {
     }
     errno = 0;
     v->u.n = strtod(c->json, NULL);
+    STAT_STOP(c, number_seconds);
     if (errno == ERANGE && (v->u.n == HUGE_VAL || v->u.n == -HUGE_VAL))
         return LEPT_PARSE_NUMBER_TOO_BIG;
     v->type = LEPT_NUMBER;
@@ -131,7 +309,7 @@ static void lept_encode_utf8(lept_context* c, unsigned u) {
     }
 }
 
-#define STRING_ERROR(ret) do { c->top = head; return ret; } while(0)
+#define STRING_ERROR(ret) do { STAT_MAX(c, stack_peak, c->top); c->top = head; return ret; } while(0)
 
 static int lept_parse_string_raw(lept_context* c, char** str, size_t* len) {
     size_t head = c->top;
@@ -143,6 +321,7 @@ static int lept_parse_string_raw(lept_context* c, char** str, size_t* len) {
         char ch = *p++;
         switch (ch) {
             case '\"':
+                STAT_MAX(c, stack_peak, c->top);
                 *len = c->top - head;
                 *str = lept_context_pop(c, *len);
                 c->json = p;
@@ -191,506 +370,3815 @@ static int lept_parse_string(lept_context* c, lept_value* v) {
     int ret;
     char* s;
     size_t len;
-    if ((ret = lept_parse_string_raw(c, &s, &len)) == LEPT_PARSE_OK)
+    const char* start = c->json;
+    STAT_START(c);
+    if ((ret = lept_parse_string_raw(c, &s, &len)) == LEPT_PARSE_OK) {
         lept_set_string(v, s, len);
+        STAT_ALLOC(c, sizeof(size_t) + len + 1);
+        /* every escape sequence is longer than what it decodes to */
+        if ((size_t)(c->json - start) == len + 2)
+            v->flags |= LEPT_FLAG_NO_ESCAPE;
+    }
+    STAT_STOP(c, string_seconds);
     return ret;
 }
 
-static int lept_parse_value(lept_context* c, lept_value* v);
-
-static int lept_parse_array(lept_context* c, lept_value* v) {
-    size_t i, size = 0;
-    int ret;
-    EXPECT(c, '[');
-    lept_parse_whitespace(c);
-    if (*c->json == ']') {
-        c->json++;
-        lept_set_array(v, 0);
-        return LEPT_PARSE_OK;
+static int lept_parse_value(lept_context* c, lept_value* v) {
+    switch (*c->json) {
+        case 't':  return lept_parse_literal(c, v, "true", LEPT_TRUE);
+        case 'f':  return lept_parse_literal(c, v, "false", LEPT_FALSE);
+        case 'n':  return lept_parse_literal(c, v, "null", LEPT_NULL);
+        default:   return lept_parse_number(c, v);
+        case '"':  return lept_parse_string(c, v);
+        case '\0': return LEPT_PARSE_EXPECT_VALUE;
     }
-    for (;;) {
-        lept_value e;
-        lept_init(&e);
-        if ((ret = lept_parse_value(c, &e)) != LEPT_PARSE_OK)
-            break;
-        memcpy(lept_context_push(c, sizeof(lept_value)), &e, sizeof(lept_value));
-        size++;
-        lept_parse_whitespace(c);
-        if (*c->json == ',') {
-            c->json++;
-            lept_parse_whitespace(c);
-        }
-        else if (*c->json == ']') {
-            c->json++;
-            lept_set_array(v, size);
-            memcpy(v->u.a.e, lept_context_pop(c, size * sizeof(lept_value)), size * sizeof(lept_value));
-            v->u.a.size = size;
-            return LEPT_PARSE_OK;
+}
+
+static double* lept_set_packed_array(lept_value* v, size_t size);
+
+#define LEPT_NO_FRAME ((size_t)-1)
+
+/*
+ * An open array or object. It sits on the context stack and is followed by
+ * the elements (lept_value) or members (lept_member) parsed so far.
+ */
+typedef struct {
+    size_t parent;  /* stack offset of the enclosing frame, or LEPT_NO_FRAME */
+    size_t slot;    /* stack offset of the value receiving this container, or LEPT_NO_FRAME for the root */
+    size_t size;    /* elements / members pushed after this frame */
+    lept_type type;
+}lept_parse_frame;
+
+#define FRAME(c) ((lept_parse_frame*)((c)->stack + (c)->frame))
+#define SLOT(c, root, slot) ((slot) == LEPT_NO_FRAME ? (root) : (lept_value*)((c)->stack + (slot)))
+
+static void lept_parse_push_frame(lept_context* c, size_t slot, lept_type type) {
+    size_t offset = c->top;
+    lept_parse_frame* f = (lept_parse_frame*)lept_context_push(c, sizeof(lept_parse_frame));
+    f->parent = c->frame;
+    f->slot = slot;
+    f->size = 0;
+    f->type = type;
+    c->frame = offset;
+    c->depth++;
+}
+
+/* Pops the innermost frame and returns the offset of the value it was destined for */
+static size_t lept_parse_pop_frame(lept_context* c, lept_value* v) {
+    lept_parse_frame* f = FRAME(c);
+    size_t i, n = f->size, slot = f->slot;
+    STAT_MAX(c, stack_peak, c->top);
+    if (f->type == LEPT_ARRAY) {
+        lept_value* e = (lept_value*)lept_context_pop(c, n * sizeof(lept_value));
+        for (i = 0; i < n && e[i].type == LEPT_NUMBER; i++);
+        if (n > 0 && i == n && (c->flags & LEPT_PARSE_PACK_NUMBERS)) {
+            double* d = lept_set_packed_array(v, n);
+            for (i = 0; i < n; i++)
+                d[i] = e[i].u.n;
+            STAT_ALLOC(c, LEPT_BUFFER_WORDS * sizeof(size_t) + n * sizeof(double));
         }
         else {
-            ret = LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
-            break;
+            lept_set_array(v, n);
+            memcpy(v->u.a.e, e, n * sizeof(lept_value));
+            LEPT_ARRAY_SIZE(v) = n;
+            STAT_ALLOC(c, LEPT_BUFFER_WORDS * sizeof(size_t) + n * sizeof(lept_value));
         }
     }
-    /* Pop and free values on the stack */
-    for (i = 0; i < size; i++)
-        lept_free((lept_value*)lept_context_pop(c, sizeof(lept_value)));
-    return ret;
+    else {
+        lept_set_object(v, n);
+        memcpy(v->u.o.m, lept_context_pop(c, n * sizeof(lept_member)), n * sizeof(lept_member));
+        LEPT_OBJECT_SIZE(v) = n;
+        STAT_ALLOC(c, LEPT_BUFFER_WORDS * sizeof(size_t) + n * sizeof(lept_member));
+    }
+    c->frame = FRAME(c)->parent;
+    lept_context_pop(c, sizeof(lept_parse_frame));
+    c->depth--;
+    return slot;
 }
 
-static int lept_parse_object(lept_context* c, lept_value* v) {
-    size_t i, size;
-    lept_member m;
-    int ret;
-    EXPECT(c, '{');
-    lept_parse_whitespace(c);
-    if (*c->json == '}') {
-        c->json++;
-        lept_set_object(v, 0);
-        return LEPT_PARSE_OK;
+/* Pop and free every open frame and what has been parsed into it */
+static void lept_parse_unwind(lept_context* c) {
+    size_t i;
+    STAT_MAX(c, stack_peak, c->top);
+    while (c->frame != LEPT_NO_FRAME) {
+        lept_parse_frame* f = FRAME(c);
+        for (i = 0; i < f->size; i++) {
+            if (f->type == LEPT_ARRAY)
+                lept_free((lept_value*)lept_context_pop(c, sizeof(lept_value)));
+            else {
+                lept_member* m = (lept_member*)lept_context_pop(c, sizeof(lept_member));
+                LEPT_FREE(m->k);
+                lept_free(&m->v);
+            }
+        }
+        c->frame = f->parent;
+        lept_context_pop(c, sizeof(lept_parse_frame));
     }
-    m.k = NULL;
-    size = 0;
-    for (;;) {
-        char* str;
-        lept_init(&m.v);
+    c->depth = 0;
+}
+
+/* Pushes an empty element or a keyed member into the innermost frame and returns the offset of its value */
+static int lept_parse_push_slot(lept_context* c, size_t* slot) {
+    if (FRAME(c)->type == LEPT_ARRAY) {
+        *slot = c->top;
+        lept_init((lept_value*)lept_context_push(c, sizeof(lept_value)));
+        FRAME(c)->size++;
+    }
+    else {
+        lept_member* m;
+        char* str, *key;
+        size_t klen;
+        int ret;
         /* parse key */
-        if (*c->json != '"') {
-            ret = LEPT_PARSE_MISS_KEY;
-            break;
-        }
-        if ((ret = lept_parse_string_raw(c, &str, &m.klen)) != LEPT_PARSE_OK)
-            break;
-        memcpy(m.k = (char*)malloc(m.klen + 1), str, m.klen);
-        m.k[m.klen] = '\0';
+        if (*c->json != '"')
+            return LEPT_PARSE_MISS_KEY;
+        STAT_START(c);
+        ret = lept_parse_string_raw(c, &str, &klen);
+        STAT_STOP(c, string_seconds);
+        if (ret != LEPT_PARSE_OK)
+            return ret;
+        memcpy(key = (char*)LEPT_MALLOC(klen + 1), str, klen);
+        key[klen] = '\0';
+        STAT_ALLOC(c, klen + 1);
+        *slot = c->top;
+        m = (lept_member*)lept_context_push(c, sizeof(lept_member));
+        m->k = key;
+        m->klen = klen;
+        lept_init(&m->v);
+        FRAME(c)->size++;
+        *slot += offsetof(lept_member, v);
         /* parse ws colon ws */
         lept_parse_whitespace(c);
-        if (*c->json != ':') {
-            ret = LEPT_PARSE_MISS_COLON;
-            break;
-        }
+        if (*c->json != ':')
+            return LEPT_PARSE_MISS_COLON;
         c->json++;
         lept_parse_whitespace(c);
-        /* parse value */
-        if ((ret = lept_parse_value(c, &m.v)) != LEPT_PARSE_OK)
-            break;
-        memcpy(lept_context_push(c, sizeof(lept_member)), &m, sizeof(lept_member));
-        size++;
-        m.k = NULL; /* ownership is transferred to member on stack */
-        /* parse ws [comma | right-curly-brace] ws */
-        lept_parse_whitespace(c);
-        if (*c->json == ',') {
+    }
+    return LEPT_PARSE_OK;
+}
+
+/*
+ * Parses a whole value tree without recursion: open arrays and objects are
+ * kept as frames on the context stack, so the nesting depth is only bounded
+ * by memory (and by max_depth when it is non-zero).
+ */
+static int lept_parse_tree(lept_context* c, lept_value* root, size_t max_depth) {
+    size_t slot = LEPT_NO_FRAME;
+    int ret;
+    for (;;) {
+        lept_value v;
+        lept_init(&v);
+        /* parse a value, or open a container and go on with its first element */
+        if (*c->json == '[' || *c->json == '{') {
+            lept_type type = *c->json == '[' ? LEPT_ARRAY : LEPT_OBJECT;
+            if (max_depth != 0 && c->depth >= max_depth) {
+                ret = LEPT_PARSE_DEPTH_EXCEEDED;
+                break;
+            }
+            STAT_MAX(c, max_depth, c->depth + 1);
             c->json++;
             lept_parse_whitespace(c);
-        }
-        else if (*c->json == '}') {
+            if (*c->json != (type == LEPT_ARRAY ? ']' : '}')) {
+                lept_parse_push_frame(c, slot, type);
+                if ((ret = lept_parse_push_slot(c, &slot)) != LEPT_PARSE_OK)
+                    break;
+                continue;
+            }
             c->json++;
-            lept_set_object(v, size);
-            memcpy(v->u.o.m, lept_context_pop(c, sizeof(lept_member) * size), sizeof(lept_member) * size);
-            v->u.o.size = size;
-            return LEPT_PARSE_OK;
+            if (type == LEPT_ARRAY)
+                lept_set_array(&v, 0);
+            else
+                lept_set_object(&v, 0);
         }
-        else {
-            ret = LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+        else if ((ret = lept_parse_value(c, &v)) != LEPT_PARSE_OK)
             break;
+        /* parsing may grow the stack, so the value is only stored once complete */
+        memcpy(SLOT(c, root, slot), &v, sizeof(lept_value));
+        STAT(c, c->stats->values[v.type]++);
+        /* parse ws [comma | right bracket] ws, closing every container that ends here */
+        for (;;) {
+            if (c->frame == LEPT_NO_FRAME)
+                return LEPT_PARSE_OK;
+            lept_parse_whitespace(c);
+            if (*c->json == ',') {
+                c->json++;
+                lept_parse_whitespace(c);
+                ret = lept_parse_push_slot(c, &slot);
+                break;
+            }
+            if (*c->json != (FRAME(c)->type == LEPT_ARRAY ? ']' : '}')) {
+                ret = FRAME(c)->type == LEPT_ARRAY ? LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET : LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+                break;
+            }
+            c->json++;
+            lept_init(&v);
+            slot = lept_parse_pop_frame(c, &v);
+            memcpy(SLOT(c, root, slot), &v, sizeof(lept_value));
+            STAT(c, c->stats->values[v.type]++);
         }
+        if (ret != LEPT_PARSE_OK)
+            break;
     }
-    /* Pop and free members on the stack */
-    free(m.k);
-    for (i = 0; i < size; i++) {
-        lept_member* m = (lept_member*)lept_context_pop(c, sizeof(lept_member));
-        free(m->k);
-        lept_free(&m->v);
-    }
-    v->type = LEPT_NULL;
+    lept_parse_unwind(c);
     return ret;
 }
 
-static int lept_parse_value(lept_context* c, lept_value* v) {
-    switch (*c->json) {
-        case 't':  return lept_parse_literal(c, v, "true", LEPT_TRUE);
-        case 'f':  return lept_parse_literal(c, v, "false", LEPT_FALSE);
-        case 'n':  return lept_parse_literal(c, v, "null", LEPT_NULL);
-        default:   return lept_parse_number(c, v);
-        case '"':  return lept_parse_string(c, v);
-        case '[':  return lept_parse_array(c, v);
-        case '{':  return lept_parse_object(c, v);
-        case '\0': return LEPT_PARSE_EXPECT_VALUE;
+#ifdef LEPT_PARSE_STATS
+/* Counts the allocations of the parse stack by replaying its growth: no parser push exceeds half of the stack, so each one grows it by a single step */
+static void lept_parse_stats_stack(lept_parse_stats* stats, size_t final) {
+    size_t size;
+    for (size = LEPT_PARSE_STACK_INIT_SIZE; final != 0 && size <= final; size += size >> 1) {
+        stats->stack_reallocs++;
+        stats->allocs++;
+        stats->alloc_bytes += size;
     }
 }
+#endif
 
-int lept_parse(lept_value* v, const char* json) {
+/* Parses up to the terminating '\0', which must be at end unless end is NULL */
+static int lept_parse_range(lept_value* v, const char* json, const char* end, const lept_parse_options* options) {
     lept_context c;
     int ret;
-    assert(v != NULL);
+#ifdef LEPT_PARSE_STATS_TIMING
+    double start = 0.0;
+#endif
     c.json = json;
     c.stack = NULL;
     c.size = c.top = 0;
+    c.frame = LEPT_NO_FRAME;
+    c.depth = 0;
+    c.flags = options ? options->flags : 0;
+    if (options != NULL && options->stats != NULL)
+        memset(options->stats, 0, sizeof(lept_parse_stats));
+#ifdef LEPT_PARSE_STATS
+    c.stats = options ? options->stats : NULL;
+#endif
+#ifdef LEPT_PARSE_STATS_TIMING
+    if (c.stats != NULL)
+        start = lept_clock();
+#endif
     lept_init(v);
     lept_parse_whitespace(&c);
-    if ((ret = lept_parse_value(&c, v)) == LEPT_PARSE_OK) {
+    if ((ret = lept_parse_tree(&c, v, options ? options->max_depth : 0)) == LEPT_PARSE_OK) {
         lept_parse_whitespace(&c);
-        if (*c.json != '\0') {
-            v->type = LEPT_NULL;
+        if (*c.json != '\0' || (end != NULL && c.json != end)) {
+            lept_free(v);
             ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
         }
     }
     assert(c.top == 0);
-    free(c.stack);
+#ifdef LEPT_PARSE_STATS
+    if (c.stats != NULL) {
+        c.stats->bytes = (size_t)(c.json - json);
+        lept_parse_stats_stack(c.stats, c.size);
+    }
+#endif
+#ifdef LEPT_PARSE_STATS_TIMING
+    if (c.stats != NULL)
+        c.stats->structure_seconds = lept_clock() - start - c.stats->string_seconds - c.stats->number_seconds;
+#endif
+    LEPT_FREE(c.stack);
     return ret;
 }
 
-static void lept_stringify_string(lept_context* c, const char* s, size_t len) {
-    static const char hex_digits[] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
-    size_t i, size;
-    char* head, *p;
-    assert(s != NULL);
-    p = head = lept_context_push(c, size = len * 6 + 2); /* "\u00xx..." */
-    *p++ = '"';
-    for (i = 0; i < len; i++) {
-        unsigned char ch = (unsigned char)s[i];
-        switch (ch) {
-            case '\"': *p++ = '\\'; *p++ = '\"'; break;
-            case '\\': *p++ = '\\'; *p++ = '\\'; break;
-            case '\b': *p++ = '\\'; *p++ = 'b';  break;
-            case '\f': *p++ = '\\'; *p++ = 'f';  break;
-            case '\n': *p++ = '\\'; *p++ = 'n';  break;
-            case '\r': *p++ = '\\'; *p++ = 'r';  break;
-            case '\t': *p++ = '\\'; *p++ = 't';  break;
-            default:
-                if (ch < 0x20) {
-                    *p++ = '\\'; *p++ = 'u'; *p++ = '0'; *p++ = '0';
-                    *p++ = hex_digits[ch >> 4];
-                    *p++ = hex_digits[ch & 15];
-                }
-                else
-                    *p++ = s[i];
+int lept_parse_ex(lept_value* v, const char* json, const lept_parse_options* options) {
+    assert(v != NULL && json != NULL);
+    return lept_parse_range(v, json, NULL, options);
+}
+
+int lept_parse(lept_value* v, const char* json) {
+    return lept_parse_ex(v, json, NULL);
+}
+
+/* Reads the rest of a file into a '\0'-terminated buffer, size is the expected length or 0 if unknown */
+static char* lept_read_fd(int fd, size_t size, size_t* len) {
+    size_t capacity = size + 2, n = 0;    /* room to see end of file without growing */
+    char* buffer = (char*)LEPT_MALLOC(capacity);
+    for (;;) {
+        size_t want;
+        long r;
+        if (n + 1 == capacity)
+            buffer = (char*)LEPT_REALLOC(buffer, capacity += (capacity > LEPT_PARSE_FILE_CHUNK ? capacity : LEPT_PARSE_FILE_CHUNK));
+        /* whole chunks at chunk-aligned offsets until the last one */
+        want = capacity - 1 - n < LEPT_PARSE_FILE_CHUNK ? capacity - 1 - n : LEPT_PARSE_FILE_CHUNK;
+#ifdef _WINDOWS
+        r = _read(fd, buffer + n, (unsigned)want);
+#else
+        r = (long)read(fd, buffer + n, want);
+#endif
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            LEPT_FREE(buffer);
+            return NULL;
         }
+        if (r == 0)
+            break;
+        n += (size_t)r;
     }
-    *p++ = '"';
-    c->top -= size - (p - head);
+    buffer[n] = '\0';
+    *len = n;
+    return buffer;
 }
 
-static void lept_stringify_value(lept_context* c, const lept_value* v) {
-    size_t i;
-    switch (v->type) {
-        case LEPT_NULL:   PUTS(c, "null",  4); break;
-        case LEPT_FALSE:  PUTS(c, "false", 5); break;
-        case LEPT_TRUE:   PUTS(c, "true",  4); break;
-        case LEPT_NUMBER: c->top -= 32 - sprintf(lept_context_push(c, 32), "%.17g", v->u.n); break;
-        case LEPT_STRING: lept_stringify_string(c, v->u.s.s, v->u.s.len); break;
-        case LEPT_ARRAY:
-            PUTC(c, '[');
-            for (i = 0; i < v->u.a.size; i++) {
-                if (i > 0)
-                    PUTC(c, ',');
-                lept_stringify_value(c, &v->u.a.e[i]);
-            }
-            PUTC(c, ']');
-            break;
-        case LEPT_OBJECT:
-            PUTC(c, '{');
-            for (i = 0; i < v->u.o.size; i++) {
-                if (i > 0)
-                    PUTC(c, ',');
-                lept_stringify_string(c, v->u.o.m[i].k, v->u.o.m[i].klen);
-                PUTC(c, ':');
-                lept_stringify_value(c, &v->u.o.m[i].v);
+int lept_parse_file(lept_value* v, const char* path, const lept_parse_options* options) {
+    size_t size = 0, len;
+    char* json;
+    int fd, ret;
+    assert(v != NULL && path != NULL);
+    lept_init(v);
+#ifdef _WINDOWS
+    if ((fd = _open(path, _O_RDONLY | _O_BINARY)) < 0)
+        return LEPT_PARSE_FILE_ERROR;
+#else
+    {
+        struct stat st;
+        if ((fd = open(path, O_RDONLY)) < 0)
+            return LEPT_PARSE_FILE_ERROR;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            size = (size_t)st.st_size;
+            /* the rest of the last page reads as zero and terminates the input, so a file filling it exactly is read instead */
+            if (size % (size_t)sysconf(_SC_PAGESIZE) != 0) {
+                void* base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (base != MAP_FAILED) {
+                    close(fd);
+                    /* read ahead of the parser instead of faulting the pages in one at a time */
+                    posix_madvise(base, size, POSIX_MADV_SEQUENTIAL);
+                    posix_madvise(base, size, POSIX_MADV_WILLNEED);
+                    ret = lept_parse_range(v, (const char*)base, (const char*)base + size, options);
+                    munmap(base, size);
+                    return ret;
+                }
             }
-            PUTC(c, '}');
-            break;
-        default: assert(0 && "invalid type");
+        }
     }
+#endif
+    json = lept_read_fd(fd, size, &len);
+#ifdef _WINDOWS
+    _close(fd);
+#else
+    close(fd);
+#endif
+    if (json == NULL)
+        return LEPT_PARSE_FILE_ERROR;
+    ret = lept_parse_range(v, json, json + len, options);
+    LEPT_FREE(json);
+    return ret;
 }
 
-char* lept_stringify(const lept_value* v, size_t* length) {
-    lept_context c;
-    assert(v != NULL);
-    c.stack = (char*)malloc(c.size = LEPT_PARSE_STRINGIFY_INIT_SIZE);
-    c.top = 0;
-    lept_stringify_value(&c, v);
-    if (length)
-        *length = c.top;
-    PUTC(&c, '\0');
-    return c.stack;
+/* Eight ASCII digits, first digit in the lowest byte */
+#define LEPT_LOAD64(p) (\
+    (uint64_t)(unsigned char)(p)[0]         | (uint64_t)(unsigned char)(p)[1] <<  8 |\
+    (uint64_t)(unsigned char)(p)[2] << 16   | (uint64_t)(unsigned char)(p)[3] << 24 |\
+    (uint64_t)(unsigned char)(p)[4] << 32   | (uint64_t)(unsigned char)(p)[5] << 40 |\
+    (uint64_t)(unsigned char)(p)[6] << 48   | (uint64_t)(unsigned char)(p)[7] << 56)
+#define LEPT_IS_8DIGITS(w) (\
+    (((w) & UINT64_C(0xF0F0F0F0F0F0F0F0)) |\
+    ((((w) + UINT64_C(0x0606060606060606)) & UINT64_C(0xF0F0F0F0F0F0F0F0)) >> 4)) == UINT64_C(0x3333333333333333))
+
+static uint64_t lept_parse_8digits(uint64_t w) {
+    w -= UINT64_C(0x3030303030303030);
+    w = w * 10 + (w >> 8);
+    return (((w & UINT64_C(0x000000FF000000FF)) * UINT64_C(0x000F424000000064)) +
+        (((w >> 16) & UINT64_C(0x000000FF000000FF)) * UINT64_C(0x0000271000000001))) >> 32;
 }
 
-void lept_copy(lept_value* dst, const lept_value* src) {
-    assert(src != NULL && dst != NULL && src != dst);
-    switch (src->type) {
-        case LEPT_STRING:
-            lept_set_string(dst, src->u.s.s, src->u.s.len);
-            break;
-        case LEPT_ARRAY:
-            /* \todo */
-            break;
-        case LEPT_OBJECT:
-            /* \todo */
-            break;
-        default:
-            lept_free(dst);
-            memcpy(dst, src, sizeof(lept_value));
+/* Accumulates a run of digits into *m, eight at a time where possible */
+static const char* lept_parse_digits(const char* p, const char* end, uint64_t* m, int* digits) {
+    while (end - p >= 8) {
+        uint64_t w = LEPT_LOAD64(p);
+        if (!LEPT_IS_8DIGITS(w))
             break;
+        *m = *m * 100000000 + lept_parse_8digits(w);
+        *digits += 8;
+        p += 8;
     }
+    for (; p < end && ISDIGIT(*p); p++, (*digits)++)
+        *m = *m * 10 + (unsigned)(*p - '0');
+    return p;
 }
 
-void lept_move(lept_value* dst, lept_value* src) {
-    assert(dst != NULL && src != NULL && src != dst);
-    lept_free(dst);
-    memcpy(dst, src, sizeof(lept_value));
-    lept_init(src);
-}
-
-void lept_swap(lept_value* lhs, lept_value* rhs) {
-    assert(lhs != NULL && rhs != NULL);
-    if (lhs != rhs) {
-        lept_value temp;
-        memcpy(&temp, lhs, sizeof(lept_value));
-        memcpy(lhs,   rhs, sizeof(lept_value));
-        memcpy(rhs, &temp, sizeof(lept_value));
+static int lept_parse_double(const char** json, const char* end, double* d) {
+    static const double pow10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const char* p = *json, *q;
+    uint64_t m = 0;
+    int digits = 0, e = 0, x = 0, neg = 0;
+    if (p < end && *p == '-') { neg = 1; p++; }
+    if (p < end && *p == '0') p++;
+    else {
+        if (p == end || !ISDIGIT1TO9(*p)) return LEPT_PARSE_INVALID_VALUE;
+        p = lept_parse_digits(p, end, &m, &digits);
+    }
+    if (p < end && *p == '.') {
+        q = ++p;
+        p = lept_parse_digits(p, end, &m, &digits);
+        if (p == q) return LEPT_PARSE_INVALID_VALUE;
+        e = -(int)(p - q);
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        int eneg = 0;
+        if (++p < end && (*p == '+' || *p == '-'))
+            eneg = *p++ == '-';
+        if (p == end || !ISDIGIT(*p)) return LEPT_PARSE_INVALID_VALUE;
+        for (; p < end && ISDIGIT(*p); p++)
+            if (x < 100000)
+                x = x * 10 + (*p - '0');
+        e += eneg ? -x : x;
     }
+    if (digits <= 19 && m <= (UINT64_C(1) << 53) && e >= -22 && e <= 22) {
+        /* both operands are exact, so a single rounding gives the same result as strtod() */
+        *d = e < 0 ? (double)m / pow10[-e] : (double)m * pow10[e];
+        if (neg) *d = -*d;
+    }
+    else {
+        char buffer[64], *s = buffer;
+        size_t len = (size_t)(p - *json);
+        if (len >= sizeof(buffer))
+            s = (char*)LEPT_MALLOC(len + 1);
+        memcpy(s, *json, len);
+        s[len] = '\0';
+        errno = 0;
+        *d = strtod(s, NULL);
+        if (s != buffer)
+            LEPT_FREE(s);
+        if (errno == ERANGE && (*d == HUGE_VAL || *d == -HUGE_VAL))
+            return LEPT_PARSE_NUMBER_TOO_BIG;
+    }
+    *json = p;
+    return LEPT_PARSE_OK;
 }
 
-void lept_free(lept_value* v) {
-    size_t i;
-    assert(v != NULL);
-    switch (v->type) {
-        case LEPT_STRING:
-            free(v->u.s.s);
-            break;
-        case LEPT_ARRAY:
-            for (i = 0; i < v->u.a.size; i++)
-                lept_free(&v->u.a.e[i]);
-            free(v->u.a.e);
-            break;
-        case LEPT_OBJECT:
-            for (i = 0; i < v->u.o.size; i++) {
-                free(v->u.o.m[i].k);
-                lept_free(&v->u.o.m[i].v);
-            }
-            free(v->u.o.m);
-            break;
-        default: break;
+static int lept_parse_int64(const char** json, const char* end, int64_t* i) {
+    const char* p = *json;
+    uint64_t m = 0;
+    int digits = 0, neg = 0;
+    if (p < end && *p == '-') { neg = 1; p++; }
+    if (p < end && *p == '0') p++;
+    else {
+        if (p == end || !ISDIGIT1TO9(*p)) return LEPT_PARSE_INVALID_VALUE;
+        p = lept_parse_digits(p, end, &m, &digits);
     }
-    v->type = LEPT_NULL;
+    if (p < end && (*p == '.' || *p == 'e' || *p == 'E'))
+        return LEPT_PARSE_INVALID_VALUE;
+    if (digits > 19 || m > (uint64_t)INT64_MAX + neg)
+        return LEPT_PARSE_NUMBER_TOO_BIG;
+    *i = neg ? (int64_t)(0 - m) : (int64_t)m;
+    *json = p;
+    return LEPT_PARSE_OK;
 }
 
-lept_type lept_get_type(const lept_value* v) {
-    assert(v != NULL);
-    return v->type;
+static const char* lept_skip_whitespace(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+    return p;
 }
 
-int lept_is_equal(const lept_value* lhs, const lept_value* rhs) {
-    size_t i;
-    assert(lhs != NULL && rhs != NULL);
-    if (lhs->type != rhs->type)
-        return 0;
-    switch (lhs->type) {
-        case LEPT_STRING:
-            return lhs->u.s.len == rhs->u.s.len && 
-                memcmp(lhs->u.s.s, rhs->u.s.s, lhs->u.s.len) == 0;
-        case LEPT_NUMBER:
-            return lhs->u.n == rhs->u.n;
-        case LEPT_ARRAY:
-            if (lhs->u.a.size != rhs->u.a.size)
-                return 0;
-            for (i = 0; i < lhs->u.a.size; i++)
-                if (!lept_is_equal(&lhs->u.a.e[i], &rhs->u.a.e[i]))
-                    return 0;
-            return 1;
-        case LEPT_OBJECT:
-            /* \todo */
-            return 1;
-        default:
-            return 1;
+static int lept_parse_numbers(const char* json, size_t len, void* out, int int64, size_t cap, size_t* n) {
+    const char* p = json, *end = json + len;
+    size_t size = 0;
+    int ret;
+    double d;
+    int64_t i;
+    assert(json != NULL && n != NULL && (out != NULL || cap == 0));
+    *n = 0;
+    p = lept_skip_whitespace(p, end);
+    if (p == end)
+        return LEPT_PARSE_EXPECT_VALUE;
+    if (*p++ != '[')
+        return LEPT_PARSE_INVALID_VALUE;
+    p = lept_skip_whitespace(p, end);
+    if (p < end && *p == ']')
+        p++;
+    else {
+        for (;;) {
+            if (p == end)
+                return LEPT_PARSE_EXPECT_VALUE;
+            if ((ret = int64 ? lept_parse_int64(&p, end, &i) : lept_parse_double(&p, end, &d)) != LEPT_PARSE_OK)
+                return ret;
+            if (size < cap) {
+                if (int64)
+                    ((int64_t*)out)[size] = i;
+                else
+                    ((double*)out)[size] = d;
+            }
+            size++;
+            p = lept_skip_whitespace(p, end);
+            if (p < end && *p == ',')
+                p = lept_skip_whitespace(p + 1, end);
+            else if (p < end && *p == ']') {
+                p++;
+                break;
+            }
+            else
+                return LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+        }
     }
+    if (lept_skip_whitespace(p, end) != end)
+        return LEPT_PARSE_ROOT_NOT_SINGULAR;
+    *n = size;
+    return LEPT_PARSE_OK;
 }
 
-int lept_get_boolean(const lept_value* v) {
-    assert(v != NULL && (v->type == LEPT_TRUE || v->type == LEPT_FALSE));
-    return v->type == LEPT_TRUE;
+int lept_parse_number_array(const char* json, size_t len, double* out, size_t cap, size_t* n) {
+    return lept_parse_numbers(json, len, out, 0, cap, n);
 }
 
-void lept_set_boolean(lept_value* v, int b) {
-    lept_free(v);
-    v->type = b ? LEPT_TRUE : LEPT_FALSE;
+int lept_parse_int64_array(const char* json, size_t len, int64_t* out, size_t cap, size_t* n) {
+    return lept_parse_numbers(json, len, out, 1, cap, n);
 }
 
-double lept_get_number(const lept_value* v) {
-    assert(v != NULL && v->type == LEPT_NUMBER);
-    return v->u.n;
+/* Hands the buffered output to the sink once it reaches LEPT_STRINGIFY_FLUSH_SIZE */
+static void lept_stringify_flush(lept_context* c, size_t threshold) {
+    if (c->write != NULL && c->top >= threshold && c->top > 0) {
+        if (c->error == 0)
+            c->error = c->write(c->sink, c->stack, c->top);
+        c->top = 0;
+    }
 }
 
-void lept_set_number(lept_value* v, double n) {
-    lept_free(v);
-    v->u.n = n;
-    v->type = LEPT_NUMBER;
-}
+#define LEPT_BYTES(b)           (UINT64_C(0x0101010101010101) * (b))
+#define LEPT_HAS_LESS(w, b)     (((w) - LEPT_BYTES(b)) & ~(w) & LEPT_BYTES(0x80))
+#define LEPT_NEEDS_ESCAPE(ch)   ((unsigned char)(ch) < 0x20 || (ch) == '"' || (ch) == '\\')
 
-const char* lept_get_string(const lept_value* v) {
+/* Returns the length of the prefix of s that can be copied without escaping, testing 8 bytes at a time */
+static size_t lept_scan_unescaped(const char* s, size_t len) {
+    size_t i = 0;
+    uint64_t w, q, b;
+    for (; len - i >= 8; i += 8) {
+        memcpy(&w, s + i, sizeof(w));
+        q = w ^ LEPT_BYTES('"');
+        b = w ^ LEPT_BYTES('\\');
+        if (LEPT_HAS_LESS(w, 0x20) | LEPT_HAS_LESS(q, 1) | LEPT_HAS_LESS(b, 1))
+            break;
+    }
+    while (i < len && !LEPT_NEEDS_ESCAPE(s[i]))
+        i++;
+    return i;
+}
+
+static char* lept_escape_char(char* p, char ch) {
+    static const char hex_digits[] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
+    switch (ch) {
+        case '\"': *p++ = '\\'; *p++ = '\"'; break;
+        case '\\': *p++ = '\\'; *p++ = '\\'; break;
+        case '\b': *p++ = '\\'; *p++ = 'b';  break;
+        case '\f': *p++ = '\\'; *p++ = 'f';  break;
+        case '\n': *p++ = '\\'; *p++ = 'n';  break;
+        case '\r': *p++ = '\\'; *p++ = 'r';  break;
+        case '\t': *p++ = '\\'; *p++ = 't';  break;
+        default:
+            *p++ = '\\'; *p++ = 'u'; *p++ = '0'; *p++ = '0';
+            *p++ = hex_digits[(unsigned char)ch >> 4];
+            *p++ = hex_digits[ch & 15];
+    }
+    return p;
+}
+
+typedef struct {
+    const char* base;   /* referenced bytes, or NULL for stack bytes at offset */
+    size_t offset, len;
+}lept_iov_piece;
+
+/* Closes the pending run of stack bytes and, if len > 0, appends a reference to s */
+static void lept_stringify_iov_cut(lept_context* c, const char* s, size_t len) {
+    lept_iov_piece* e;
+    if (c->top > c->mark) {
+        e = (lept_iov_piece*)lept_context_push(c->iov, sizeof(lept_iov_piece));
+        e->base = NULL;
+        e->offset = c->mark;
+        e->len = c->top - c->mark;
+    }
+    if (len > 0) {
+        e = (lept_iov_piece*)lept_context_push(c->iov, sizeof(lept_iov_piece));
+        e->base = s;
+        e->len = len;
+    }
+    c->mark = c->top;
+}
+
+/* Long runs that need no escaping are referenced in place, everything else is copied */
+static void lept_stringify_string_iov(lept_context* c, const char* s, size_t len, int no_escape) {
+    size_t i = 0, run;
+    PUTC(c, '"');
+    while (i < len) {
+        run = no_escape ? len - i : lept_scan_unescaped(s + i, len - i);
+        if (run >= LEPT_STRINGIFY_IOV_MIN)
+            lept_stringify_iov_cut(c, s + i, run);
+        else if (run > 0)
+            PUTS(c, s + i, run);
+        i += run;
+        if (i < len) {
+            char* head = lept_context_push(c, 6);
+            c->top -= 6 - (lept_escape_char(head, s[i++]) - head);
+        }
+    }
+    PUTC(c, '"');
+}
+
+static void lept_stringify_string(lept_context* c, const char* s, size_t len, int no_escape) {
+    size_t i = 0, end, run, size;
+    char* head, *p;
+    assert(s != NULL);
+    if (c->iov != NULL) {
+        lept_stringify_string_iov(c, s, len, no_escape);
+        return;
+    }
+    PUTC(c, '"');
+    /* work in chunks so that a long string never needs len * 6 bytes of buffer */
+    while (i < len) {
+        end = len - i > LEPT_STRINGIFY_FLUSH_SIZE ? i + LEPT_STRINGIFY_FLUSH_SIZE : len;
+        if (no_escape) {
+            PUTS(c, s + i, end - i);
+            i = end;
+            lept_stringify_flush(c, LEPT_STRINGIFY_FLUSH_SIZE);
+            continue;
+        }
+        p = head = lept_context_push(c, size = (end - i) * 6); /* "\u00xx..." */
+        while (i < end) {
+            run = lept_scan_unescaped(s + i, end - i);
+            memcpy(p, s + i, run);
+            p += run;
+            i += run;
+            if (i == end)
+                break;
+            p = lept_escape_char(p, s[i++]);
+        }
+        c->top -= size - (p - head);
+        lept_stringify_flush(c, LEPT_STRINGIFY_FLUSH_SIZE);
+    }
+    PUTC(c, '"');
+}
+
+/*
+ * Grisu2 (Florian Loitsch, "Printing Floating-Point Numbers Quickly and Accurately
+ * with Integers", PLDI 2010): the digits always parse back to the same double and
+ * are the shortest such digits for all but a tiny fraction of inputs.
+ */
+typedef struct {
+    uint64_t f;
+    int e;
+}lept_diy_fp;
+
+#define LEPT_DP_HIDDEN_BIT  UINT64_C(0x0010000000000000)
+
+static lept_diy_fp lept_diy_fp_multiply(lept_diy_fp x, lept_diy_fp y) {
+    const uint64_t m32 = UINT64_C(0xFFFFFFFF);
+    uint64_t a = x.f >> 32, b = x.f & m32, c = y.f >> 32, d = y.f & m32;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32) + (UINT64_C(1) << 31);
+    lept_diy_fp r;
+    r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+    r.e = x.e + y.e + 64;
+    return r;
+}
+
+static lept_diy_fp lept_cached_power(int e, int* k) {
+    static const lept_diy_fp cached_powers[] = {
+        { UINT64_C(0xfa8fd5a0081c0288), -1220 }, { UINT64_C(0xbaaee17fa23ebf76), -1193 }, { UINT64_C(0x8b16fb203055ac76), -1166 },
+        { UINT64_C(0xcf42894a5dce35ea), -1140 }, { UINT64_C(0x9a6bb0aa55653b2d), -1113 }, { UINT64_C(0xe61acf033d1a45df), -1087 },
+        { UINT64_C(0xab70fe17c79ac6ca), -1060 }, { UINT64_C(0xff77b1fcbebcdc4f), -1034 }, { UINT64_C(0xbe5691ef416bd60c), -1007 },
+        { UINT64_C(0x8dd01fad907ffc3c),  -980 }, { UINT64_C(0xd3515c2831559a83),  -954 }, { UINT64_C(0x9d71ac8fada6c9b5),  -927 },
+        { UINT64_C(0xea9c227723ee8bcb),  -901 }, { UINT64_C(0xaecc49914078536d),  -874 }, { UINT64_C(0x823c12795db6ce57),  -847 },
+        { UINT64_C(0xc21094364dfb5637),  -821 }, { UINT64_C(0x9096ea6f3848984f),  -794 }, { UINT64_C(0xd77485cb25823ac7),  -768 },
+        { UINT64_C(0xa086cfcd97bf97f4),  -741 }, { UINT64_C(0xef340a98172aace5),  -715 }, { UINT64_C(0xb23867fb2a35b28e),  -688 },
+        { UINT64_C(0x84c8d4dfd2c63f3b),  -661 }, { UINT64_C(0xc5dd44271ad3cdba),  -635 }, { UINT64_C(0x936b9fcebb25c996),  -608 },
+        { UINT64_C(0xdbac6c247d62a584),  -582 }, { UINT64_C(0xa3ab66580d5fdaf6),  -555 }, { UINT64_C(0xf3e2f893dec3f126),  -529 },
+        { UINT64_C(0xb5b5ada8aaff80b8),  -502 }, { UINT64_C(0x87625f056c7c4a8b),  -475 }, { UINT64_C(0xc9bcff6034c13053),  -449 },
+        { UINT64_C(0x964e858c91ba2655),  -422 }, { UINT64_C(0xdff9772470297ebd),  -396 }, { UINT64_C(0xa6dfbd9fb8e5b88f),  -369 },
+        { UINT64_C(0xf8a95fcf88747d94),  -343 }, { UINT64_C(0xb94470938fa89bcf),  -316 }, { UINT64_C(0x8a08f0f8bf0f156b),  -289 },
+        { UINT64_C(0xcdb02555653131b6),  -263 }, { UINT64_C(0x993fe2c6d07b7fac),  -236 }, { UINT64_C(0xe45c10c42a2b3b06),  -210 },
+        { UINT64_C(0xaa242499697392d3),  -183 }, { UINT64_C(0xfd87b5f28300ca0e),  -157 }, { UINT64_C(0xbce5086492111aeb),  -130 },
+        { UINT64_C(0x8cbccc096f5088cc),  -103 }, { UINT64_C(0xd1b71758e219652c),   -77 }, { UINT64_C(0x9c40000000000000),   -50 },
+        { UINT64_C(0xe8d4a51000000000),   -24 }, { UINT64_C(0xad78ebc5ac620000),     3 }, { UINT64_C(0x813f3978f8940984),    30 },
+        { UINT64_C(0xc097ce7bc90715b3),    56 }, { UINT64_C(0x8f7e32ce7bea5c70),    83 }, { UINT64_C(0xd5d238a4abe98068),   109 },
+        { UINT64_C(0x9f4f2726179a2245),   136 }, { UINT64_C(0xed63a231d4c4fb27),   162 }, { UINT64_C(0xb0de65388cc8ada8),   189 },
+        { UINT64_C(0x83c7088e1aab65db),   216 }, { UINT64_C(0xc45d1df942711d9a),   242 }, { UINT64_C(0x924d692ca61be758),   269 },
+        { UINT64_C(0xda01ee641a708dea),   295 }, { UINT64_C(0xa26da3999aef774a),   322 }, { UINT64_C(0xf209787bb47d6b85),   348 },
+        { UINT64_C(0xb454e4a179dd1877),   375 }, { UINT64_C(0x865b86925b9bc5c2),   402 }, { UINT64_C(0xc83553c5c8965d3d),   428 },
+        { UINT64_C(0x952ab45cfa97a0b3),   455 }, { UINT64_C(0xde469fbd99a05fe3),   481 }, { UINT64_C(0xa59bc234db398c25),   508 },
+        { UINT64_C(0xf6c69a72a3989f5c),   534 }, { UINT64_C(0xb7dcbf5354e9bece),   561 }, { UINT64_C(0x88fcf317f22241e2),   588 },
+        { UINT64_C(0xcc20ce9bd35c78a5),   614 }, { UINT64_C(0x98165af37b2153df),   641 }, { UINT64_C(0xe2a0b5dc971f303a),   667 },
+        { UINT64_C(0xa8d9d1535ce3b396),   694 }, { UINT64_C(0xfb9b7cd9a4a7443c),   720 }, { UINT64_C(0xbb764c4ca7a44410),   747 },
+        { UINT64_C(0x8bab8eefb6409c1a),   774 }, { UINT64_C(0xd01fef10a657842c),   800 }, { UINT64_C(0x9b10a4e5e9913129),   827 },
+        { UINT64_C(0xe7109bfba19c0c9d),   853 }, { UINT64_C(0xac2820d9623bf429),   880 }, { UINT64_C(0x80444b5e7aa7cf85),   907 },
+        { UINT64_C(0xbf21e44003acdd2d),   933 }, { UINT64_C(0x8e679c2f5e44ff8f),   960 }, { UINT64_C(0xd433179d9c8cb841),   986 },
+        { UINT64_C(0x9e19db92b4e31ba9),  1013 }, { UINT64_C(0xeb96bf6ebadf77d9),  1039 }, { UINT64_C(0xaf87023b9bf0ee6b),  1066 }
+    };
+    /* smallest 10^-k (k a multiple of 8) that brings the product into [2^-60, 2^-32) */
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int ik = (int)dk;
+    unsigned index;
+    if (ik != dk)
+        ik++;
+    index = (unsigned)((ik >> 3) + 1);
+    *k = 348 - (int)(index << 3);
+    return cached_powers[index];
+}
+
+static void lept_grisu_round(char* buffer, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w) {
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+        (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        buffer[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static int lept_grisu_digits(lept_diy_fp w, lept_diy_fp mp, uint64_t delta, char* buffer, int* k) {
+    static const uint64_t pow10[] = {
+        UINT64_C(1), UINT64_C(10), UINT64_C(100), UINT64_C(1000), UINT64_C(10000), UINT64_C(100000),
+        UINT64_C(1000000), UINT64_C(10000000), UINT64_C(100000000), UINT64_C(1000000000),
+        UINT64_C(10000000000), UINT64_C(100000000000), UINT64_C(1000000000000),
+        UINT64_C(10000000000000), UINT64_C(100000000000000), UINT64_C(1000000000000000),
+        UINT64_C(10000000000000000), UINT64_C(100000000000000000), UINT64_C(1000000000000000000),
+        UINT64_C(10000000000000000000)
+    };
+    const int shift = -mp.e;
+    const uint64_t one = UINT64_C(1) << shift, wp_w = mp.f - w.f;
+    uint32_t p1 = (uint32_t)(mp.f >> shift);
+    uint64_t p2 = mp.f & (one - 1), rest;
+    int kappa = 10, len = 0;
+    while (kappa > 1 && p1 < pow10[kappa - 1])
+        kappa--;
+    while (kappa > 0) {
+        uint32_t d = (uint32_t)(p1 / pow10[kappa - 1]);
+        p1 = (uint32_t)(p1 % pow10[kappa - 1]);
+        if (d || len)
+            buffer[len++] = (char)('0' + d);
+        kappa--;
+        rest = ((uint64_t)p1 << shift) + p2;
+        if (rest <= delta) {
+            *k += kappa;
+            lept_grisu_round(buffer, len, delta, rest, pow10[kappa] << shift, wp_w);
+            return len;
+        }
+    }
+    for (;;) {
+        char d;
+        p2 *= 10;
+        delta *= 10;
+        d = (char)(p2 >> shift);
+        if (d || len)
+            buffer[len++] = (char)('0' + d);
+        p2 &= one - 1;
+        kappa--;
+        if (p2 < delta) {
+            *k += kappa;
+            lept_grisu_round(buffer, len, delta, p2, one, -kappa < 20 ? wp_w * pow10[-kappa] : 0);
+            return len;
+        }
+    }
+}
+
+/* Writes the digits of a positive finite n, n == digits * 10^k */
+static int lept_grisu2(double n, char* buffer, int* k) {
+    lept_diy_fp v, w, mp, mm, c;
+    uint64_t u;
+    memcpy(&u, &n, sizeof(u));
+    v.f = u & (LEPT_DP_HIDDEN_BIT - 1);
+    if ((u >> 52) & 0x7FF) {
+        v.f += LEPT_DP_HIDDEN_BIT;
+        v.e = (int)((u >> 52) & 0x7FF) - 1075;
+    }
+    else
+        v.e = -1074;
+
+    /* boundaries m+ and m-, normalized to the same exponent */
+    mp.f = (v.f << 1) + 1;
+    mp.e = v.e - 1;
+    while (!(mp.f & (LEPT_DP_HIDDEN_BIT << 1))) {
+        mp.f <<= 1;
+        mp.e--;
+    }
+    mp.f <<= 10;
+    mp.e -= 10;
+    if (v.f == LEPT_DP_HIDDEN_BIT) {
+        mm.f = (v.f << 2) - 1;
+        mm.e = v.e - 2;
+    }
+    else {
+        mm.f = (v.f << 1) - 1;
+        mm.e = v.e - 1;
+    }
+    mm.f <<= mm.e - mp.e;
+    mm.e = mp.e;
+
+    w = v;
+    while (!(w.f & LEPT_DP_HIDDEN_BIT)) {
+        w.f <<= 1;
+        w.e--;
+    }
+    w.f <<= 11;
+    w.e -= 11;
+
+    c = lept_cached_power(mp.e, k);
+    w = lept_diy_fp_multiply(w, c);
+    mp = lept_diy_fp_multiply(mp, c);
+    mm = lept_diy_fp_multiply(mm, c);
+    mm.f++;
+    mp.f--;
+    return lept_grisu_digits(w, mp, mp.f - mm.f, buffer, k);
+}
+
+/* Same layout as "%.17g" but with the shortest digits, returns the length written (at most 32) */
+static int lept_format_number(char* head, double n) {
+    char* p = head, digits[20];
+    int i, len, k, x;
+    uint64_t u;
+    if (n - n != 0) {   /* inf or nan, which JSON cannot represent */
+        return sprintf(head, "%.17g", n);
+    }
+    memcpy(&u, &n, sizeof(u));
+    if (u >> 63) {
+        *p++ = '-';
+        n = -n;
+    }
+    if (n == 0) {
+        *p++ = '0';
+        return (int)(p - head);
+    }
+    len = lept_grisu2(n, digits, &k);
+    x = len + k - 1;    /* decimal exponent of the first digit */
+    if (x >= 17 || x < -4) {
+        *p++ = digits[0];
+        if (len > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, len - 1);
+            p += len - 1;
+        }
+        *p++ = 'e';
+        *p++ = x < 0 ? '-' : '+';
+        if (x < 0)
+            x = -x;
+        if (x >= 100) {
+            *p++ = (char)('0' + x / 100);
+            x %= 100;
+        }
+        *p++ = (char)('0' + x / 10);
+        *p++ = (char)('0' + x % 10);
+    }
+    else if (k >= 0) {
+        memcpy(p, digits, len);
+        p += len;
+        for (i = 0; i < k; i++)
+            *p++ = '0';
+    }
+    else if (x >= 0) {
+        memcpy(p, digits, x + 1);
+        p += x + 1;
+        *p++ = '.';
+        memcpy(p, digits + x + 1, len - x - 1);
+        p += len - x - 1;
+    }
+    else {
+        *p++ = '0';
+        *p++ = '.';
+        for (i = -1; i > x; i--)
+            *p++ = '0';
+        memcpy(p, digits, len);
+        p += len;
+    }
+    return (int)(p - head);
+}
+
+static void lept_stringify_number(lept_context* c, double n) {
+    c->top -= 32 - lept_format_number(lept_context_push(c, 32), n);
+}
+
+typedef struct {
+    const lept_value* v;    /* array or object */
+    size_t index, size;     /* next element or member, and their count */
+}lept_walk_frame;
+
+/* Frame stack of the writers, the first LEPT_WALK_LOCAL_DEPTH levels are walked without allocating */
+typedef struct {
+    lept_walk_frame local[LEPT_WALK_LOCAL_DEPTH];
+    lept_context heap;      /* deeper frames */
+    size_t depth;
+}lept_walk;
+
+static void lept_walk_init(lept_walk* w) {
+    w->heap.stack = NULL;
+    w->heap.size = w->heap.top = 0;
+    w->depth = 0;
+}
+
+static lept_walk_frame* lept_walk_push(lept_walk* w, const lept_value* v) {
+    lept_walk_frame* f = w->depth < LEPT_WALK_LOCAL_DEPTH ? &w->local[w->depth] :
+        (lept_walk_frame*)lept_context_push(&w->heap, sizeof(lept_walk_frame));
+    w->depth++;
+    f->v = v;
+    f->index = 0;
+    f->size = v->type == LEPT_ARRAY ? LEPT_ARRAY_SIZE(v) : LEPT_OBJECT_SIZE(v);
+    return f;
+}
+
+/* Returns the new innermost frame, NULL once the walk is done */
+static lept_walk_frame* lept_walk_pop(lept_walk* w) {
+    if (--w->depth >= LEPT_WALK_LOCAL_DEPTH)
+        w->heap.top -= sizeof(lept_walk_frame);
+    if (w->depth > LEPT_WALK_LOCAL_DEPTH)
+        return (lept_walk_frame*)(w->heap.stack + w->heap.top) - 1;
+    return w->depth > 0 ? &w->local[w->depth - 1] : NULL;
+}
+
+static void lept_walk_free(lept_walk* w) {
+    LEPT_FREE(w->heap.stack);
+}
+
+/* The value after f->v's element or member at f->index, written as the walk returns to f */
+#define LEPT_WALK_NEXT(f) ((f)->v->type == LEPT_OBJECT ? &(f)->v->u.o.m[(f)->index++].v : &(f)->v->u.a.e[(f)->index++])
+
+static void lept_stringify_value(lept_context* c, const lept_value* v) {
+    lept_walk w;
+    lept_walk_frame* f = NULL;
+    size_t i;
+    lept_walk_init(&w);
+    for (;;) {
+        switch (v->type) {
+            case LEPT_NULL:   PUTS(c, "null",  4); break;
+            case LEPT_FALSE:  PUTS(c, "false", 5); break;
+            case LEPT_TRUE:   PUTS(c, "true",  4); break;
+            case LEPT_NUMBER: lept_stringify_number(c, v->u.n); break;
+            case LEPT_STRING: lept_stringify_string(c, v->u.s.s, LEPT_STRING_LEN(v), LEPT_NO_ESCAPE(v)); break;
+            case LEPT_ARRAY:
+                PUTC(c, '[');
+                if (v->flags & LEPT_FLAG_PACKED) {
+                    for (i = 0; i < LEPT_ARRAY_SIZE(v); i++) {
+                        if (i > 0)
+                            PUTC(c, ',');
+                        lept_stringify_flush(c, LEPT_STRINGIFY_FLUSH_SIZE);
+                        lept_stringify_number(c, LEPT_ARRAY_DOUBLES(v)[i]);
+                    }
+                    PUTC(c, ']');
+                }
+                else
+                    f = lept_walk_push(&w, v);
+                break;
+            case LEPT_OBJECT:
+                PUTC(c, '{');
+                f = lept_walk_push(&w, v);
+                break;
+            default: assert(0 && "invalid type");
+        }
+        for (; f != NULL && f->index == f->size; f = lept_walk_pop(&w))
+            PUTC(c, f->v->type == LEPT_ARRAY ? ']' : '}');
+        if (f == NULL)
+            break;
+        if (f->index > 0)
+            PUTC(c, ',');
+        lept_stringify_flush(c, LEPT_STRINGIFY_FLUSH_SIZE);
+        if (f->v->type == LEPT_OBJECT) {
+            lept_stringify_string(c, f->v->u.o.m[f->index].k, f->v->u.o.m[f->index].klen, 0);
+            PUTC(c, ':');
+        }
+        v = LEPT_WALK_NEXT(f);
+    }
+    lept_walk_free(&w);
+}
+
+void lept_free_buffer(void* p) {
+    LEPT_FREE(p);
+}
+
+char* lept_stringify(const lept_value* v, size_t* length) {
+    lept_context c;
+    assert(v != NULL);
+    c.stack = (char*)LEPT_MALLOC(c.size = LEPT_PARSE_STRINGIFY_INIT_SIZE);
+    c.top = 0;
+    c.write = NULL;
+    c.iov = NULL;
+    lept_stringify_value(&c, v);
+    if (length)
+        *length = c.top;
+    PUTC(&c, '\0');
+    return c.stack;
+}
+
+/* Runs an encoder with its output flushed to write_fn in pieces */
+static int lept_write_to(const lept_value* v, void (*encode)(lept_context*, const lept_value*), lept_write_fn write_fn, void* sink) {
+    lept_context c;
+    assert(v != NULL && write_fn != NULL);
+    c.stack = (char*)LEPT_MALLOC(c.size = LEPT_STRINGIFY_FLUSH_SIZE * 2);
+    c.top = 0;
+    c.write = write_fn;
+    c.sink = sink;
+    c.error = 0;
+    c.iov = NULL;
+    encode(&c, v);
+    lept_stringify_flush(&c, 0);
+    LEPT_FREE(c.stack);
+    return c.error;
+}
+
+int lept_stringify_to(const lept_value* v, lept_write_fn write_fn, void* sink) {
+    return lept_write_to(v, lept_stringify_value, write_fn, sink);
+}
+
+lept_iovec* lept_stringify_iov(const lept_value* v, size_t* count) {
+    lept_context c, iov;
+    lept_iov_piece* e;
+    lept_iovec* ret;
+    char* buffer;
+    size_t i, n;
+    assert(v != NULL && count != NULL);
+    c.stack = (char*)LEPT_MALLOC(c.size = LEPT_PARSE_STRINGIFY_INIT_SIZE);
+    c.top = 0;
+    c.write = NULL;
+    c.iov = &iov;
+    c.mark = 0;
+    iov.stack = NULL;
+    iov.size = iov.top = 0;
+    lept_stringify_value(&c, v);
+    lept_stringify_iov_cut(&c, NULL, 0);
+
+    /* one block for lept_free_buffer(): the iovec array followed by the copied bytes */
+    n = iov.top / sizeof(lept_iov_piece);
+    ret = (lept_iovec*)LEPT_MALLOC(n * sizeof(lept_iovec) + c.top);
+    buffer = (char*)(ret + n);
+    memcpy(buffer, c.stack, c.top);
+    for (i = 0, e = (lept_iov_piece*)iov.stack; i < n; i++, e++) {
+        ret[i].base = e->base != NULL ? e->base : buffer + e->offset;
+        ret[i].len = e->len;
+    }
+    LEPT_FREE(c.stack);
+    LEPT_FREE(iov.stack);
+    *count = n;
+    return ret;
+}
+
+static size_t lept_stringify_string_size(const char* s, size_t len, int no_escape) {
+    size_t i = 0, size = len + 2;
+    if (no_escape)
+        return size;
+    while ((i += lept_scan_unescaped(s + i, len - i)) < len) {
+        unsigned char ch = (unsigned char)s[i++];
+        if (ch == '"' || ch == '\\' || ch == '\b' || ch == '\f' || ch == '\n' || ch == '\r' || ch == '\t')
+            size += 1;
+        else
+            size += 5;
+    }
+    return size;
+}
+
+size_t lept_stringify_size(const lept_value* v) {
+    char buffer[32];
+    size_t i, size = 0;
+    lept_walk w;
+    lept_walk_frame* f = NULL;
+    assert(v != NULL);
+    lept_walk_init(&w);
+    for (;;) {
+        switch (v->type) {
+            case LEPT_NULL:   size += 4; break;
+            case LEPT_FALSE:  size += 5; break;
+            case LEPT_TRUE:   size += 4; break;
+            case LEPT_NUMBER: size += (size_t)lept_format_number(buffer, v->u.n); break;
+            case LEPT_STRING: size += lept_stringify_string_size(v->u.s.s, LEPT_STRING_LEN(v), LEPT_NO_ESCAPE(v)); break;
+            case LEPT_ARRAY:
+                size += LEPT_ARRAY_SIZE(v) > 0 ? LEPT_ARRAY_SIZE(v) + 1 : 2;   /* brackets and commas */
+                if (v->flags & LEPT_FLAG_PACKED)
+                    for (i = 0; i < LEPT_ARRAY_SIZE(v); i++)
+                        size += (size_t)lept_format_number(buffer, LEPT_ARRAY_DOUBLES(v)[i]);
+                else
+                    f = lept_walk_push(&w, v);
+                break;
+            case LEPT_OBJECT:
+                size += LEPT_OBJECT_SIZE(v) > 0 ? LEPT_OBJECT_SIZE(v) * 2 + 1 : 2;    /* braces, colons and commas */
+                f = lept_walk_push(&w, v);
+                break;
+            default: assert(0 && "invalid type");
+        }
+        while (f != NULL && f->index == f->size)
+            f = lept_walk_pop(&w);
+        if (f == NULL)
+            break;
+        if (f->v->type == LEPT_OBJECT)
+            size += lept_stringify_string_size(f->v->u.o.m[f->index].k, f->v->u.o.m[f->index].klen, 0);
+        v = LEPT_WALK_NEXT(f);
+    }
+    lept_walk_free(&w);
+    return size;
+}
+
+typedef struct {
+    char* buffer;
+    size_t capacity, size;  /* size keeps counting past capacity */
+}lept_buffer_sink;
+
+static void lept_put_bounded(lept_buffer_sink* b, const char* s, size_t len) {
+    if (b->size < b->capacity)
+        memcpy(b->buffer + b->size, s, b->capacity - b->size < len ? b->capacity - b->size : len);
+    b->size += len;
+}
+
+static void lept_put_number_bounded(lept_buffer_sink* b, double n) {
+    char buffer[32];
+    if (b->size <= b->capacity && b->capacity - b->size >= 32)
+        b->size += (size_t)lept_format_number(b->buffer + b->size, n);
+    else
+        lept_put_bounded(b, buffer, (size_t)lept_format_number(buffer, n));
+}
+
+static void lept_put_string_bounded(lept_buffer_sink* b, const char* s, size_t len, int no_escape) {
+    char buffer[6];
+    size_t i = 0, run;
+    lept_put_bounded(b, "\"", 1);
+    while (i < len) {
+        run = no_escape ? len - i : lept_scan_unescaped(s + i, len - i);
+        lept_put_bounded(b, s + i, run);
+        if ((i += run) < len)
+            lept_put_bounded(b, buffer, (size_t)(lept_escape_char(buffer, s[i++]) - buffer));
+    }
+    lept_put_bounded(b, "\"", 1);
+}
+
+size_t lept_stringify_into(const lept_value* v, char* buffer, size_t capacity) {
+    lept_buffer_sink b;
+    lept_walk w;
+    lept_walk_frame* f = NULL;
+    size_t i;
+    assert(v != NULL && (buffer != NULL || capacity == 0));
+    b.buffer = buffer;
+    b.capacity = capacity;
+    b.size = 0;
+    lept_walk_init(&w);
+    for (;;) {
+        switch (v->type) {
+            case LEPT_NULL:   lept_put_bounded(&b, "null",  4); break;
+            case LEPT_FALSE:  lept_put_bounded(&b, "false", 5); break;
+            case LEPT_TRUE:   lept_put_bounded(&b, "true",  4); break;
+            case LEPT_NUMBER: lept_put_number_bounded(&b, v->u.n); break;
+            case LEPT_STRING: lept_put_string_bounded(&b, v->u.s.s, LEPT_STRING_LEN(v), LEPT_NO_ESCAPE(v)); break;
+            case LEPT_ARRAY:
+                lept_put_bounded(&b, "[", 1);
+                if (v->flags & LEPT_FLAG_PACKED) {
+                    for (i = 0; i < LEPT_ARRAY_SIZE(v); i++) {
+                        if (i > 0)
+                            lept_put_bounded(&b, ",", 1);
+                        lept_put_number_bounded(&b, LEPT_ARRAY_DOUBLES(v)[i]);
+                    }
+                    lept_put_bounded(&b, "]", 1);
+                }
+                else
+                    f = lept_walk_push(&w, v);
+                break;
+            case LEPT_OBJECT:
+                lept_put_bounded(&b, "{", 1);
+                f = lept_walk_push(&w, v);
+                break;
+            default: assert(0 && "invalid type");
+        }
+        for (; f != NULL && f->index == f->size; f = lept_walk_pop(&w))
+            lept_put_bounded(&b, f->v->type == LEPT_ARRAY ? "]" : "}", 1);
+        if (f == NULL)
+            break;
+        if (f->index > 0)
+            lept_put_bounded(&b, ",", 1);
+        if (f->v->type == LEPT_OBJECT) {
+            lept_put_string_bounded(&b, f->v->u.o.m[f->index].k, f->v->u.o.m[f->index].klen, 0);
+            lept_put_bounded(&b, ":", 1);
+        }
+        v = LEPT_WALK_NEXT(f);
+    }
+    lept_walk_free(&w);
+    return b.size;
+}
+
+static int lept_write_fd(void* sink, const char* data, size_t len) {
+    int fd = *(int*)sink;
+    while (len > 0) {
+#ifdef _WINDOWS
+        int n = _write(fd, data, len > 0x40000000 ? 0x40000000 : (unsigned)len);
+#else
+        long n = (long)write(fd, data, len);
+#endif
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int lept_stringify_fd(const lept_value* v, int fd) {
+    return lept_stringify_to(v, lept_write_fd, &fd);
+}
+
+/* CBOR (RFC 8949) and MessagePack */
+
+typedef struct {
+    int type;           /* lept_type */
+    double n;           /* LEPT_NUMBER */
+    const char* s;      /* LEPT_STRING */
+    size_t size;        /* LEPT_STRING: length, LEPT_ARRAY / LEPT_OBJECT: element / member count */
+}lept_item;
+
+typedef int (*lept_item_reader)(const unsigned char** p, const unsigned char* end, lept_item* item);
+
+static uint64_t lept_read_be(const unsigned char* p, int n) {
+    uint64_t u = 0;
+    while (n-- > 0)
+        u = (u << 8) | *p++;
+    return u;
+}
+
+static void lept_write_be(lept_context* c, unsigned char lead, uint64_t u, int n) {
+    unsigned char* p = (unsigned char*)lept_context_push(c, 1 + n);
+    *p = lead;
+    for (; n > 0; n--, u >>= 8)
+        p[n] = (unsigned char)(u & 0xFF);
+}
+
+static void lept_write_bytes(lept_context* c, const char* s, size_t len) {
+    size_t n;
+    for (; len > 0; s += n, len -= n) {
+        n = len > LEPT_STRINGIFY_FLUSH_SIZE ? LEPT_STRINGIFY_FLUSH_SIZE : len;
+        PUTS(c, s, n);
+        lept_stringify_flush(c, LEPT_STRINGIFY_FLUSH_SIZE);
+    }
+}
+
+/* 1 and *u = n for a non-negative integer below 2^64, -1 and *u = -n for a negative one down to -2^64, else 0 */
+static int lept_integer(double n, uint64_t* u) {
+    uint64_t bits;
+    memcpy(&bits, &n, sizeof(bits));
+    if (bits == UINT64_C(0x8000000000000000))   /* -0 stays a float */
+        return 0;
+    if (n >= 0 && n < 18446744073709551616.0)
+        return (double)(*u = (uint64_t)n) == n ? 1 : 0;
+    if (n < 0 && n > -18446744073709551616.0)
+        return (double)(*u = (uint64_t)-n) == -n ? -1 : 0;
+    return 0;
+}
+
+/* Writes n as a float32 if that is exact, as a float64 otherwise */
+static void lept_write_float(lept_context* c, unsigned char lead32, unsigned char lead64, double n) {
+    float f;
+    uint32_t u32;
+    uint64_t u64;
+    if (n >= -FLT_MAX && n <= FLT_MAX && (double)(f = (float)n) == n) {
+        memcpy(&u32, &f, sizeof(u32));
+        lept_write_be(c, lead32, u32, 4);
+    }
+    else {
+        memcpy(&u64, &n, sizeof(u64));
+        lept_write_be(c, lead64, u64, 8);
+    }
+}
+
+static double lept_read_float(const unsigned char* p, int n) {
+    uint64_t u = lept_read_be(p, n);
+    uint32_t u32;
+    float f;
+    double d;
+    if (n == 4) {
+        u32 = (uint32_t)u;
+        memcpy(&f, &u32, sizeof(f));
+        return f;
+    }
+    memcpy(&d, &u, sizeof(d));
+    return d;
+}
+
+static double lept_read_half(unsigned h) {
+    int e = (h >> 10) & 0x1F;
+    unsigned m = h & 0x3FF;
+    double d;
+    if (e == 0)
+        d = m / 16777216.0;                                 /* m * 2^-24 */
+    else if (e != 31)
+        d = (double)(m + 1024) * (1UL << e) / 33554432.0;   /* (m + 1024) * 2^(e - 25) */
+    else
+        d = m == 0 ? HUGE_VAL : HUGE_VAL - HUGE_VAL;
+    return (h & 0x8000) ? -d : d;
+}
+
+static void lept_cbor_head(lept_context* c, unsigned major, uint64_t u) {
+    major <<= 5;
+    if (u < 24)
+        PUTC(c, (char)(major | u));
+    else if (u <= 0xFF)
+        lept_write_be(c, (unsigned char)(major | 24), u, 1);
+    else if (u <= 0xFFFF)
+        lept_write_be(c, (unsigned char)(major | 25), u, 2);
+    else if (u <= 0xFFFFFFFF)
+        lept_write_be(c, (unsigned char)(major | 26), u, 4);
+    else
+        lept_write_be(c, (unsigned char)(major | 27), u, 8);
+}
+
+static void lept_cbor_number(lept_context* c, double n) {
+    uint64_t u;
+    switch (lept_integer(n, &u)) {
+        case 1:  lept_cbor_head(c, 0, u); break;
+        case -1: lept_cbor_head(c, 1, u - 1); break;
+        default: lept_write_float(c, 0xFA, 0xFB, n);
+    }
+}
+
+static void lept_cbor_value(lept_context* c, const lept_value* v) {
+    lept_walk w;
+    lept_walk_frame* f = NULL;
+    size_t i;
+    lept_walk_init(&w);
+    for (;;) {
+        switch (v->type) {
+            case LEPT_NULL:   PUTC(c, (char)0xF6); break;
+            case LEPT_FALSE:  PUTC(c, (char)0xF4); break;
+            case LEPT_TRUE:   PUTC(c, (char)0xF5); break;
+            case LEPT_NUMBER: lept_cbor_number(c, v->u.n); break;
+            case LEPT_STRING:
+                lept_cbor_head(c, 3, LEPT_STRING_LEN(v));
+                lept_write_bytes(c, v->u.s.s, LEPT_STRING_LEN(v));
+                break;
+            case LEPT_ARRAY:
+                lept_cbor_head(c, 4, LEPT_ARRAY_SIZE(v));
+                if (v->flags & LEPT_FLAG_PACKED)
+                    for (i = 0; i < LEPT_ARRAY_SIZE(v); i++) {
+                        lept_stringify_flush(c, LEPT_STRINGIFY_FLUSH_SIZE);
+                        lept_cbor_number(c, LEPT_ARRAY_DOUBLES(v)[i]);
+                    }
+                else
+                    f = lept_walk_push(&w, v);
+                break;
+            case LEPT_OBJECT:
+                lept_cbor_head(c, 5, LEPT_OBJECT_SIZE(v));
+                f = lept_walk_push(&w, v);
+                break;
+            default: assert(0 && "invalid type");
+        }
+        while (f != NULL && f->index == f->size)
+            f = lept_walk_pop(&w);
+        if (f == NULL)
+            break;
+        lept_stringify_flush(c, LEPT_STRINGIFY_FLUSH_SIZE);
+        if (f->v->type == LEPT_OBJECT) {
+            lept_cbor_head(c, 3, f->v->u.o.m[f->index].klen);
+            lept_write_bytes(c, f->v->u.o.m[f->index].k, f->v->u.o.m[f->index].klen);
+        }
+        v = LEPT_WALK_NEXT(f);
+    }
+    lept_walk_free(&w);
+}
+
+/* Tags are skipped, byte strings, indefinite lengths and simple values other than false / true / null are rejected */
+static int lept_cbor_item(const unsigned char** pp, const unsigned char* end, lept_item* item) {
+    const unsigned char* p = *pp;
+    unsigned major, info;
+    uint64_t u;
+    int n;
+    do {
+        if (p == end)
+            return LEPT_PARSE_EXPECT_VALUE;
+        major = *p >> 5;
+        info = *p++ & 31;
+        if (info < 24)
+            u = info;
+        else if (info < 28) {
+            n = 1 << (info - 24);
+            if (end - p < n)
+                return LEPT_PARSE_EXPECT_VALUE;
+            u = lept_read_be(p, n);
+            p += n;
+        }
+        else
+            return LEPT_PARSE_INVALID_VALUE;
+    } while (major == 6);
+    switch (major) {
+        case 0: item->type = LEPT_NUMBER; item->n = (double)u; break;
+        case 1: item->type = LEPT_NUMBER; item->n = -1.0 - (double)u; break;
+        case 3:
+            if (u > (uint64_t)(end - p))
+                return LEPT_PARSE_EXPECT_VALUE;
+            item->type = LEPT_STRING;
+            item->s = (const char*)p;
+            item->size = (size_t)u;
+            p += u;
+            break;
+        case 4:
+        case 5:
+            /* every element takes at least one byte, which bounds what a short input can make us allocate */
+            if (u > (uint64_t)(end - p) / (major - 3))
+                return LEPT_PARSE_EXPECT_VALUE;
+            item->type = major == 4 ? LEPT_ARRAY : LEPT_OBJECT;
+            item->size = (size_t)u;
+            break;
+        case 7:
+            switch (info) {
+                case 20: item->type = LEPT_FALSE; break;
+                case 21: item->type = LEPT_TRUE; break;
+                case 22: item->type = LEPT_NULL; break;
+                case 25: item->type = LEPT_NUMBER; item->n = lept_read_half((unsigned)u); break;
+                case 26: item->type = LEPT_NUMBER; item->n = lept_read_float(p - 4, 4); break;
+                case 27: item->type = LEPT_NUMBER; item->n = lept_read_float(p - 8, 8); break;
+                default: return LEPT_PARSE_INVALID_VALUE;
+            }
+            break;
+        default: return LEPT_PARSE_INVALID_VALUE;
+    }
+    *pp = p;
+    return LEPT_PARSE_OK;
+}
+
+/* lead16 is the 16-bit form, the 32-bit form follows it and only str (0xDA) has an 8-bit form before it */
+static void lept_msgpack_head(lept_context* c, unsigned char fix, unsigned fix_max, unsigned char lead16, uint64_t u) {
+    if (u <= fix_max)
+        PUTC(c, (char)(fix | u));
+    else if (lead16 == 0xDA && u <= 0xFF)
+        lept_write_be(c, 0xD9, u, 1);
+    else if (u <= 0xFFFF)
+        lept_write_be(c, lead16, u, 2);
+    else {
+        assert(u <= 0xFFFFFFFF);
+        lept_write_be(c, (unsigned char)(lead16 + 1), u, 4);
+    }
+}
+
+static void lept_msgpack_number(lept_context* c, double n) {
+    uint64_t u;
+    switch (lept_integer(n, &u)) {
+        case 1:
+            if (u < 0x80)
+                PUTC(c, (char)u);
+            else if (u <= 0xFF)
+                lept_write_be(c, 0xCC, u, 1);
+            else if (u <= 0xFFFF)
+                lept_write_be(c, 0xCD, u, 2);
+            else if (u <= 0xFFFFFFFF)
+                lept_write_be(c, 0xCE, u, 4);
+            else
+                lept_write_be(c, 0xCF, u, 8);
+            break;
+        case -1:
+            /* two's complement of -u in the narrowest signed width */
+            if (u <= 32)
+                PUTC(c, (char)(0x100 - u));
+            else if (u <= 0x80)
+                lept_write_be(c, 0xD0, 0 - u, 1);
+            else if (u <= 0x8000)
+                lept_write_be(c, 0xD1, 0 - u, 2);
+            else if (u <= UINT64_C(0x80000000))
+                lept_write_be(c, 0xD2, 0 - u, 4);
+            else if (u <= UINT64_C(0x8000000000000000))
+                lept_write_be(c, 0xD3, 0 - u, 8);
+            else
+                lept_write_float(c, 0xCA, 0xCB, n);
+            break;
+        default: lept_write_float(c, 0xCA, 0xCB, n);
+    }
+}
+
+static void lept_msgpack_value(lept_context* c, const lept_value* v) {
+    lept_walk w;
+    lept_walk_frame* f = NULL;
+    size_t i;
+    lept_walk_init(&w);
+    for (;;) {
+        switch (v->type) {
+            case LEPT_NULL:   PUTC(c, (char)0xC0); break;
+            case LEPT_FALSE:  PUTC(c, (char)0xC2); break;
+            case LEPT_TRUE:   PUTC(c, (char)0xC3); break;
+            case LEPT_NUMBER: lept_msgpack_number(c, v->u.n); break;
+            case LEPT_STRING:
+                lept_msgpack_head(c, 0xA0, 31, 0xDA, LEPT_STRING_LEN(v));
+                lept_write_bytes(c, v->u.s.s, LEPT_STRING_LEN(v));
+                break;
+            case LEPT_ARRAY:
+                lept_msgpack_head(c, 0x90, 15, 0xDC, LEPT_ARRAY_SIZE(v));
+                if (v->flags & LEPT_FLAG_PACKED)
+                    for (i = 0; i < LEPT_ARRAY_SIZE(v); i++) {
+                        lept_stringify_flush(c, LEPT_STRINGIFY_FLUSH_SIZE);
+                        lept_msgpack_number(c, LEPT_ARRAY_DOUBLES(v)[i]);
+                    }
+                else
+                    f = lept_walk_push(&w, v);
+                break;
+            case LEPT_OBJECT:
+                lept_msgpack_head(c, 0x80, 15, 0xDE, LEPT_OBJECT_SIZE(v));
+                f = lept_walk_push(&w, v);
+                break;
+            default: assert(0 && "invalid type");
+        }
+        while (f != NULL && f->index == f->size)
+            f = lept_walk_pop(&w);
+        if (f == NULL)
+            break;
+        lept_stringify_flush(c, LEPT_STRINGIFY_FLUSH_SIZE);
+        if (f->v->type == LEPT_OBJECT) {
+            lept_msgpack_head(c, 0xA0, 31, 0xDA, f->v->u.o.m[f->index].klen);
+            lept_write_bytes(c, f->v->u.o.m[f->index].k, f->v->u.o.m[f->index].klen);
+        }
+        v = LEPT_WALK_NEXT(f);
+    }
+    lept_walk_free(&w);
+}
+
+/* bin and ext are rejected */
+static int lept_msgpack_item(const unsigned char** pp, const unsigned char* end, lept_item* item) {
+    const unsigned char* p = *pp;
+    unsigned b;
+    uint64_t u = 0;
+    int n = 0;
+    if (p == end)
+        return LEPT_PARSE_EXPECT_VALUE;
+    b = *p++;
+    if (b >= 0xCA && b <= 0xD3)
+        n = 1 << ((b - 0xCA + 2) & 3);          /* float32, float64, uint8..64, int8..64 */
+    else if (b >= 0xD9 && b <= 0xDF)
+        n = "\1\2\4\2\4\2\4"[b - 0xD9];         /* str8..32, array16..32, map16..32 */
+    if (n > 0) {
+        if (end - p < n)
+            return LEPT_PARSE_EXPECT_VALUE;
+        u = lept_read_be(p, n);
+        p += n;
+    }
+    item->type = LEPT_NUMBER;
+    if (b <= 0x7F)
+        item->n = b;
+    else if (b >= 0xE0)
+        item->n = (double)b - 256;
+    else if (b < 0xC0) {
+        u = b < 0x90 ? b & 0x0F : b < 0xA0 ? b & 0x0F : b & 0x1F;
+        item->type = b < 0x90 ? LEPT_OBJECT : b < 0xA0 ? LEPT_ARRAY : LEPT_STRING;
+    }
+    else
+        switch (b) {
+            case 0xC0: item->type = LEPT_NULL; break;
+            case 0xC2: item->type = LEPT_FALSE; break;
+            case 0xC3: item->type = LEPT_TRUE; break;
+            case 0xCA: case 0xCB: item->n = lept_read_float(p - n, n); break;
+            case 0xCC: case 0xCD: case 0xCE: case 0xCF: item->n = (double)u; break;
+            case 0xD0: case 0xD1: case 0xD2: case 0xD3:
+                if (u >> (n * 8 - 1))   /* negative: magnitude is the complement plus one */
+                    item->n = -(double)(~u & (UINT64_C(0xFFFFFFFFFFFFFFFF) >> (64 - n * 8))) - 1;
+                else
+                    item->n = (double)u;
+                break;
+            case 0xD9: case 0xDA: case 0xDB: item->type = LEPT_STRING; break;
+            case 0xDC: case 0xDD: item->type = LEPT_ARRAY; break;
+            case 0xDE: case 0xDF: item->type = LEPT_OBJECT; break;
+            default: return LEPT_PARSE_INVALID_VALUE;
+        }
+    switch (item->type) {
+        case LEPT_STRING:
+            if (u > (uint64_t)(end - p))
+                return LEPT_PARSE_EXPECT_VALUE;
+            item->s = (const char*)p;
+            item->size = (size_t)u;
+            p += u;
+            break;
+        case LEPT_ARRAY:
+        case LEPT_OBJECT:
+            if (u > (uint64_t)(end - p) / (item->type == LEPT_ARRAY ? 1 : 2))
+                return LEPT_PARSE_EXPECT_VALUE;
+            item->size = (size_t)u;
+            break;
+    }
+    *pp = p;
+    return LEPT_PARSE_OK;
+}
+
+/* Containers are sized from their declared counts up front, so children can be decoded in place */
+static void lept_decode_set(lept_value* v, const lept_item* item) {
+    lept_init(v);
+    switch (item->type) {
+        case LEPT_NUMBER: lept_set_number(v, item->n); break;
+        case LEPT_STRING: lept_set_string(v, item->s, item->size); break;
+        case LEPT_ARRAY:  lept_set_array(v, item->size); break;
+        case LEPT_OBJECT: lept_set_object(v, item->size); break;
+        default: v->type = (lept_type)item->type;
+    }
+}
+
+static int lept_decode(lept_value* v, const void* data, size_t len, lept_item_reader read) {
+    const unsigned char* p = (const unsigned char*)data, *end = p + len;
+    lept_context c;
+    lept_item item;
+    lept_value** top, *container, *child;
+    int ret;
+    assert(v != NULL && (data != NULL || len == 0));
+    c.stack = NULL;
+    c.size = c.top = 0;
+    lept_init(v);
+    if ((ret = read(&p, end, &item)) != LEPT_PARSE_OK)
+        return ret;
+    lept_decode_set(v, &item);
+    if (item.size > 0 && (item.type == LEPT_ARRAY || item.type == LEPT_OBJECT))
+        *(lept_value**)lept_context_push(&c, sizeof(lept_value*)) = v;
+    while (c.top > 0) {
+        top = (lept_value**)(c.stack + c.top) - 1;
+        container = *top;
+        if (container->type == LEPT_ARRAY) {
+            child = &container->u.a.e[LEPT_ARRAY_SIZE(container)];
+            lept_init(child);
+            if (++LEPT_ARRAY_SIZE(container) == LEPT_ARRAY_CAPACITY(container))
+                c.top -= sizeof(lept_value*);
+        }
+        else {
+            lept_member* m = &container->u.o.m[LEPT_OBJECT_SIZE(container)];
+            if ((ret = read(&p, end, &item)) != LEPT_PARSE_OK)
+                break;
+            if (item.type != LEPT_STRING) {
+                ret = LEPT_PARSE_MISS_KEY;
+                break;
+            }
+            memcpy(m->k = (char*)LEPT_MALLOC(item.size + 1), item.s, item.size);
+            m->k[m->klen = item.size] = '\0';
+            child = &m->v;
+            lept_init(child);
+            if (++LEPT_OBJECT_SIZE(container) == LEPT_OBJECT_CAPACITY(container))
+                c.top -= sizeof(lept_value*);
+        }
+        if ((ret = read(&p, end, &item)) != LEPT_PARSE_OK)
+            break;
+        lept_decode_set(child, &item);
+        if (item.size > 0 && (item.type == LEPT_ARRAY || item.type == LEPT_OBJECT))
+            *(lept_value**)lept_context_push(&c, sizeof(lept_value*)) = child;
+    }
+    LEPT_FREE(c.stack);
+    if (ret == LEPT_PARSE_OK && p != end)
+        ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
+    if (ret != LEPT_PARSE_OK)
+        lept_free(v);
+    return ret;
+}
+
+int lept_encode_cbor(const lept_value* v, lept_write_fn write_fn, void* sink) {
+    return lept_write_to(v, lept_cbor_value, write_fn, sink);
+}
+
+int lept_decode_cbor(lept_value* v, const void* data, size_t len) {
+    return lept_decode(v, data, len, lept_cbor_item);
+}
+
+int lept_encode_msgpack(const lept_value* v, lept_write_fn write_fn, void* sink) {
+    return lept_write_to(v, lept_msgpack_value, write_fn, sink);
+}
+
+int lept_decode_msgpack(lept_value* v, const void* data, size_t len) {
+    return lept_decode(v, data, len, lept_msgpack_item);
+}
+
+/* The reference counted buffer of a string, array or object, NULL for other values and empty containers */
+static void* lept_buffer(const lept_value* v) {
+    switch (v->type) {
+        case LEPT_STRING: return v->u.s.s;
+        case LEPT_ARRAY:  return v->u.a.e;
+        case LEPT_OBJECT: return v->u.o.m;
+        default:          return NULL;
+    }
+}
+
+static void lept_retain(void* p) {
+    LEPT_RETAIN(LEPT_REFS_LOAD(p) == LEPT_REFS_BLOCK ? LEPT_BLOCK_OF(p) : (char*)p);
+}
+
+/* Drops a reference to the buffer of v, returns non-zero if it was the last one and the elements / members are to be freed */
+static int lept_release(const lept_value* v) {
+    void* p = lept_buffer(v);
+    if (p == NULL)
+        return 0;
+    if (LEPT_REFS_LOAD(p) == LEPT_REFS_BLOCK) {
+        /* nothing in a block is freed on its own */
+        p = LEPT_BLOCK_OF(p);
+        if (LEPT_RELEASE(p) == 0)
+            LEPT_BLOCK_FREE(p);
+        return 0;
+    }
+    if (LEPT_RELEASE(p) != 0)
+        return 0;
+    if (v->type == LEPT_STRING)
+        LEPT_STRING_FREE(p);
+    else if (LEPT_IS_PACKED(v))
+        LEPT_BUFFER_FREE(p);
+    else
+        return 1;
+    return 0;
+}
+
+void lept_copy(lept_value* dst, const lept_value* src) {
+    lept_value temp;
+    void* p;
+    assert(src != NULL && dst != NULL && src != dst);
+    /* share the buffer, the first mutator to find it shared gives its value a copy of one level */
+    memcpy(&temp, src, sizeof(lept_value));
+    if ((p = lept_buffer(src)) != NULL)
+        lept_retain(p);
+    lept_free(dst);
+    memcpy(dst, &temp, sizeof(lept_value));
+}
+
+void lept_move(lept_value* dst, lept_value* src) {
+    assert(dst != NULL && src != NULL && src != dst);
+    lept_free(dst);
+    memcpy(dst, src, sizeof(lept_value));
+    lept_init(src);
+}
+
+void lept_swap(lept_value* lhs, lept_value* rhs) {
+    assert(lhs != NULL && rhs != NULL);
+    if (lhs != rhs) {
+        lept_value temp;
+        memcpy(&temp, lhs, sizeof(lept_value));
+        memcpy(lhs,   rhs, sizeof(lept_value));
+        memcpy(rhs, &temp, sizeof(lept_value));
+    }
+}
+
+void lept_free(lept_value* v) {
+    lept_context c;
+    assert(v != NULL);
+    if (!lept_release(v)) {
+        v->type = LEPT_NULL;
+        return;
+    }
+    /* containers are emptied from the back; a parent is only pushed when descending into a child container released for good */
+    c.stack = NULL;
+    c.size = c.top = 0;
+    for (;;) {
+        lept_value* e = NULL;
+        if (v->type == LEPT_ARRAY) {
+            if (LEPT_ARRAY_SIZE(v) > 0)
+                e = &v->u.a.e[--LEPT_ARRAY_SIZE(v)];
+            else
+                LEPT_BUFFER_FREE(v->u.a.e);
+        }
+        else {
+            if (LEPT_OBJECT_SIZE(v) > 0) {
+                lept_member* m = &v->u.o.m[--LEPT_OBJECT_SIZE(v)];
+                LEPT_FREE(m->k);
+                e = &m->v;
+            }
+            else
+                LEPT_BUFFER_FREE(v->u.o.m);
+        }
+        if (e != NULL) {
+            if (lept_release(e)) {
+                *(lept_value**)lept_context_push(&c, sizeof(lept_value*)) = v;
+                v = e;
+            }
+            continue;
+        }
+        v->type = LEPT_NULL;
+        if (c.top == 0)
+            break;
+        v = *(lept_value**)lept_context_pop(&c, sizeof(lept_value*));
+    }
+    LEPT_FREE(c.stack);
+}
+
+lept_type lept_get_type(const lept_value* v) {
+    assert(v != NULL);
+    return (lept_type)v->type;
+}
+
+#define LEPT_HASH_K0 UINT64_C(0x9E3779B97F4A7C15)
+#define LEPT_HASH_K1 UINT64_C(0xC2B2AE3D27D4EB4F)
+#define LEPT_HASH_K2 UINT64_C(0x165667B19E3779F9)
+#define LEPT_ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static uint64_t lept_hash_mix(uint64_t h) { /* murmur3 fmix64 */
+    h ^= h >> 33;
+    h *= UINT64_C(0xFF51AFD7ED558CCD);
+    h ^= h >> 33;
+    h *= UINT64_C(0xC4CEB9FE1A85EC53);
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t lept_hash_word(const char* p) {
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+static uint64_t lept_hash_string(const char* s, size_t len, uint64_t seed) {
+    /* four independent 64-bit lanes per 32-byte block, so the loop vectorizes / pipelines */
+    uint64_t h = seed ^ ((uint64_t)len * LEPT_HASH_K0), tail = 0;
+    const char* end = s + len;
+    if (len >= 32) {
+        uint64_t l0 = h, l1 = h ^ LEPT_HASH_K1, l2 = h ^ LEPT_HASH_K2, l3 = h ^ LEPT_HASH_K0;
+        for (; end - s >= 32; s += 32) {
+            l0 = LEPT_ROTL64(l0 ^ (lept_hash_word(s     ) * LEPT_HASH_K1), 31) * LEPT_HASH_K0;
+            l1 = LEPT_ROTL64(l1 ^ (lept_hash_word(s +  8) * LEPT_HASH_K1), 31) * LEPT_HASH_K0;
+            l2 = LEPT_ROTL64(l2 ^ (lept_hash_word(s + 16) * LEPT_HASH_K1), 31) * LEPT_HASH_K0;
+            l3 = LEPT_ROTL64(l3 ^ (lept_hash_word(s + 24) * LEPT_HASH_K1), 31) * LEPT_HASH_K0;
+        }
+        h = LEPT_ROTL64(l0, 1) + LEPT_ROTL64(l1, 7) + LEPT_ROTL64(l2, 12) + LEPT_ROTL64(l3, 18);
+    }
+    for (; end - s >= 8; s += 8)
+        h = LEPT_ROTL64(h ^ (lept_hash_word(s) * LEPT_HASH_K1), 27) * LEPT_HASH_K0 + LEPT_HASH_K2;
+    memcpy(&tail, s, (size_t)(end - s));
+    return lept_hash_mix(h ^ (tail * LEPT_HASH_K1));
+}
+
+static uint64_t lept_hash_scalar(const lept_value* v, uint64_t seed) {
+    uint64_t bits;
+    double n;
+    switch (v->type) {
+        case LEPT_NUMBER:
+            n = v->u.n == 0.0 ? 0.0 : v->u.n; /* -0 == 0 */
+            memcpy(&bits, &n, sizeof(bits));
+            return lept_hash_mix(seed ^ LEPT_HASH_K2 ^ ((bits + 1) * LEPT_HASH_K0));  /* + 1: 0 apart from {} */
+        case LEPT_STRING:
+            return lept_hash_string(v->u.s.s, LEPT_STRING_LEN(v), seed ^ LEPT_HASH_K1);
+        default:
+            return lept_hash_mix(seed ^ ((uint64_t)(v->type + 1) * LEPT_HASH_K0));
+    }
+}
+
+typedef struct {
+    const lept_value* v;
+    size_t index;
+    uint64_t h, key;
+}lept_hash_frame;
+
+/* Hashes of containers by buffer, filled in by lept_hash_tree(); copies sharing a buffer share the entry */
+typedef struct {
+    const void* p;
+    uint64_t h;
+}lept_hash_entry;
+
+typedef struct {
+    lept_hash_entry* e;
+    size_t mask, count;
+}lept_hash_table;
+
+static const uint64_t* lept_hash_table_find(const lept_hash_table* t, const void* p) {
+    size_t i;
+    if (t->e == NULL || p == NULL)
+        return NULL;
+    for (i = (size_t)lept_hash_mix((uint64_t)(size_t)p) & t->mask; t->e[i].p != NULL; i = (i + 1) & t->mask)
+        if (t->e[i].p == p)
+            return &t->e[i].h;
+    return NULL;
+}
+
+static void lept_hash_table_put(lept_hash_table* t, const void* p, uint64_t h) {
+    size_t i;
+    if (t->count * 2 >= t->mask) {
+        lept_hash_table old = *t;
+        t->mask = old.e != NULL ? old.mask * 2 + 1 : 63;
+        t->e = (lept_hash_entry*)lept_calloc(t->mask + 1, sizeof(lept_hash_entry));
+        t->count = 0;
+        for (i = 0; old.e != NULL && i <= old.mask; i++)
+            if (old.e[i].p != NULL)
+                lept_hash_table_put(t, old.e[i].p, old.e[i].h);
+        LEPT_FREE(old.e);
+    }
+    for (i = (size_t)lept_hash_mix((uint64_t)(size_t)p) & t->mask; t->e[i].p != NULL; i = (i + 1) & t->mask)
+        if (t->e[i].p == p)
+            return;
+    t->e[i].p = p;
+    t->e[i].h = h;
+    t->count++;
+}
+
+static void lept_hash_fold(lept_hash_frame* f, uint64_t h) {
+    if (f->v->type == LEPT_ARRAY)
+        f->h = LEPT_ROTL64(f->h ^ h, 29) * LEPT_HASH_K0;
+    else /* members are summed so that the order does not matter */
+        f->h += lept_hash_mix(f->key ^ (h * LEPT_HASH_K1));
+}
+
+/* With a table, the hash of every container is recorded there and containers already in it are not walked again */
+static uint64_t lept_hash_tree(const lept_value* v, uint64_t seed, lept_hash_table* t) {
+    lept_context c;
+    lept_hash_frame* f;
+    const uint64_t* known;
+    uint64_t h;
+    if (v->type != LEPT_ARRAY && v->type != LEPT_OBJECT)
+        return lept_hash_scalar(v, seed);
+    if (t != NULL && (known = lept_hash_table_find(t, lept_buffer(v))) != NULL)
+        return *known;
+    c.stack = NULL;
+    c.size = c.top = 0;
+    f = (lept_hash_frame*)lept_context_push(&c, sizeof(lept_hash_frame));
+    f->v = v;
+    f->index = 0;
+    f->h = seed ^ (v->type == LEPT_ARRAY ? LEPT_HASH_K1 : LEPT_HASH_K2);
+    for (;;) {
+        size_t size;
+        f = (lept_hash_frame*)(c.stack + c.top - sizeof(lept_hash_frame));
+        size = f->v->type == LEPT_ARRAY ? LEPT_ARRAY_SIZE(f->v) : LEPT_OBJECT_SIZE(f->v);
+        if (f->index == size) {
+            h = lept_hash_mix(f->h ^ ((uint64_t)size * LEPT_HASH_K2));
+            if (t != NULL && lept_buffer(f->v) != NULL)
+                lept_hash_table_put(t, lept_buffer(f->v), h);
+            lept_context_pop(&c, sizeof(lept_hash_frame));
+            if (c.top == 0)
+                break;
+            lept_hash_fold((lept_hash_frame*)(c.stack + c.top - sizeof(lept_hash_frame)), h);
+        }
+        else {
+            const lept_value* e;
+            lept_value n;
+            if (LEPT_IS_PACKED(f->v)) {
+                n.type = LEPT_NUMBER;
+                n.u.n = LEPT_ARRAY_DOUBLES(f->v)[f->index++];
+                e = &n;
+            }
+            else if (f->v->type == LEPT_ARRAY)
+                e = &f->v->u.a.e[f->index++];
+            else {
+                const lept_member* m = &f->v->u.o.m[f->index++];
+                f->key = lept_hash_string(m->k, m->klen, seed);
+                e = &m->v;
+            }
+            if (t != NULL && e->type >= LEPT_ARRAY && (known = lept_hash_table_find(t, lept_buffer(e))) != NULL)
+                lept_hash_fold(f, *known);
+            else if (e->type == LEPT_ARRAY || e->type == LEPT_OBJECT) {
+                f = (lept_hash_frame*)lept_context_push(&c, sizeof(lept_hash_frame));
+                f->v = e;
+                f->index = 0;
+                f->h = seed ^ (e->type == LEPT_ARRAY ? LEPT_HASH_K1 : LEPT_HASH_K2);
+            }
+            else
+                lept_hash_fold(f, lept_hash_scalar(e, seed));
+        }
+    }
+    LEPT_FREE(c.stack);
+    return h;
+}
+
+uint64_t lept_hash(const lept_value* v, uint64_t seed) {
+    assert(v != NULL);
+    return lept_hash_tree(v, seed, NULL);
+}
+
+typedef struct {
+    const lept_value* v;
+    int shared;     /* reached through a buffer with more than one reference */
+}lept_memory_item;
+
+/*
+ * Accounts a buffer of header + used + slack bytes, heap being the size of the allocation to add if the
+ * buffer is one rather than part of a lept_compact() block. The caller adds used to its category.
+ */
+static void lept_memory_block(lept_memory_stats* stats, size_t header, size_t used, size_t slack, int shared, size_t heap) {
+    size_t overhead = header;
+    if (heap != 0) {
+        overhead += (heap + LEPT_MALLOC_HEADER + LEPT_MALLOC_ALIGN - 1) / LEPT_MALLOC_ALIGN * LEPT_MALLOC_ALIGN - heap;
+        stats->blocks++;
+    }
+    stats->slack += slack;
+    stats->overhead += overhead;
+    if (shared)
+        stats->shared += used + slack + overhead;
+}
+
+void lept_memory_usage(const lept_value* v, lept_memory_stats* stats) {
+    lept_context c;
+    lept_hash_table seen;
+    lept_memory_item* item;
+    size_t i, n, header, slack;
+    int heap;
+    assert(v != NULL && stats != NULL);
+    memset(stats, 0, sizeof(lept_memory_stats));
+    c.stack = NULL;
+    c.size = c.top = 0;
+    seen.e = NULL;
+    seen.mask = seen.count = 0;
+    item = (lept_memory_item*)lept_context_push(&c, sizeof(lept_memory_item));
+    item->v = v;
+    item->shared = 0;
+    while (c.top > 0) {
+        lept_memory_item it = *(lept_memory_item*)lept_context_pop(&c, sizeof(lept_memory_item));
+        const void* p = lept_buffer(it.v);
+        if (p == NULL)
+            continue;
+        /* only a buffer with several references can be reached again */
+        heap = LEPT_REFS_LOAD(p) != LEPT_REFS_BLOCK;
+        if (LEPT_REFS_LOAD(p) > 1) {
+            if (lept_hash_table_find(&seen, p) != NULL)
+                continue;
+            lept_hash_table_put(&seen, p, 0);
+            if (heap)
+                it.shared = 1;
+        }
+        if (!heap) {
+            /* a buffer in a block is shared if the block is */
+            const char* b = LEPT_BLOCK_OF(p);
+            if (LEPT_REFS_LOAD(b) > 1)
+                it.shared = 1;
+            if (lept_hash_table_find(&seen, b) == NULL) {
+                lept_hash_table_put(&seen, b, 0);
+                lept_memory_block(stats, 2 * sizeof(size_t), 0, 0, it.shared, 2 * sizeof(size_t) + LEPT_BLOCK_SIZE(b));
+            }
+        }
+        header = heap ? LEPT_BUFFER_WORDS * sizeof(size_t) : LEPT_BLOCK_HEADER;
+        switch (it.v->type) {
+            case LEPT_STRING:
+                n = LEPT_STRING_LEN(it.v) + 1;
+                stats->strings += n;
+                if (heap)
+                    lept_memory_block(stats, sizeof(size_t), n, 0, it.shared, sizeof(size_t) + n);
+                else
+                    lept_memory_block(stats, header + LEPT_BLOCK_ROUND(n) - n, n, 0, it.shared, 0);
+                break;
+            case LEPT_ARRAY:
+                n = LEPT_ARRAY_SIZE(it.v);
+                if (LEPT_IS_PACKED(it.v)) {
+                    stats->nodes += n * sizeof(double);
+                    slack = (LEPT_ARRAY_CAPACITY(it.v) - n) * sizeof(double);
+                    lept_memory_block(stats, header, n * sizeof(double), slack, it.shared,
+                        heap ? header + n * sizeof(double) + slack : 0);
+                    break;
+                }
+                stats->nodes += n * sizeof(lept_value);
+                slack = (LEPT_ARRAY_CAPACITY(it.v) - n) * sizeof(lept_value);
+                lept_memory_block(stats, header, n * sizeof(lept_value), slack, it.shared,
+                    heap ? header + n * sizeof(lept_value) + slack : 0);
+                for (i = 0; i < n; i++)
+                    if (it.v->u.a.e[i].type >= LEPT_STRING) {
+                        item = (lept_memory_item*)lept_context_push(&c, sizeof(lept_memory_item));
+                        item->v = &it.v->u.a.e[i];
+                        item->shared = it.shared;
+                    }
+                break;
+            default:
+                n = LEPT_OBJECT_SIZE(it.v);
+                stats->nodes += n * sizeof(lept_member);
+                slack = (LEPT_OBJECT_CAPACITY(it.v) - n) * sizeof(lept_member);
+                lept_memory_block(stats, header, n * sizeof(lept_member), slack, it.shared,
+                    heap ? header + n * sizeof(lept_member) + slack : 0);
+                for (i = 0; i < n; i++) {
+                    const lept_member* m = &it.v->u.o.m[i];
+                    /* keys are plain blocks owned by the member buffer */
+                    stats->keys += m->klen + 1;
+                    lept_memory_block(stats, 0, m->klen + 1, 0, it.shared, heap ? m->klen + 1 : 0);
+                    if (m->v.type >= LEPT_STRING) {
+                        item = (lept_memory_item*)lept_context_push(&c, sizeof(lept_memory_item));
+                        item->v = &m->v;
+                        item->shared = it.shared;
+                    }
+                }
+                break;
+        }
+    }
+    stats->total = stats->nodes + stats->slack + stats->strings + stats->keys + stats->overhead;
+    LEPT_FREE(seen.e);
+    LEPT_FREE(c.stack);
+}
+
+/*
+ * Pair the members of lhs with members of rhs of the same key, writing the
+ * rhs index of lhs member i into map[i], or LEPT_KEY_NOT_EXIST if there is none.
+ * The n-th occurrence of a key in lhs is paired with the n-th occurrence in rhs,
+ * so duplicated keys compare in order. Small objects are scanned linearly, larger
+ * ones go through a temporary hash table so that the whole match is O(n) instead
+ * of O(n^2). Returns the number of pairs.
+ */
+static size_t lept_pair_object_members(const lept_value* lhs, const lept_value* rhs, size_t* map) {
+    size_t i, j, n = LEPT_OBJECT_SIZE(lhs), m = LEPT_OBJECT_SIZE(rhs), pairs = 0;
+    if (n < LEPT_EQUAL_HASH_THRESHOLD && m < LEPT_EQUAL_HASH_THRESHOLD) {
+        unsigned char used[LEPT_EQUAL_HASH_THRESHOLD];
+        memset(used, 0, m);
+        for (i = 0; i < n; i++) {
+            const lept_member* k = &lhs->u.o.m[i];
+            map[i] = LEPT_KEY_NOT_EXIST;
+            for (j = 0; j < m; j++)
+                if (!used[j] && rhs->u.o.m[j].klen == k->klen && memcmp(rhs->u.o.m[j].k, k->k, k->klen) == 0) {
+                    used[j] = 1;
+                    map[i] = j;
+                    pairs++;
+                    break;
+                }
+        }
+    }
+    else {
+        /* slot[2h]: first rhs index of a key + 1 (0 if empty), slot[2h+1]: next unpaired rhs index */
+        size_t mask, h, *slot, *next;
+        for (mask = 1; mask < m * 2; mask <<= 1);
+        slot = (size_t*)lept_calloc(mask * 2 + m, sizeof(size_t));
+        next = slot + mask * 2;
+        mask--;
+        for (j = m; j-- > 0; ) {
+            const lept_member* k = &rhs->u.o.m[j];
+            for (h = (size_t)lept_hash_string(k->k, k->klen, 0) & mask; slot[h * 2] != 0; h = (h + 1) & mask) {
+                const lept_member* f = &rhs->u.o.m[slot[h * 2] - 1];
+                if (f->klen == k->klen && memcmp(f->k, k->k, k->klen) == 0)
+                    break;
+            }
+            next[j] = slot[h * 2] != 0 ? slot[h * 2 + 1] : LEPT_KEY_NOT_EXIST;
+            slot[h * 2] = j + 1;
+            slot[h * 2 + 1] = j;
+        }
+        for (i = 0; i < n; i++) {
+            const lept_member* k = &lhs->u.o.m[i];
+            map[i] = LEPT_KEY_NOT_EXIST;
+            for (h = (size_t)lept_hash_string(k->k, k->klen, 0) & mask; slot[h * 2] != 0; h = (h + 1) & mask) {
+                const lept_member* f = &rhs->u.o.m[slot[h * 2] - 1];
+                if (f->klen == k->klen && memcmp(f->k, k->k, k->klen) == 0) {
+                    if ((map[i] = slot[h * 2 + 1]) != LEPT_KEY_NOT_EXIST) {
+                        slot[h * 2 + 1] = next[map[i]];
+                        pairs++;
+                    }
+                    break;
+                }
+            }
+        }
+        LEPT_FREE(slot);
+    }
+    return pairs;
+}
+
+typedef struct {
+    const lept_value* lhs, *rhs;
+    size_t index;
+    size_t* map;    /* object only: rhs member index paired with each lhs member */
+}lept_equal_frame;
+
+int lept_is_equal(const lept_value* lhs, const lept_value* rhs) {
+    lept_context c;
+    lept_equal_frame* f;
+    lept_value ln, rn;  /* elements of packed arrays */
+    size_t* map;
+    int ret = 1;
+    assert(lhs != NULL && rhs != NULL);
+    c.stack = NULL;
+    c.size = c.top = 0;
+    for (;;) {
+        /* compare one pair of values; containers of the same size are pushed to compare their children */
+        map = NULL;
+        if (lhs->type != rhs->type)
+            ret = 0;
+        else if (lhs->type >= LEPT_STRING && lept_buffer(lhs) != NULL && lept_buffer(lhs) == lept_buffer(rhs))
+            ret = 2;    /* copies still sharing their buffer */
+        else switch (lhs->type) {
+            case LEPT_STRING:
+                ret = LEPT_STRING_LEN(lhs) == LEPT_STRING_LEN(rhs) &&
+                    memcmp(lhs->u.s.s, rhs->u.s.s, LEPT_STRING_LEN(lhs)) == 0;
+                break;
+            case LEPT_NUMBER:
+                ret = lhs->u.n == rhs->u.n;
+                break;
+            case LEPT_ARRAY:
+                ret = LEPT_ARRAY_SIZE(lhs) == LEPT_ARRAY_SIZE(rhs);
+                break;
+            case LEPT_OBJECT:
+                if ((ret = LEPT_OBJECT_SIZE(lhs) == LEPT_OBJECT_SIZE(rhs)) && LEPT_OBJECT_SIZE(lhs) > 0) {
+                    map = (size_t*)LEPT_MALLOC(LEPT_OBJECT_SIZE(lhs) * sizeof(size_t));
+                    if (!(ret = lept_pair_object_members(lhs, rhs, map) == LEPT_OBJECT_SIZE(lhs)))
+                        LEPT_FREE(map);
+                }
+                break;
+            default:
+                break;
+        }
+        if (!ret)
+            break;
+        if (ret == 2)
+            ret = 1;
+        else if ((lhs->type == LEPT_ARRAY && LEPT_ARRAY_SIZE(lhs) > 0) || (lhs->type == LEPT_OBJECT && LEPT_OBJECT_SIZE(lhs) > 0)) {
+            f = (lept_equal_frame*)lept_context_push(&c, sizeof(lept_equal_frame));
+            f->lhs = lhs;
+            f->rhs = rhs;
+            f->index = 0;
+            f->map = map;
+        }
+        /* move on to the next pair of children, leaving finished containers */
+        for (;;) {
+            if (c.top == 0) {
+                LEPT_FREE(c.stack);
+                return 1;
+            }
+            f = (lept_equal_frame*)(c.stack + c.top - sizeof(lept_equal_frame));
+            if (f->lhs->type == LEPT_ARRAY && f->index < LEPT_ARRAY_SIZE(f->lhs)) {
+                if (LEPT_IS_PACKED(f->lhs)) {
+                    ln.type = LEPT_NUMBER;
+                    ln.u.n = LEPT_ARRAY_DOUBLES(f->lhs)[f->index];
+                    lhs = &ln;
+                }
+                else
+                    lhs = &f->lhs->u.a.e[f->index];
+                if (LEPT_IS_PACKED(f->rhs)) {
+                    rn.type = LEPT_NUMBER;
+                    rn.u.n = LEPT_ARRAY_DOUBLES(f->rhs)[f->index];
+                    rhs = &rn;
+                }
+                else
+                    rhs = &f->rhs->u.a.e[f->index];
+                f->index++;
+                break;
+            }
+            if (f->lhs->type == LEPT_OBJECT && f->index < LEPT_OBJECT_SIZE(f->lhs)) {
+                lhs = &f->lhs->u.o.m[f->index].v;
+                rhs = &f->rhs->u.o.m[f->map[f->index++]].v;
+                break;
+            }
+            LEPT_FREE(f->map);
+            lept_context_pop(&c, sizeof(lept_equal_frame));
+        }
+    }
+    while (c.top > 0)
+        LEPT_FREE(((lept_equal_frame*)lept_context_pop(&c, sizeof(lept_equal_frame)))->map);
+    LEPT_FREE(c.stack);
+    return 0;
+}
+
+int lept_get_boolean(const lept_value* v) {
+    assert(v != NULL && (v->type == LEPT_TRUE || v->type == LEPT_FALSE));
+    return v->type == LEPT_TRUE;
+}
+
+void lept_set_boolean(lept_value* v, int b) {
+    lept_free(v);
+    v->type = b ? LEPT_TRUE : LEPT_FALSE;
+}
+
+double lept_get_number(const lept_value* v) {
+    assert(v != NULL && v->type == LEPT_NUMBER);
+    return v->u.n;
+}
+
+void lept_set_number(lept_value* v, double n) {
+    lept_free(v);
+    v->u.n = n;
+    v->type = LEPT_NUMBER;
+}
+
+const char* lept_get_string(const lept_value* v) {
     assert(v != NULL && v->type == LEPT_STRING);
     return v->u.s.s;
 }
 
-size_t lept_get_string_length(const lept_value* v) {
-    assert(v != NULL && v->type == LEPT_STRING);
-    return v->u.s.len;
+size_t lept_get_string_length(const lept_value* v) {
+    assert(v != NULL && v->type == LEPT_STRING);
+    return LEPT_STRING_LEN(v);
+}
+
+void lept_set_string(lept_value* v, const char* s, size_t len) {
+    size_t* header;
+    assert(v != NULL && (s != NULL || len == 0));
+    lept_free(v);
+#ifdef LEPT_COMPACT_VALUE
+    assert((unsigned)len == len);
+#endif
+    header = (size_t*)LEPT_MALLOC(sizeof(size_t) + len + 1);
+    *header = 1;
+    v->u.s.s = (char*)(header + 1);
+    memcpy(v->u.s.s, s, len);
+    v->u.s.s[len] = '\0';
+    LEPT_STRING_LEN(v) = len;
+    v->type = LEPT_STRING;
+    v->flags = 0;
+}
+
+static void* lept_buffer_resize(void* p, size_t capacity, size_t size) {
+    size_t* header = p != NULL ? (size_t*)p - LEPT_BUFFER_WORDS : NULL;
+    assert(p == NULL || LEPT_REFS(p) == 1);
+    if (capacity == 0) {
+        LEPT_FREE(header);
+        return NULL;
+    }
+    header = (size_t*)LEPT_REALLOC(header, LEPT_BUFFER_WORDS * sizeof(size_t) + capacity * size);
+#ifdef LEPT_COMPACT_VALUE
+    assert((unsigned)capacity == capacity);
+    header[0] = capacity;
+#endif
+    header[LEPT_BUFFER_WORDS - 1] = 1;
+    return header + LEPT_BUFFER_WORDS;
+}
+
+static void lept_resize_array(lept_value* v, size_t capacity) {
+    v->u.a.e = (lept_value*)lept_buffer_resize(v->u.a.e, capacity, sizeof(lept_value));
+#ifndef LEPT_COMPACT_VALUE
+    v->u.a.capacity = capacity;
+#endif
+}
+
+static void lept_resize_object(lept_value* v, size_t capacity) {
+    v->u.o.m = (lept_member*)lept_buffer_resize(v->u.o.m, capacity, sizeof(lept_member));
+#ifndef LEPT_COMPACT_VALUE
+    v->u.o.capacity = capacity;
+#endif
+}
+
+static double* lept_set_packed_array(lept_value* v, size_t size) {
+    lept_set_array(v, 0);
+    v->u.a.e = (lept_value*)lept_buffer_resize(NULL, size, sizeof(double));
+#ifndef LEPT_COMPACT_VALUE
+    v->u.a.capacity = size;
+#endif
+    LEPT_ARRAY_SIZE(v) = size;
+    v->flags |= LEPT_FLAG_PACKED;
+    return LEPT_ARRAY_DOUBLES(v);
+}
+
+/*
+ * Makes the elements of an array writable, keeping its capacity: a packed array is turned
+ * back into lept_value elements and a shared buffer is replaced by a copy sharing the elements.
+ */
+static void lept_own_array(lept_value* v) {
+    lept_value old;
+    size_t i, capacity;
+    if (v->u.a.e == NULL || (!(v->flags & LEPT_FLAG_PACKED) && LEPT_REFS_LOAD(v->u.a.e) == 1))
+        return;
+    memcpy(&old, v, sizeof(lept_value));
+    capacity = LEPT_ARRAY_CAPACITY(v);
+    v->u.a.e = NULL;
+    v->flags &= ~LEPT_FLAG_PACKED;
+    lept_resize_array(v, capacity);
+    for (i = 0; i < LEPT_ARRAY_SIZE(v); i++) {
+        lept_value* e = &v->u.a.e[i];
+        void* p;
+        if (old.flags & LEPT_FLAG_PACKED) {
+            e->type = LEPT_NUMBER;
+            e->u.n = LEPT_ARRAY_DOUBLES(&old)[i];
+        }
+        else if ((p = lept_buffer(memcpy(e, &old.u.a.e[i], sizeof(lept_value)))) != NULL)
+            lept_retain(p);
+    }
+    lept_free(&old);
+}
+
+/* Replaces a shared member buffer by a copy sharing the values */
+static void lept_own_object(lept_value* v) {
+    lept_value old;
+    size_t i;
+    if (v->u.o.m == NULL || LEPT_REFS_LOAD(v->u.o.m) == 1)
+        return;
+    memcpy(&old, v, sizeof(lept_value));
+    v->u.o.m = NULL;
+    lept_resize_object(v, LEPT_OBJECT_CAPACITY(&old));
+    for (i = 0; i < LEPT_OBJECT_SIZE(v); i++) {
+        lept_member* m = &v->u.o.m[i];
+        void* p;
+        memcpy(m, &old.u.o.m[i], sizeof(lept_member));
+        memcpy(m->k = (char*)LEPT_MALLOC(m->klen + 1), old.u.o.m[i].k, m->klen + 1);
+        if ((p = lept_buffer(&m->v)) != NULL)
+            lept_retain(p);
+    }
+    lept_free(&old);
+}
+
+void lept_set_array(lept_value* v, size_t capacity) {
+    assert(v != NULL);
+    lept_free(v);
+    v->type = LEPT_ARRAY;
+    v->flags = 0;
+    LEPT_ARRAY_SIZE(v) = 0;
+    v->u.a.e = NULL;
+    lept_resize_array(v, capacity);
+}
+
+size_t lept_get_array_size(const lept_value* v) {
+    assert(v != NULL && v->type == LEPT_ARRAY);
+    return LEPT_ARRAY_SIZE(v);
+}
+
+size_t lept_get_array_capacity(const lept_value* v) {
+    assert(v != NULL && v->type == LEPT_ARRAY);
+    return LEPT_ARRAY_CAPACITY(v);
+}
+
+void lept_reserve_array(lept_value* v, size_t capacity) {
+    assert(v != NULL && v->type == LEPT_ARRAY);
+    lept_own_array(v);
+    if (LEPT_ARRAY_CAPACITY(v) < capacity)
+        lept_resize_array(v, capacity);
+}
+
+void lept_shrink_array(lept_value* v) {
+    assert(v != NULL && v->type == LEPT_ARRAY);
+    lept_own_array(v);
+    if (LEPT_ARRAY_CAPACITY(v) > LEPT_ARRAY_SIZE(v))
+        lept_resize_array(v, LEPT_ARRAY_SIZE(v));
+}
+
+void lept_clear_array(lept_value* v) {
+    assert(v != NULL && v->type == LEPT_ARRAY);
+    lept_erase_array_element(v, 0, LEPT_ARRAY_SIZE(v));
+}
+
+const lept_value* lept_get_array_element(const lept_value* v, size_t index) {
+    assert(v != NULL && v->type == LEPT_ARRAY && !LEPT_IS_PACKED(v));
+    assert(index < LEPT_ARRAY_SIZE(v));
+    return &v->u.a.e[index];
+}
+
+lept_value* lept_set_array_element(lept_value* v, size_t index) {
+    assert(v != NULL && v->type == LEPT_ARRAY);
+    assert(index < LEPT_ARRAY_SIZE(v));
+    lept_own_array(v);
+    return &v->u.a.e[index];
+}
+
+const double* lept_get_array_doubles(const lept_value* v, size_t* size) {
+    assert(v != NULL && v->type == LEPT_ARRAY);
+    if (size)
+        *size = LEPT_ARRAY_SIZE(v);
+    return (v->flags & LEPT_FLAG_PACKED) ? LEPT_ARRAY_DOUBLES(v) : NULL;
+}
+
+lept_value* lept_pushback_array_element(lept_value* v) {
+    assert(v != NULL && v->type == LEPT_ARRAY);
+    lept_own_array(v);
+    if (LEPT_ARRAY_SIZE(v) == LEPT_ARRAY_CAPACITY(v))
+        lept_reserve_array(v, LEPT_ARRAY_CAPACITY(v) == 0 ? 1 : LEPT_ARRAY_CAPACITY(v) * 2);
+    lept_init(&v->u.a.e[LEPT_ARRAY_SIZE(v)]);
+    return &v->u.a.e[LEPT_ARRAY_SIZE(v)++];
+}
+
+void lept_popback_array_element(lept_value* v) {
+    assert(v != NULL && v->type == LEPT_ARRAY && LEPT_ARRAY_SIZE(v) > 0);
+    lept_own_array(v);
+    lept_free(&v->u.a.e[--LEPT_ARRAY_SIZE(v)]);
+}
+
+lept_value* lept_insert_array_element(lept_value* v, size_t index) {
+    assert(v != NULL && v->type == LEPT_ARRAY && index <= LEPT_ARRAY_SIZE(v));
+    lept_own_array(v);
+    if (LEPT_ARRAY_SIZE(v) == LEPT_ARRAY_CAPACITY(v))
+        lept_reserve_array(v, LEPT_ARRAY_CAPACITY(v) == 0 ? 1 : LEPT_ARRAY_CAPACITY(v) * 2);
+    memmove(&v->u.a.e[index + 1], &v->u.a.e[index], (LEPT_ARRAY_SIZE(v) - index) * sizeof(lept_value));
+    lept_init(&v->u.a.e[index]);
+    LEPT_ARRAY_SIZE(v)++;
+    return &v->u.a.e[index];
+}
+
+void lept_erase_array_element(lept_value* v, size_t index, size_t count) {
+    size_t i;
+    assert(v != NULL && v->type == LEPT_ARRAY && index + count <= LEPT_ARRAY_SIZE(v));
+    lept_own_array(v);
+    for (i = index; i < index + count; i++)
+        lept_free(&v->u.a.e[i]);
+    memmove(&v->u.a.e[index], &v->u.a.e[index + count], (LEPT_ARRAY_SIZE(v) - index - count) * sizeof(lept_value));
+    LEPT_ARRAY_SIZE(v) -= count;
+}
+
+void lept_set_object(lept_value* v, size_t capacity) {
+    assert(v != NULL);
+    lept_free(v);
+    v->type = LEPT_OBJECT;
+    v->flags = 0;
+    LEPT_OBJECT_SIZE(v) = 0;
+    v->u.o.m = NULL;
+    lept_resize_object(v, capacity);
+}
+
+size_t lept_get_object_size(const lept_value* v) {
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    return LEPT_OBJECT_SIZE(v);
+}
+
+size_t lept_get_object_capacity(const lept_value* v) {
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    return LEPT_OBJECT_CAPACITY(v);
+}
+
+void lept_reserve_object(lept_value* v, size_t capacity) {
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    lept_own_object(v);
+    if (LEPT_OBJECT_CAPACITY(v) < capacity)
+        lept_resize_object(v, capacity);
+}
+
+void lept_shrink_object(lept_value* v) {
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    lept_own_object(v);
+    if (LEPT_OBJECT_CAPACITY(v) > LEPT_OBJECT_SIZE(v))
+        lept_resize_object(v, LEPT_OBJECT_SIZE(v));
+}
+
+size_t lept_shrink_to_fit_recursive(lept_value* v) {
+    lept_context c;
+    size_t i, n, reclaimed = 0;
+    assert(v != NULL);
+    c.stack = NULL;
+    c.size = c.top = 0;
+    *(lept_value**)lept_context_push(&c, sizeof(lept_value*)) = v;
+    while (c.top > 0) {
+        v = *(lept_value**)lept_context_pop(&c, sizeof(lept_value*));
+        /* shrinking a shared buffer would copy it, and packed arrays are allocated to size */
+        if (lept_buffer(v) == NULL || LEPT_REFS_LOAD(lept_buffer(v)) > 1 || LEPT_IS_PACKED(v))
+            continue;
+        if (v->type == LEPT_ARRAY) {
+            n = LEPT_ARRAY_SIZE(v);
+            if (LEPT_ARRAY_CAPACITY(v) > n) {
+                reclaimed += (LEPT_ARRAY_CAPACITY(v) - n) * sizeof(lept_value);
+                lept_resize_array(v, n);
+            }
+            for (i = 0; i < n; i++)
+                if (v->u.a.e[i].type == LEPT_ARRAY || v->u.a.e[i].type == LEPT_OBJECT)
+                    *(lept_value**)lept_context_push(&c, sizeof(lept_value*)) = &v->u.a.e[i];
+        }
+        else if (v->type == LEPT_OBJECT) {
+            n = LEPT_OBJECT_SIZE(v);
+            if (LEPT_OBJECT_CAPACITY(v) > n) {
+                reclaimed += (LEPT_OBJECT_CAPACITY(v) - n) * sizeof(lept_member);
+                lept_resize_object(v, n);
+            }
+            for (i = 0; i < n; i++)
+                if (v->u.o.m[i].v.type == LEPT_ARRAY || v->u.o.m[i].v.type == LEPT_OBJECT)
+                    *(lept_value**)lept_context_push(&c, sizeof(lept_value*)) = &v->u.o.m[i].v;
+        }
+    }
+    LEPT_FREE(c.stack);
+    return reclaimed;
+}
+
+typedef struct {
+    const lept_value* src;
+    lept_value* dst;    /* NULL while measuring */
+}lept_compact_item;
+
+/* Points a copied string, array or object at its buffer q in a block */
+static void lept_compact_point(lept_value* v, char* b, char* q) {
+    ((size_t*)q)[-1] = LEPT_REFS_BLOCK;
+    ((size_t*)q)[-1 - LEPT_BUFFER_WORDS] = (size_t)(q - b);
+    if (v->type == LEPT_STRING)
+        v->u.s.s = q;
+    else if (v->type == LEPT_ARRAY) {
+        v->u.a.e = (lept_value*)q;
+#ifdef LEPT_COMPACT_VALUE
+        ((size_t*)q)[-2] = LEPT_ARRAY_SIZE(v);
+#else
+        v->u.a.capacity = LEPT_ARRAY_SIZE(v);
+#endif
+    }
+    else {
+        v->u.o.m = (lept_member*)q;
+#ifdef LEPT_COMPACT_VALUE
+        ((size_t*)q)[-2] = LEPT_OBJECT_SIZE(v);
+#else
+        v->u.o.capacity = LEPT_OBJECT_SIZE(v);
+#endif
+    }
+}
+
+/* Whether the buffer of v goes into the block; copy, if not NULL, is a copy of v that loses the spare capacity of an empty container */
+static int lept_compact_needed(const lept_value* v, lept_value* copy) {
+    if (v->type == LEPT_STRING)
+        return 1;
+    if (v->type == LEPT_ARRAY) {
+        if (LEPT_ARRAY_SIZE(v) > 0)
+            return 1;
+        if (copy != NULL) {
+            copy->u.a.e = NULL;
+#ifndef LEPT_COMPACT_VALUE
+            copy->u.a.capacity = 0;
+#endif
+            copy->flags = 0;
+        }
+    }
+    else if (v->type == LEPT_OBJECT) {
+        if (LEPT_OBJECT_SIZE(v) > 0)
+            return 1;
+        if (copy != NULL) {
+            copy->u.o.m = NULL;
+#ifndef LEPT_COMPACT_VALUE
+            copy->u.o.capacity = 0;
+#endif
+        }
+    }
+    return 0;
+}
+
+/*
+ * Lays out the buffers of src in preorder, containers from offset at[0] of block b, strings from at[1]
+ * and keys from at[2], writing the copy into dst. With b NULL the offsets are only advanced, which
+ * measures the block. Buffers shared within src are laid out once.
+ */
+static void lept_compact_tree(char* b, size_t* at, lept_value* dst, const lept_value* src) {
+    lept_context c;
+    lept_hash_table placed;
+    lept_compact_item* item;
+    size_t i, n, size, offset;
+    c.stack = NULL;
+    c.size = c.top = 0;
+    placed.e = NULL;
+    placed.mask = placed.count = 0;
+    item = (lept_compact_item*)lept_context_push(&c, sizeof(lept_compact_item));
+    item->src = src;
+    item->dst = dst;
+    while (c.top > 0) {
+        lept_compact_item it = *(lept_compact_item*)lept_context_pop(&c, sizeof(lept_compact_item));
+        const void* p = lept_buffer(it.src);
+        const uint64_t* known;
+        char* q = NULL;
+        int shared = p != NULL && LEPT_REFS_LOAD(p) > 1;
+        if (shared && (known = lept_hash_table_find(&placed, p)) != NULL) {
+            if (b != NULL)
+                lept_compact_point(it.dst, b, b + *known);
+            continue;
+        }
+        if (it.src->type == LEPT_STRING) {
+            n = LEPT_STRING_LEN(it.src) + 1;
+            offset = at[1] + LEPT_BLOCK_HEADER;
+            at[1] = offset + LEPT_BLOCK_ROUND(n);
+            if (b != NULL) {
+                memcpy(q = b + offset, it.src->u.s.s, n);
+                lept_compact_point(it.dst, b, q);
+            }
+        }
+        else {
+            if (it.src->type == LEPT_OBJECT) {
+                n = LEPT_OBJECT_SIZE(it.src);
+                size = sizeof(lept_member);
+            }
+            else {
+                n = LEPT_ARRAY_SIZE(it.src);
+                size = LEPT_IS_PACKED(it.src) ? sizeof(double) : sizeof(lept_value);
+            }
+            offset = at[0] + LEPT_BLOCK_HEADER;
+            at[0] = offset + n * size;
+            if (b != NULL) {
+                memcpy(q = b + offset, p, n * size);
+                lept_compact_point(it.dst, b, q);
+            }
+            for (i = 0; i < n && it.src->type == LEPT_OBJECT; i++) {
+                const lept_member* m = &it.src->u.o.m[i];
+                if (b != NULL)
+                    memcpy(((lept_member*)q)[i].k = b + at[2], m->k, m->klen + 1);
+                at[2] += m->klen + 1;
+            }
+            /* children are pushed last first, so that the first one follows its parent */
+            for (i = n; i-- > 0 && !LEPT_IS_PACKED(it.src); ) {
+                const lept_value* e = it.src->type == LEPT_OBJECT ? &it.src->u.o.m[i].v : &it.src->u.a.e[i];
+                lept_value* copy = NULL;
+                if (b != NULL)
+                    copy = it.src->type == LEPT_OBJECT ? &((lept_member*)q)[i].v : &((lept_value*)q)[i];
+                if (lept_compact_needed(e, copy)) {
+                    item = (lept_compact_item*)lept_context_push(&c, sizeof(lept_compact_item));
+                    item->src = e;
+                    item->dst = copy;
+                }
+            }
+        }
+        if (shared)
+            lept_hash_table_put(&placed, p, offset);
+    }
+    LEPT_FREE(placed.e);
+    LEPT_FREE(c.stack);
+}
+
+void lept_compact(lept_value* dst, const lept_value* src) {
+    lept_value temp;
+    size_t at[3], nodes, strings;
+    assert(dst != NULL && src != NULL);
+    memcpy(&temp, src, sizeof(lept_value));
+    if (lept_compact_needed(src, &temp)) {
+        size_t* header;
+        at[0] = at[1] = at[2] = 0;
+        lept_compact_tree(NULL, at, NULL, src);
+        nodes = at[0];
+        strings = at[1];
+        header = (size_t*)LEPT_MALLOC(2 * sizeof(size_t) + nodes + strings + at[2]);
+        header[0] = nodes + strings + at[2];
+        header[1] = 1;  /* held by temp, the one reference from outside */
+        at[0] = 0;
+        at[1] = nodes;
+        at[2] = nodes + strings;
+        lept_compact_tree((char*)(header + 2), at, &temp, src);
+    }
+    lept_free(dst);
+    memcpy(dst, &temp, sizeof(lept_value));
+}
+
+void lept_clear_object(lept_value* v) {
+    size_t i;
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    lept_own_object(v);
+    for (i = 0; i < LEPT_OBJECT_SIZE(v); i++) {
+        LEPT_FREE(v->u.o.m[i].k);
+        lept_free(&v->u.o.m[i].v);
+    }
+    LEPT_OBJECT_SIZE(v) = 0;
+}
+
+const char* lept_get_object_key(const lept_value* v, size_t index) {
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    assert(index < LEPT_OBJECT_SIZE(v));
+    return v->u.o.m[index].k;
+}
+
+size_t lept_get_object_key_length(const lept_value* v, size_t index) {
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    assert(index < LEPT_OBJECT_SIZE(v));
+    return v->u.o.m[index].klen;
+}
+
+const lept_value* lept_get_object_value(const lept_value* v, size_t index) {
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    assert(index < LEPT_OBJECT_SIZE(v));
+    return &v->u.o.m[index].v;
+}
+
+size_t lept_find_object_index(const lept_value* v, const char* key, size_t klen) {
+    size_t i;
+    assert(v != NULL && v->type == LEPT_OBJECT && key != NULL);
+    for (i = 0; i < LEPT_OBJECT_SIZE(v); i++)
+        if (v->u.o.m[i].klen == klen && memcmp(v->u.o.m[i].k, key, klen) == 0)
+            return i;
+    return LEPT_KEY_NOT_EXIST;
+}
+
+const lept_value* lept_find_object_value(const lept_value* v, const char* key, size_t klen) {
+    size_t index = lept_find_object_index(v, key, klen);
+    return index != LEPT_KEY_NOT_EXIST ? lept_get_object_value(v, index) : NULL;
+}
+
+lept_value* lept_set_object_value(lept_value* v, const char* key, size_t klen) {
+    size_t index;
+    lept_member* m;
+    assert(v != NULL && v->type == LEPT_OBJECT && key != NULL);
+    lept_own_object(v);
+    if ((index = lept_find_object_index(v, key, klen)) != LEPT_KEY_NOT_EXIST)
+        return &v->u.o.m[index].v;
+    if (LEPT_OBJECT_SIZE(v) == LEPT_OBJECT_CAPACITY(v))
+        lept_reserve_object(v, LEPT_OBJECT_CAPACITY(v) == 0 ? 1 : LEPT_OBJECT_CAPACITY(v) * 2);
+    m = &v->u.o.m[LEPT_OBJECT_SIZE(v)++];
+    memcpy(m->k = (char*)LEPT_MALLOC(klen + 1), key, klen);
+    m->k[klen] = '\0';
+    m->klen = klen;
+    lept_init(&m->v);
+    return &m->v;
+}
+
+void lept_remove_object_value(lept_value* v, size_t index) {
+    assert(v != NULL && v->type == LEPT_OBJECT && index < LEPT_OBJECT_SIZE(v));
+    lept_own_object(v);
+    LEPT_FREE(v->u.o.m[index].k);
+    lept_free(&v->u.o.m[index].v);
+    memmove(&v->u.o.m[index], &v->u.o.m[index + 1], (--LEPT_OBJECT_SIZE(v) - index) * sizeof(lept_member));
+}
+
+/* Snapshots */
+
+#define LEPT_SNAPSHOT_VERSION 2
+#define LEPT_SNAPSHOT_ORDER   0x01020304u
+#define LEPT_SNAPSHOT_ALIGN(n)  (((n) + 7) & ~(size_t)7)
+#define LEPT_SNAPSHOT_TYPE(v)   ((lept_type)((v)->head & 0xff))
+#define LEPT_SNAPSHOT_COUNT(v)  ((size_t)((v)->head >> 8))
+#define LEPT_SNAPSHOT_AT(v)     ((const char*)(v) + (v)->u)
+
+typedef struct {
+    char magic[8];          /* "LEPTSNAP" */
+    uint32_t version;       /* LEPT_SNAPSHOT_VERSION */
+    uint32_t order;         /* LEPT_SNAPSHOT_ORDER in the writer's byte order */
+    uint64_t size;          /* whole image including this header */
+    uint64_t checksum;      /* lept_snapshot_checksum() of the bytes after this header */
+}lept_snapshot_header;      /* followed by the root node */
+
+struct lept_snapshot_value {
+    uint64_t head;          /* length / element count / member count << 8 | lept_type */
+    uint64_t u;             /* number bits, or offset of the payload from this node */
+};  /* object members are a key node of type LEPT_STRING followed by the value node */
+
+struct lept_snapshot {
+    const char* base;
+    size_t size;
+};
+
+typedef struct {
+    const lept_value* v;
+    size_t at;              /* offset of the node to fill in */
+}lept_snapshot_frame;
+
+typedef struct {
+    size_t at, n;           /* n nodes from offset at */
+    int object;             /* key / value pairs, the keys being strings */
+}lept_snapshot_range;
+
+/* same as lept_hash() of the bytes as a string value, so the checksum can be recomputed through the API */
+static uint64_t lept_snapshot_checksum(const char* s, size_t len) {
+    return lept_hash_string(s, len, LEPT_HASH_K1);
 }
 
-void lept_set_string(lept_value* v, const char* s, size_t len) {
-    assert(v != NULL && (s != NULL || len == 0));
-    lept_free(v);
-    v->u.s.s = (char*)malloc(len + 1);
-    memcpy(v->u.s.s, s, len);
-    v->u.s.s[len] = '\0';
-    v->u.s.len = len;
-    v->type = LEPT_STRING;
+static size_t lept_snapshot_alloc(lept_context* c, size_t size) {
+    size_t at = c->top;
+    if (size > 0)
+        memset(lept_context_push(c, LEPT_SNAPSHOT_ALIGN(size)), 0, LEPT_SNAPSHOT_ALIGN(size));
+    return at;
 }
 
-void lept_set_array(lept_value* v, size_t capacity) {
-    assert(v != NULL);
-    lept_free(v);
-    v->type = LEPT_ARRAY;
-    v->u.a.size = 0;
-    v->u.a.capacity = capacity;
-    v->u.a.e = capacity > 0 ? (lept_value*)malloc(capacity * sizeof(lept_value)) : NULL;
+static void lept_snapshot_node(lept_context* c, size_t at, lept_type type, size_t count, uint64_t u) {
+    lept_snapshot_value* node = (lept_snapshot_value*)(c->stack + at);
+    node->head = (uint64_t)count << 8 | (uint64_t)type;
+    node->u = u;
 }
 
-size_t lept_get_array_size(const lept_value* v) {
-    assert(v != NULL && v->type == LEPT_ARRAY);
-    return v->u.a.size;
+static void lept_snapshot_string(lept_context* c, size_t at, const char* s, size_t len) {
+    size_t p = lept_snapshot_alloc(c, len + 1);
+    memcpy(c->stack + p, s, len);
+    lept_snapshot_node(c, at, LEPT_STRING, len, p - at);
 }
 
-size_t lept_get_array_capacity(const lept_value* v) {
-    assert(v != NULL && v->type == LEPT_ARRAY);
-    return v->u.a.capacity;
+static void lept_snapshot_number(lept_context* c, size_t at, double n) {
+    uint64_t bits;
+    memcpy(&bits, &n, sizeof(bits));
+    lept_snapshot_node(c, at, LEPT_NUMBER, 0, bits);
 }
 
-void lept_reserve_array(lept_value* v, size_t capacity) {
-    assert(v != NULL && v->type == LEPT_ARRAY);
-    if (v->u.a.capacity < capacity) {
-        v->u.a.capacity = capacity;
-        v->u.a.e = (lept_value*)realloc(v->u.a.e, capacity * sizeof(lept_value));
+int lept_snapshot_write(const lept_value* v, int fd) {
+    lept_context c, work;
+    lept_snapshot_frame* f;
+    lept_snapshot_header* h;
+    int ret;
+    assert(v != NULL);
+    c.stack = work.stack = NULL;
+    c.size = c.top = work.size = work.top = 0;
+    lept_snapshot_alloc(&c, sizeof(lept_snapshot_header));
+    f = (lept_snapshot_frame*)lept_context_push(&work, sizeof(lept_snapshot_frame));
+    f->v = v;
+    f->at = lept_snapshot_alloc(&c, sizeof(lept_snapshot_value));
+    /* the image is built in memory so the checksum can go into the header */
+    while (work.top > 0) {
+        lept_snapshot_frame e = *(lept_snapshot_frame*)lept_context_pop(&work, sizeof(lept_snapshot_frame));
+        size_t i, n, block;
+        switch (e.v->type) {
+            case LEPT_NUMBER:
+                lept_snapshot_number(&c, e.at, e.v->u.n);
+                break;
+            case LEPT_STRING:
+                lept_snapshot_string(&c, e.at, e.v->u.s.s, LEPT_STRING_LEN(e.v));
+                break;
+            case LEPT_ARRAY:
+                n = LEPT_ARRAY_SIZE(e.v);
+                block = lept_snapshot_alloc(&c, n * sizeof(lept_snapshot_value));
+                lept_snapshot_node(&c, e.at, LEPT_ARRAY, n, block - e.at);
+                for (i = 0; i < n; i++, block += sizeof(lept_snapshot_value)) {
+                    if (LEPT_IS_PACKED(e.v))
+                        lept_snapshot_number(&c, block, LEPT_ARRAY_DOUBLES(e.v)[i]);
+                    else {
+                        f = (lept_snapshot_frame*)lept_context_push(&work, sizeof(lept_snapshot_frame));
+                        f->v = &e.v->u.a.e[i];
+                        f->at = block;
+                    }
+                }
+                break;
+            case LEPT_OBJECT:
+                n = LEPT_OBJECT_SIZE(e.v);
+                block = lept_snapshot_alloc(&c, n * 2 * sizeof(lept_snapshot_value));
+                lept_snapshot_node(&c, e.at, LEPT_OBJECT, n, block - e.at);
+                for (i = 0; i < n; i++, block += 2 * sizeof(lept_snapshot_value)) {
+                    lept_snapshot_string(&c, block, e.v->u.o.m[i].k, e.v->u.o.m[i].klen);
+                    f = (lept_snapshot_frame*)lept_context_push(&work, sizeof(lept_snapshot_frame));
+                    f->v = &e.v->u.o.m[i].v;
+                    f->at = block + sizeof(lept_snapshot_value);
+                }
+                break;
+            default:
+                lept_snapshot_node(&c, e.at, e.v->type, 0, 0);
+                break;
+        }
     }
+    h = (lept_snapshot_header*)c.stack;
+    memcpy(h->magic, "LEPTSNAP", sizeof(h->magic));
+    h->version = LEPT_SNAPSHOT_VERSION;
+    h->order = LEPT_SNAPSHOT_ORDER;
+    h->size = c.top;
+    h->checksum = lept_snapshot_checksum(c.stack + sizeof(lept_snapshot_header), c.top - sizeof(lept_snapshot_header));
+    ret = lept_write_fd(&fd, c.stack, c.top);
+    LEPT_FREE(work.stack);
+    LEPT_FREE(c.stack);
+    return ret;
 }
 
-void lept_shrink_array(lept_value* v) {
-    assert(v != NULL && v->type == LEPT_ARRAY);
-    if (v->u.a.capacity > v->u.a.size) {
-        v->u.a.capacity = v->u.a.size;
-        v->u.a.e = (lept_value*)realloc(v->u.a.e, v->u.a.capacity * sizeof(lept_value));
-    }
+#ifdef _WINDOWS
+static const char* lept_snapshot_load(const char* path, size_t* size) {
+    /* no mmap(): the image is read into memory, it is still used without decoding */
+    FILE* fp;
+    char* base = NULL;
+    long n;
+    if ((fp = fopen(path, "rb")) == NULL)
+        return NULL;
+    if (fseek(fp, 0, SEEK_END) == 0 && (n = ftell(fp)) > 0 && fseek(fp, 0, SEEK_SET) == 0)
+        if ((base = (char*)LEPT_MALLOC((size_t)n)) != NULL && fread(base, 1, (size_t)n, fp) != (size_t)n) {
+            LEPT_FREE(base);
+            base = NULL;
+        }
+    fclose(fp);
+    *size = base != NULL ? (size_t)n : 0;
+    return base;
 }
 
-void lept_clear_array(lept_value* v) {
-    assert(v != NULL && v->type == LEPT_ARRAY);
-    lept_erase_array_element(v, 0, v->u.a.size);
+static void lept_snapshot_unload(const char* base, size_t size) {
+    (void)size;
+    LEPT_FREE((char*)base);
+}
+#else
+static const char* lept_snapshot_load(const char* path, size_t* size) {
+    struct stat st;
+    void* base = NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && (base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+        base = NULL;
+    close(fd);
+    *size = base != NULL ? (size_t)st.st_size : 0;
+    return (const char*)base;
 }
 
-lept_value* lept_get_array_element(lept_value* v, size_t index) {
-    assert(v != NULL && v->type == LEPT_ARRAY);
-    assert(index < v->u.a.size);
-    return &v->u.a.e[index];
+static void lept_snapshot_unload(const char* base, size_t size) {
+    munmap((void*)base, size);
 }
+#endif
 
-lept_value* lept_pushback_array_element(lept_value* v) {
-    assert(v != NULL && v->type == LEPT_ARRAY);
-    if (v->u.a.size == v->u.a.capacity)
-        lept_reserve_array(v, v->u.a.capacity == 0 ? 1 : v->u.a.capacity * 2);
-    lept_init(&v->u.a.e[v->u.a.size]);
-    return &v->u.a.e[v->u.a.size++];
+/*
+ * The checksum only catches accidents, so before the accessors trust an image every node is checked in one
+ * pass: its type, that strings and child blocks lie inside the image and strings end with '\0'. An image
+ * holds at most size / sizeof(lept_snapshot_value) nodes, which bounds the walk even if offsets form a cycle.
+ */
+static int lept_snapshot_check(const char* base, size_t size) {
+    lept_context work;
+    lept_snapshot_range* r;
+    size_t i, nodes = 1, budget = size / sizeof(lept_snapshot_value);
+    int ok = 1;
+    work.stack = NULL;
+    work.size = work.top = 0;
+    r = (lept_snapshot_range*)lept_context_push(&work, sizeof(lept_snapshot_range));
+    r->at = sizeof(lept_snapshot_header);
+    r->n = 1;
+    r->object = 0;
+    while (ok && work.top > 0) {
+        lept_snapshot_range e = *(lept_snapshot_range*)lept_context_pop(&work, sizeof(lept_snapshot_range));
+        for (i = 0; ok && i < e.n; i++) {
+            size_t at = e.at + i * sizeof(lept_snapshot_value), end = size - at;
+            const lept_snapshot_value* v = (const lept_snapshot_value*)(base + at);
+            uint64_t count = v->head >> 8, k;
+            if ((v->head & 0xff) > LEPT_OBJECT || (e.object && i % 2 == 0 && LEPT_SNAPSHOT_TYPE(v) != LEPT_STRING))
+                ok = 0;
+            else if (LEPT_SNAPSHOT_TYPE(v) == LEPT_STRING)
+                ok = v->u <= end && count < end - v->u && base[at + (size_t)v->u + (size_t)count] == '\0';
+            else if (LEPT_SNAPSHOT_TYPE(v) == LEPT_ARRAY || LEPT_SNAPSHOT_TYPE(v) == LEPT_OBJECT) {
+                k = LEPT_SNAPSHOT_TYPE(v) == LEPT_OBJECT ? 2 : 1;
+                ok = v->u % 8 == 0 && v->u <= end && count <= (end - v->u) / sizeof(lept_snapshot_value) / k &&
+                    count * k <= budget - nodes;
+                if (ok && count > 0) {
+                    nodes += (size_t)(count * k);
+                    r = (lept_snapshot_range*)lept_context_push(&work, sizeof(lept_snapshot_range));
+                    r->at = at + (size_t)v->u;
+                    r->n = (size_t)(count * k);
+                    r->object = k == 2;
+                }
+            }
+        }
+    }
+    LEPT_FREE(work.stack);
+    return ok;
 }
 
-void lept_popback_array_element(lept_value* v) {
-    assert(v != NULL && v->type == LEPT_ARRAY && v->u.a.size > 0);
-    lept_free(&v->u.a.e[--v->u.a.size]);
+lept_snapshot* lept_snapshot_map(const char* path) {
+    lept_snapshot* s;
+    const lept_snapshot_header* h;
+    size_t size;
+    const char* base;
+    assert(path != NULL);
+    if ((base = lept_snapshot_load(path, &size)) == NULL)
+        return NULL;
+    h = (const lept_snapshot_header*)base;
+    if (size < sizeof(lept_snapshot_header) + sizeof(lept_snapshot_value) ||
+        memcmp(h->magic, "LEPTSNAP", sizeof(h->magic)) != 0 ||
+        h->version != LEPT_SNAPSHOT_VERSION ||
+        h->order != LEPT_SNAPSHOT_ORDER ||
+        h->size != size ||
+        h->checksum != lept_snapshot_checksum(base + sizeof(lept_snapshot_header), size - sizeof(lept_snapshot_header)) ||
+        !lept_snapshot_check(base, size)) {
+        lept_snapshot_unload(base, size);
+        return NULL;
+    }
+    s = (lept_snapshot*)LEPT_MALLOC(sizeof(lept_snapshot));
+    s->base = base;
+    s->size = size;
+    return s;
 }
 
-lept_value* lept_insert_array_element(lept_value* v, size_t index) {
-    assert(v != NULL && v->type == LEPT_ARRAY && index <= v->u.a.size);
-    /* \todo */
-    return NULL;
+void lept_snapshot_unmap(lept_snapshot* s) {
+    if (s != NULL) {
+        lept_snapshot_unload(s->base, s->size);
+        LEPT_FREE(s);
+    }
 }
 
-void lept_erase_array_element(lept_value* v, size_t index, size_t count) {
-    assert(v != NULL && v->type == LEPT_ARRAY && index + count <= v->u.a.size);
-    /* \todo */
+const lept_snapshot_value* lept_snapshot_root(const lept_snapshot* s) {
+    assert(s != NULL);
+    return (const lept_snapshot_value*)(s->base + sizeof(lept_snapshot_header));
 }
 
-void lept_set_object(lept_value* v, size_t capacity) {
+lept_type lept_snapshot_get_type(const lept_snapshot_value* v) {
     assert(v != NULL);
-    lept_free(v);
-    v->type = LEPT_OBJECT;
-    v->u.o.size = 0;
-    v->u.o.capacity = capacity;
-    v->u.o.m = capacity > 0 ? (lept_member*)malloc(capacity * sizeof(lept_member)) : NULL;
+    return LEPT_SNAPSHOT_TYPE(v);
 }
 
-size_t lept_get_object_size(const lept_value* v) {
-    assert(v != NULL && v->type == LEPT_OBJECT);
-    return v->u.o.size;
+int lept_snapshot_get_boolean(const lept_snapshot_value* v) {
+    assert(v != NULL && (LEPT_SNAPSHOT_TYPE(v) == LEPT_TRUE || LEPT_SNAPSHOT_TYPE(v) == LEPT_FALSE));
+    return LEPT_SNAPSHOT_TYPE(v) == LEPT_TRUE;
 }
 
-size_t lept_get_object_capacity(const lept_value* v) {
-    assert(v != NULL && v->type == LEPT_OBJECT);
-    /* \todo */
-    return 0;
+double lept_snapshot_get_number(const lept_snapshot_value* v) {
+    double n;
+    assert(v != NULL && LEPT_SNAPSHOT_TYPE(v) == LEPT_NUMBER);
+    memcpy(&n, &v->u, sizeof(n));
+    return n;
 }
 
-void lept_reserve_object(lept_value* v, size_t capacity) {
-    assert(v != NULL && v->type == LEPT_OBJECT);
-    /* \todo */
+const char* lept_snapshot_get_string(const lept_snapshot_value* v) {
+    assert(v != NULL && LEPT_SNAPSHOT_TYPE(v) == LEPT_STRING);
+    return LEPT_SNAPSHOT_AT(v);
 }
 
-void lept_shrink_object(lept_value* v) {
-    assert(v != NULL && v->type == LEPT_OBJECT);
-    /* \todo */
+size_t lept_snapshot_get_string_length(const lept_snapshot_value* v) {
+    assert(v != NULL && LEPT_SNAPSHOT_TYPE(v) == LEPT_STRING);
+    return LEPT_SNAPSHOT_COUNT(v);
 }
 
-void lept_clear_object(lept_value* v) {
-    assert(v != NULL && v->type == LEPT_OBJECT);
-    /* \todo */
+size_t lept_snapshot_get_array_size(const lept_snapshot_value* v) {
+    assert(v != NULL && LEPT_SNAPSHOT_TYPE(v) == LEPT_ARRAY);
+    return LEPT_SNAPSHOT_COUNT(v);
 }
 
-const char* lept_get_object_key(const lept_value* v, size_t index) {
-    assert(v != NULL && v->type == LEPT_OBJECT);
-    assert(index < v->u.o.size);
-    return v->u.o.m[index].k;
+const lept_snapshot_value* lept_snapshot_get_array_element(const lept_snapshot_value* v, size_t index) {
+    assert(v != NULL && LEPT_SNAPSHOT_TYPE(v) == LEPT_ARRAY);
+    assert(index < LEPT_SNAPSHOT_COUNT(v));
+    return (const lept_snapshot_value*)LEPT_SNAPSHOT_AT(v) + index;
 }
 
-size_t lept_get_object_key_length(const lept_value* v, size_t index) {
-    assert(v != NULL && v->type == LEPT_OBJECT);
-    assert(index < v->u.o.size);
-    return v->u.o.m[index].klen;
+size_t lept_snapshot_get_object_size(const lept_snapshot_value* v) {
+    assert(v != NULL && LEPT_SNAPSHOT_TYPE(v) == LEPT_OBJECT);
+    return LEPT_SNAPSHOT_COUNT(v);
 }
 
-lept_value* lept_get_object_value(lept_value* v, size_t index) {
-    assert(v != NULL && v->type == LEPT_OBJECT);
-    assert(index < v->u.o.size);
-    return &v->u.o.m[index].v;
+const char* lept_snapshot_get_object_key(const lept_snapshot_value* v, size_t index) {
+    assert(v != NULL && LEPT_SNAPSHOT_TYPE(v) == LEPT_OBJECT);
+    assert(index < LEPT_SNAPSHOT_COUNT(v));
+    return lept_snapshot_get_string((const lept_snapshot_value*)LEPT_SNAPSHOT_AT(v) + index * 2);
 }
 
-size_t lept_find_object_index(const lept_value* v, const char* key, size_t klen) {
+size_t lept_snapshot_get_object_key_length(const lept_snapshot_value* v, size_t index) {
+    assert(v != NULL && LEPT_SNAPSHOT_TYPE(v) == LEPT_OBJECT);
+    assert(index < LEPT_SNAPSHOT_COUNT(v));
+    return LEPT_SNAPSHOT_COUNT((const lept_snapshot_value*)LEPT_SNAPSHOT_AT(v) + index * 2);
+}
+
+const lept_snapshot_value* lept_snapshot_get_object_value(const lept_snapshot_value* v, size_t index) {
+    assert(v != NULL && LEPT_SNAPSHOT_TYPE(v) == LEPT_OBJECT);
+    assert(index < LEPT_SNAPSHOT_COUNT(v));
+    return (const lept_snapshot_value*)LEPT_SNAPSHOT_AT(v) + index * 2 + 1;
+}
+
+size_t lept_snapshot_find_object_index(const lept_snapshot_value* v, const char* key, size_t klen) {
+    const lept_snapshot_value* k;
     size_t i;
-    assert(v != NULL && v->type == LEPT_OBJECT && key != NULL);
-    for (i = 0; i < v->u.o.size; i++)
-        if (v->u.o.m[i].klen == klen && memcmp(v->u.o.m[i].k, key, klen) == 0)
+    assert(v != NULL && LEPT_SNAPSHOT_TYPE(v) == LEPT_OBJECT && key != NULL);
+    for (i = 0, k = (const lept_snapshot_value*)LEPT_SNAPSHOT_AT(v); i < LEPT_SNAPSHOT_COUNT(v); i++, k += 2)
+        if (LEPT_SNAPSHOT_COUNT(k) == klen && memcmp(LEPT_SNAPSHOT_AT(k), key, klen) == 0)
             return i;
     return LEPT_KEY_NOT_EXIST;
 }
 
-lept_value* lept_find_object_value(lept_value* v, const char* key, size_t klen) {
-    size_t index = lept_find_object_index(v, key, klen);
-    return index != LEPT_KEY_NOT_EXIST ? &v->u.o.m[index].v : NULL;
+const lept_snapshot_value* lept_snapshot_find_object_value(const lept_snapshot_value* v, const char* key, size_t klen) {
+    size_t index = lept_snapshot_find_object_index(v, key, klen);
+    return index != LEPT_KEY_NOT_EXIST ? lept_snapshot_get_object_value(v, index) : NULL;
 }
 
-lept_value* lept_set_object_value(lept_value* v, const char* key, size_t klen) {
-    assert(v != NULL && v->type == LEPT_OBJECT && key != NULL);
-    /* \todo */
+/* Parse cache */
+
+#ifdef _WINDOWS
+typedef CRITICAL_SECTION lept_mutex;
+#define LEPT_MUTEX_INIT(m)      InitializeCriticalSection(m)
+#define LEPT_MUTEX_DESTROY(m)   DeleteCriticalSection(m)
+#define LEPT_MUTEX_LOCK(m)      EnterCriticalSection(m)
+#define LEPT_MUTEX_UNLOCK(m)    LeaveCriticalSection(m)
+#else
+typedef pthread_mutex_t lept_mutex;
+#define LEPT_MUTEX_INIT(m)      pthread_mutex_init(m, NULL)
+#define LEPT_MUTEX_DESTROY(m)   pthread_mutex_destroy(m)
+#define LEPT_MUTEX_LOCK(m)      pthread_mutex_lock(m)
+#define LEPT_MUTEX_UNLOCK(m)    pthread_mutex_unlock(m)
+#endif
+
+typedef struct lept_cache_entry {
+    lept_value v;                       /* first, so a document handed out leads back to its entry */
+    struct lept_cache_entry* chain;     /* next entry in the hash bucket */
+    struct lept_cache_entry* newer, *older;
+    uint64_t hash;
+    size_t refs;                        /* documents handed out and not released */
+    size_t len;                         /* input length, the input follows this struct */
+    int cached;                         /* still reachable from the table */
+}lept_cache_entry;
+
+struct lept_cache {
+    lept_mutex lock;
+    lept_cache_entry** buckets;
+    size_t mask;                        /* bucket count - 1 */
+    lept_cache_entry* newest, *oldest;
+    size_t max_bytes;
+    lept_cache_stats stats;
+};
+
+#define LEPT_CACHE_JSON(e) ((const char*)((e) + 1))
+
+lept_cache* lept_cache_create(size_t max_bytes) {
+    lept_cache* cache = (lept_cache*)LEPT_MALLOC(sizeof(lept_cache));
+    LEPT_MUTEX_INIT(&cache->lock);
+    cache->mask = 15;
+    cache->buckets = (lept_cache_entry**)lept_calloc(cache->mask + 1, sizeof(lept_cache_entry*));
+    cache->newest = cache->oldest = NULL;
+    cache->max_bytes = max_bytes;
+    memset(&cache->stats, 0, sizeof(lept_cache_stats));
+    return cache;
+}
+
+static void lept_cache_free_entry(lept_cache_entry* e) {
+    lept_free(&e->v);
+    LEPT_FREE(e);
+}
+
+void lept_cache_destroy(lept_cache* cache) {
+    lept_cache_entry* e, *older;
+    if (cache == NULL)
+        return;
+    for (e = cache->newest; e != NULL; e = older) {
+        older = e->older;
+        assert(e->refs == 0);
+        lept_cache_free_entry(e);
+    }
+    LEPT_FREE(cache->buckets);
+    LEPT_MUTEX_DESTROY(&cache->lock);
+    LEPT_FREE(cache);
+}
+
+static void lept_cache_unlink(lept_cache* cache, lept_cache_entry* e) {
+    if (e->newer != NULL) e->newer->older = e->older; else cache->newest = e->older;
+    if (e->older != NULL) e->older->newer = e->newer; else cache->oldest = e->newer;
+}
+
+static void lept_cache_link(lept_cache* cache, lept_cache_entry* e) {
+    e->newer = NULL;
+    e->older = cache->newest;
+    if (cache->newest != NULL) cache->newest->newer = e; else cache->oldest = e;
+    cache->newest = e;
+}
+
+static void lept_cache_grow(lept_cache* cache) {
+    size_t i, mask = cache->mask * 2 + 1;
+    lept_cache_entry** buckets = (lept_cache_entry**)lept_calloc(mask + 1, sizeof(lept_cache_entry*));
+    for (i = 0; i <= cache->mask; i++) {
+        lept_cache_entry* e, *chain;
+        for (e = cache->buckets[i]; e != NULL; e = chain) {
+            chain = e->chain;
+            e->chain = buckets[e->hash & mask];
+            buckets[e->hash & mask] = e;
+        }
+    }
+    LEPT_FREE(cache->buckets);
+    cache->buckets = buckets;
+    cache->mask = mask;
+}
+
+/* Drops the oldest entries until the inputs fit, entries still in use are freed on their last release */
+static void lept_cache_evict(lept_cache* cache) {
+    while (cache->stats.bytes > cache->max_bytes) {
+        lept_cache_entry* e = cache->oldest, **p;
+        for (p = &cache->buckets[e->hash & cache->mask]; *p != e; p = &(*p)->chain);
+        *p = e->chain;
+        lept_cache_unlink(cache, e);
+        cache->stats.bytes -= e->len;
+        cache->stats.count--;
+        cache->stats.evictions++;
+        e->cached = 0;
+        if (e->refs == 0)
+            lept_cache_free_entry(e);
+    }
+}
+
+static lept_cache_entry* lept_cache_find(lept_cache* cache, uint64_t hash, const char* json, size_t len) {
+    lept_cache_entry* e;
+    for (e = cache->buckets[hash & cache->mask]; e != NULL; e = e->chain)
+        if (e->hash == hash && e->len == len && memcmp(LEPT_CACHE_JSON(e), json, len) == 0) {
+            e->refs++;
+            lept_cache_unlink(cache, e);
+            lept_cache_link(cache, e);
+            return e;
+        }
     return NULL;
 }
 
-void lept_remove_object_value(lept_value* v, size_t index) {
-    assert(v != NULL && v->type == LEPT_OBJECT && index < v->u.o.size);
-    /* \todo */
+const lept_value* lept_cache_parse(lept_cache* cache, const char* json, size_t len, int* error) {
+    uint64_t hash;
+    lept_cache_entry* e, *found;
+    char* copy;
+    int ret;
+    assert(cache != NULL && json != NULL);
+    hash = lept_hash_string(json, len, 0);
+    LEPT_MUTEX_LOCK(&cache->lock);
+    if ((e = lept_cache_find(cache, hash, json, len)) != NULL) {
+        cache->stats.hits++;
+        LEPT_MUTEX_UNLOCK(&cache->lock);
+        if (error != NULL)
+            *error = LEPT_PARSE_OK;
+        return &e->v;
+    }
+    cache->stats.misses++;
+    LEPT_MUTEX_UNLOCK(&cache->lock);
+
+    /* parse without holding the lock, the input is kept to compare against on later lookups */
+    e = (lept_cache_entry*)LEPT_MALLOC(sizeof(lept_cache_entry) + len + 1);
+    copy = (char*)(e + 1);
+    memcpy(copy, json, len);
+    copy[len] = '\0';
+    if ((ret = lept_parse_range(&e->v, copy, copy + len, NULL)) != LEPT_PARSE_OK) {
+        LEPT_FREE(e);
+        if (error != NULL)
+            *error = ret;
+        return NULL;
+    }
+    if (error != NULL)
+        *error = LEPT_PARSE_OK;
+    e->hash = hash;
+    e->refs = 1;
+    e->len = len;
+
+    LEPT_MUTEX_LOCK(&cache->lock);
+    if ((found = lept_cache_find(cache, hash, json, len)) != NULL) {
+        /* another thread parsed the same input meanwhile */
+        LEPT_MUTEX_UNLOCK(&cache->lock);
+        lept_cache_free_entry(e);
+        return &found->v;
+    }
+    if (len > cache->max_bytes)
+        e->cached = 0;
+    else {
+        e->cached = 1;
+        if (++cache->stats.count > cache->mask + 1)
+            lept_cache_grow(cache);
+        e->chain = cache->buckets[hash & cache->mask];
+        cache->buckets[hash & cache->mask] = e;
+        lept_cache_link(cache, e);
+        cache->stats.bytes += len;
+        lept_cache_evict(cache);
+    }
+    LEPT_MUTEX_UNLOCK(&cache->lock);
+    return &e->v;
+}
+
+void lept_cache_release(lept_cache* cache, const lept_value* v) {
+    lept_cache_entry* e = (lept_cache_entry*)v;
+    int unused;
+    assert(cache != NULL);
+    if (v == NULL)
+        return;
+    LEPT_MUTEX_LOCK(&cache->lock);
+    assert(e->refs > 0);
+    unused = --e->refs == 0 && !e->cached;
+    LEPT_MUTEX_UNLOCK(&cache->lock);
+    if (unused)
+        lept_cache_free_entry(e);
+}
+
+void lept_cache_get_stats(lept_cache* cache, lept_cache_stats* stats) {
+    assert(cache != NULL && stats != NULL);
+    LEPT_MUTEX_LOCK(&cache->lock);
+    *stats = cache->stats;
+    LEPT_MUTEX_UNLOCK(&cache->lock);
+}
+
+/* JSON Patch (RFC 6902) and JSON Merge Patch (RFC 7396) */
+
+enum { LEPT_OP_ADD, LEPT_OP_REMOVE, LEPT_OP_REPLACE, LEPT_OP_MOVE, LEPT_OP_COPY, LEPT_OP_TEST };
+
+typedef struct {
+    int op;                     /* LEPT_OP_* */
+    const lept_value* path;
+    const lept_value* from;     /* move, copy */
+    const lept_value* value;    /* add, replace, test */
+}lept_patch_op;
+
+/* One change made to the target, undone in reverse order if a later operation fails */
+typedef struct {
+    enum { LEPT_UNDO_INSERTED, LEPT_UNDO_ERASED, LEPT_UNDO_REPLACED } kind;
+    const char* path;           /* JSON Pointer of the location, valid in the document as it was right after the change */
+    size_t len;
+    size_t index;               /* array index or member index of the location */
+    lept_value old;             /* erased or replaced value */
+}lept_patch_undo;
+
+/* Where a JSON Pointer leads: the value there, if any, and the container holding it */
+typedef struct {
+    lept_value* parent;         /* NULL for the whole document */
+    lept_value* v;              /* NULL if there is no such member / element yet */
+    size_t index;               /* array index ("-" is the size), member index or LEPT_KEY_NOT_EXIST */
+    const char* key;            /* object parent: last reference token, unescaped */
+    size_t klen;
+    lept_value number;          /* read-only lookups: element of a packed array */
+}lept_location;
+
+static const lept_value* lept_patch_member(const lept_value* op, const char* key, size_t klen) {
+    size_t index = lept_find_object_index(op, key, klen);
+    return index != LEPT_KEY_NOT_EXIST ? &op->u.o.m[index].v : NULL;
+}
+
+/* "" or "/token/...": a token may contain "~0" and "~1" but no other '~' */
+static int lept_pointer_valid(const lept_value* pointer) {
+    const char* p = pointer->u.s.s, *end = p + LEPT_STRING_LEN(pointer);
+    if (p != end && *p != '/')
+        return 0;
+    for (; p != end; p++)
+        if (*p == '~' && (p + 1 == end || (p[1] != '0' && p[1] != '1')))
+            return 0;
+    return 1;
+}
+
+/* An array index token, without leading zeros; "-" is the end of the array when allowed */
+static int lept_pointer_index(const char* s, size_t len, size_t size, int dash, size_t* index) {
+    size_t i;
+    if (len == 1 && s[0] == '-' && dash) {
+        *index = size;
+        return 1;
+    }
+    if (len == 0 || (len > 1 && s[0] == '0'))
+        return 0;
+    for (i = 0, *index = 0; i < len; i++) {
+        if (!ISDIGIT(s[i]) || *index > size / 10)
+            return 0;
+        *index = *index * 10 + (size_t)(s[i] - '0');
+    }
+    return *index < size || (dash && *index == size);
+}
+
+/*
+ * Follows a JSON Pointer from root. Writing lookups go through the mutators, so that
+ * a path shared with a copy is copied, and may end at the end of an array or at a new member.
+ */
+static int lept_locate(lept_context* c, lept_value* root, const char* p, size_t len, int write, lept_location* l) {
+    const char* end = p + len;
+    l->parent = NULL;
+    l->v = root;
+    lept_init(&l->number);
+    while (p != end) {
+        lept_value* v = l->v;
+        if (v == NULL)
+            return LEPT_PATCH_PATH_NOT_FOUND;
+        /* unescape the next token */
+        c->top = 0;
+        PUTC(c, '\0');
+        for (p++; p != end && *p != '/'; p++)
+            PUTC(c, *p == '~' ? (*++p == '0' ? '~' : '/') : *p);
+        l->key = c->stack + 1;
+        l->klen = c->top - 1;
+        l->parent = v;
+        if (v->type == LEPT_OBJECT) {
+            l->index = lept_find_object_index(v, l->key, l->klen);
+            if (l->index == LEPT_KEY_NOT_EXIST)
+                l->v = NULL;
+            else {
+                if (write)
+                    lept_own_object(v);
+                l->v = &v->u.o.m[l->index].v;
+            }
+        }
+        else if (v->type == LEPT_ARRAY && lept_pointer_index(l->key, l->klen, LEPT_ARRAY_SIZE(v), p == end && write, &l->index)) {
+            if (l->index == LEPT_ARRAY_SIZE(v))
+                l->v = NULL;
+            else if (write)
+                l->v = lept_set_array_element(v, l->index);
+            else if (LEPT_IS_PACKED(v)) {
+                lept_set_number(&l->number, LEPT_ARRAY_DOUBLES(v)[l->index]);
+                l->v = &l->number;
+            }
+            else
+                l->v = &v->u.a.e[l->index];
+        }
+        else
+            return LEPT_PATCH_PATH_NOT_FOUND;
+    }
+    return LEPT_PATCH_OK;
+}
+
+static lept_patch_undo* lept_patch_record(lept_context* undo, int kind, const char* path, size_t len, size_t index) {
+    lept_patch_undo* u = (lept_patch_undo*)lept_context_push(undo, sizeof(lept_patch_undo));
+    u->kind = kind;
+    u->path = path;
+    u->len = len;
+    u->index = index;
+    lept_init(&u->old);
+    return u;
+}
+
+/* Puts *value (which is moved) at path, replacing an existing member or the whole document */
+/* Adds or, with replace, overwrites the value at path; adding to an array always inserts */
+static int lept_patch_add(lept_context* c, lept_context* undo, lept_value* root, const char* path, size_t len, lept_value* value, int replace) {
+    lept_location l;
+    int ret;
+    if ((ret = lept_locate(c, root, path, len, 1, &l)) != LEPT_PATCH_OK)
+        return ret;
+    if (replace && l.v == NULL)
+        return LEPT_PATCH_PATH_NOT_FOUND;
+    if (l.v != NULL && (replace || l.parent == NULL || l.parent->type == LEPT_OBJECT))
+        lept_move(&lept_patch_record(undo, LEPT_UNDO_REPLACED, path, len, l.index)->old, l.v);
+    else if (l.parent->type == LEPT_ARRAY) {
+        /* record the index, "-" would no longer lead to the new element */
+        lept_patch_record(undo, LEPT_UNDO_INSERTED, path, len, l.index);
+        l.v = lept_insert_array_element(l.parent, l.index);
+    }
+    else {
+        lept_patch_record(undo, LEPT_UNDO_INSERTED, path, len, LEPT_OBJECT_SIZE(l.parent));
+        l.v = lept_set_object_value(l.parent, l.key, l.klen);
+    }
+    lept_move(l.v, value);
+    return LEPT_PATCH_OK;
+}
+
+/* Takes the value at path out of the document into *value */
+static int lept_patch_remove(lept_context* c, lept_context* undo, lept_value* root, const char* path, size_t len, lept_value* value) {
+    lept_location l;
+    lept_patch_undo* u;
+    int ret;
+    if ((ret = lept_locate(c, root, path, len, 1, &l)) != LEPT_PATCH_OK)
+        return ret;
+    if (l.v == NULL || l.parent == NULL)
+        return LEPT_PATCH_PATH_NOT_FOUND;
+    u = lept_patch_record(undo, LEPT_UNDO_ERASED, path, len, l.index);
+    lept_move(&u->old, l.v);
+    if (value != NULL)
+        lept_copy(value, &u->old);
+    if (l.parent->type == LEPT_OBJECT)
+        lept_remove_object_value(l.parent, l.index);
+    else
+        lept_erase_array_element(l.parent, l.index, 1);
+    return LEPT_PATCH_OK;
+}
+
+static void lept_patch_undo_one(lept_context* c, lept_value* root, lept_patch_undo* u) {
+    lept_location l;
+    int ret = lept_locate(c, root, u->path, u->len, 1, &l);
+    assert(ret == LEPT_PATCH_OK);
+    (void)ret;
+    switch (u->kind) {
+        case LEPT_UNDO_INSERTED:
+            if (l.parent->type == LEPT_OBJECT)
+                lept_remove_object_value(l.parent, u->index);
+            else
+                lept_erase_array_element(l.parent, u->index, 1);
+            break;
+        case LEPT_UNDO_ERASED:
+            if (l.parent->type == LEPT_OBJECT) {
+                /* back to its old position among the members */
+                lept_member m;
+                lept_set_object_value(l.parent, l.key, l.klen);
+                m = l.parent->u.o.m[LEPT_OBJECT_SIZE(l.parent) - 1];
+                memmove(&l.parent->u.o.m[u->index + 1], &l.parent->u.o.m[u->index], (LEPT_OBJECT_SIZE(l.parent) - 1 - u->index) * sizeof(lept_member));
+                l.parent->u.o.m[u->index] = m;
+                lept_move(&l.parent->u.o.m[u->index].v, &u->old);
+            }
+            else
+                lept_move(lept_insert_array_element(l.parent, u->index), &u->old);
+            break;
+        default:
+            lept_move(l.v, &u->old);
+            break;
+    }
+}
+
+static int lept_patch_parse_op(const lept_value* op, lept_patch_op* p) {
+    static const char* names[] = { "add", "remove", "replace", "move", "copy", "test" };
+    const lept_value* name;
+    if (op->type != LEPT_OBJECT || (name = lept_patch_member(op, "op", 2)) == NULL || name->type != LEPT_STRING)
+        return LEPT_PATCH_INVALID_OPERATION;
+    for (p->op = 0; p->op < 6; p->op++)
+        if (strlen(names[p->op]) == LEPT_STRING_LEN(name) && memcmp(names[p->op], name->u.s.s, LEPT_STRING_LEN(name)) == 0)
+            break;
+    if (p->op == 6)
+        return LEPT_PATCH_INVALID_OPERATION;
+    p->path = lept_patch_member(op, "path", 4);
+    p->from = p->op == LEPT_OP_MOVE || p->op == LEPT_OP_COPY ? lept_patch_member(op, "from", 4) : NULL;
+    p->value = p->op == LEPT_OP_ADD || p->op == LEPT_OP_REPLACE || p->op == LEPT_OP_TEST ? lept_patch_member(op, "value", 5) : NULL;
+    if (p->path == NULL || p->path->type != LEPT_STRING ||
+        ((p->op == LEPT_OP_MOVE || p->op == LEPT_OP_COPY) && (p->from == NULL || p->from->type != LEPT_STRING)) ||
+        ((p->op == LEPT_OP_ADD || p->op == LEPT_OP_REPLACE || p->op == LEPT_OP_TEST) && p->value == NULL))
+        return LEPT_PATCH_INVALID_OPERATION;
+    if (!lept_pointer_valid(p->path) || (p->from != NULL && !lept_pointer_valid(p->from)))
+        return LEPT_PATCH_INVALID_POINTER;
+    if (p->op == LEPT_OP_MOVE) {
+        /* a value cannot be moved into itself */
+        size_t n = LEPT_STRING_LEN(p->from);
+        if (n < LEPT_STRING_LEN(p->path) && memcmp(p->from->u.s.s, p->path->u.s.s, n) == 0 && p->path->u.s.s[n] == '/')
+            return LEPT_PATCH_INVALID_OPERATION;
+    }
+    return LEPT_PATCH_OK;
+}
+
+static int lept_patch_apply_op(lept_context* c, lept_context* undo, lept_value* root, const lept_patch_op* p) {
+    const char* path = p->path->u.s.s;
+    size_t len = LEPT_STRING_LEN(p->path);
+    const char* from = p->from != NULL ? p->from->u.s.s : NULL;
+    size_t from_len = p->from != NULL ? LEPT_STRING_LEN(p->from) : 0;
+    lept_location l;
+    lept_value value;   /* shares what is added with its source until either is changed */
+    int ret;
+    lept_init(&value);
+    switch (p->op) {
+        case LEPT_OP_ADD:
+            lept_copy(&value, p->value);
+            ret = lept_patch_add(c, undo, root, path, len, &value, 0);
+            break;
+        case LEPT_OP_REMOVE:
+            ret = lept_patch_remove(c, undo, root, path, len, NULL);
+            break;
+        case LEPT_OP_REPLACE:
+            lept_copy(&value, p->value);
+            ret = lept_patch_add(c, undo, root, path, len, &value, 1);
+            break;
+        case LEPT_OP_MOVE:
+            if (from_len == len && memcmp(from, path, len) == 0) {
+                if ((ret = lept_locate(c, root, path, len, 0, &l)) == LEPT_PATCH_OK && l.v == NULL)
+                    ret = LEPT_PATCH_PATH_NOT_FOUND;
+            }
+            else if ((ret = lept_patch_remove(c, undo, root, from, from_len, &value)) == LEPT_PATCH_OK)
+                ret = lept_patch_add(c, undo, root, path, len, &value, 0);
+            break;
+        case LEPT_OP_COPY:
+            if ((ret = lept_locate(c, root, from, from_len, 0, &l)) == LEPT_PATCH_OK && l.v == NULL)
+                ret = LEPT_PATCH_PATH_NOT_FOUND;
+            if (ret == LEPT_PATCH_OK) {
+                lept_copy(&value, l.v);
+                ret = lept_patch_add(c, undo, root, path, len, &value, 0);
+            }
+            break;
+        default:
+            if ((ret = lept_locate(c, root, path, len, 0, &l)) == LEPT_PATCH_OK && l.v == NULL)
+                ret = LEPT_PATCH_PATH_NOT_FOUND;
+            if (ret == LEPT_PATCH_OK && !lept_is_equal(l.v, p->value))
+                ret = LEPT_PATCH_TEST_FAILED;
+            break;
+    }
+    lept_free(&value);
+    return ret;
+}
+
+int lept_patch_apply(lept_value* v, const lept_value* patch) {
+    lept_context c, undo, ops;
+    size_t i, n;
+    int ret = LEPT_PATCH_OK;
+    assert(v != NULL && patch != NULL);
+    if (patch->type != LEPT_ARRAY)
+        return LEPT_PATCH_INVALID_OPERATION;
+    if ((n = LEPT_ARRAY_SIZE(patch)) == 0 || LEPT_IS_PACKED(patch))
+        return n == 0 ? LEPT_PATCH_OK : LEPT_PATCH_INVALID_OPERATION;
+    /* check every operation before the document is touched */
+    ops.stack = NULL;
+    ops.size = ops.top = 0;
+    for (i = 0; i < n && ret == LEPT_PATCH_OK; i++)
+        ret = lept_patch_parse_op(&patch->u.a.e[i], (lept_patch_op*)lept_context_push(&ops, sizeof(lept_patch_op)));
+    c.stack = undo.stack = NULL;
+    c.size = c.top = undo.size = undo.top = 0;
+    for (i = 0; i < n && ret == LEPT_PATCH_OK; i++)
+        ret = lept_patch_apply_op(&c, &undo, v, (lept_patch_op*)ops.stack + i);
+    /* on failure every recorded change is undone, latest first */
+    while (undo.top > 0) {
+        lept_patch_undo* u = (lept_patch_undo*)lept_context_pop(&undo, sizeof(lept_patch_undo));
+        if (ret != LEPT_PATCH_OK)
+            lept_patch_undo_one(&c, v, u);
+        lept_free(&u->old);
+    }
+    LEPT_FREE(c.stack);
+    LEPT_FREE(undo.stack);
+    LEPT_FREE(ops.stack);
+    return ret;
+}
+
+typedef struct {
+    lept_value* target;
+    const lept_value* patch;
+    size_t index;
+}lept_merge_frame;
+
+void lept_merge_patch_apply(lept_value* v, const lept_value* patch) {
+    lept_context c;
+    lept_merge_frame* f;
+    assert(v != NULL && patch != NULL);
+    if (patch->type != LEPT_OBJECT) {
+        lept_copy(v, patch);
+        return;
+    }
+    c.stack = NULL;
+    c.size = c.top = 0;
+    f = (lept_merge_frame*)lept_context_push(&c, sizeof(lept_merge_frame));
+    f->target = v;
+    f->patch = patch;
+    f->index = 0;
+    while (c.top > 0) {
+        const lept_member* m;
+        lept_value* t;
+        size_t index;
+        f = (lept_merge_frame*)(c.stack + c.top - sizeof(lept_merge_frame));
+        if (f->index == 0 && f->target->type != LEPT_OBJECT)
+            lept_set_object(f->target, 0);
+        if (f->index == LEPT_OBJECT_SIZE(f->patch)) {
+            lept_context_pop(&c, sizeof(lept_merge_frame));
+            continue;
+        }
+        m = &f->patch->u.o.m[f->index++];
+        if (m->v.type == LEPT_NULL) {
+            if ((index = lept_find_object_index(f->target, m->k, m->klen)) != LEPT_KEY_NOT_EXIST)
+                lept_remove_object_value(f->target, index);
+        }
+        else if (m->v.type != LEPT_OBJECT)
+            lept_copy(lept_set_object_value(f->target, m->k, m->klen), &m->v);
+        else {
+            /* the parent's members stay where they are until this member is done */
+            t = lept_set_object_value(f->target, m->k, m->klen);
+            f = (lept_merge_frame*)lept_context_push(&c, sizeof(lept_merge_frame));
+            f->target = t;
+            f->patch = &m->v;
+            f->index = 0;
+        }
+    }
+    LEPT_FREE(c.stack);
+}
+
+/* Diff */
+
+typedef struct {
+    const lept_value* a, *b;
+    size_t parent;      /* length of the path of the containing value */
+    const char* key;    /* object member key, NULL for an array element */
+    size_t klen, index; /* LEPT_KEY_NOT_EXIST index: the root */
+}lept_diff_item;
+
+typedef struct {
+    lept_context items, path;
+    lept_hash_table hashes;
+    lept_value* patch;
+}lept_diff_context;
+
+/* Truncates the path to parent and appends one reference token, none for the root */
+static void lept_diff_path(lept_context* path, size_t parent, const char* key, size_t klen, size_t index) {
+    path->top = parent;
+    if (key == NULL && index == LEPT_KEY_NOT_EXIST)
+        return;
+    PUTC(path, '/');
+    if (key != NULL) {
+        size_t i;
+        for (i = 0; i < klen; i++)
+            if (key[i] == '~')
+                PUTS(path, "~0", 2);
+            else if (key[i] == '/')
+                PUTS(path, "~1", 2);
+            else
+                PUTC(path, key[i]);
+    }
+    else {
+        char buffer[24], *p = buffer + sizeof(buffer);
+        do
+            *--p = (char)('0' + index % 10);
+        while ((index /= 10) != 0);
+        PUTS(path, p, (size_t)(buffer + sizeof(buffer) - p));
+    }
+}
+
+static void lept_diff_op(lept_diff_context* d, const char* op, const lept_value* value) {
+    lept_value* o = lept_pushback_array_element(d->patch);
+    lept_set_object(o, value != NULL ? 3 : 2);
+    lept_set_string(lept_set_object_value(o, "op", 2), op, strlen(op));
+    lept_set_string(lept_set_object_value(o, "path", 4), d->path.top > 0 ? d->path.stack : "", d->path.top);
+    if (value != NULL)
+        lept_copy(lept_set_object_value(o, "value", 5), value);  /* shared with b */
+}
+
+/*
+ * Compares containers by their shared buffer or hashes in O(1), each buffer being hashed once.
+ * Without hash, containers that are not hashed yet are reported different, to be walked instead.
+ */
+static int lept_diff_same(lept_diff_context* d, const lept_value* a, const lept_value* b, int hash) {
+    if (a->type != b->type)
+        return 0;
+    if (a->type >= LEPT_STRING && lept_buffer(a) != NULL && lept_buffer(a) == lept_buffer(b))
+        return 1;
+    switch (a->type) {
+        case LEPT_NUMBER:
+            return a->u.n == b->u.n;
+        case LEPT_STRING:
+            return LEPT_STRING_LEN(a) == LEPT_STRING_LEN(b) && memcmp(a->u.s.s, b->u.s.s, LEPT_STRING_LEN(a)) == 0;
+        case LEPT_ARRAY:
+            if (LEPT_ARRAY_SIZE(a) != LEPT_ARRAY_SIZE(b))
+                return 0;
+            break;
+        case LEPT_OBJECT:
+            if (LEPT_OBJECT_SIZE(a) != LEPT_OBJECT_SIZE(b))
+                return 0;
+            break;
+        default:
+            return 1;
+    }
+    if (!hash && (lept_hash_table_find(&d->hashes, lept_buffer(a)) == NULL || lept_hash_table_find(&d->hashes, lept_buffer(b)) == NULL))
+        return 0;
+    /* equal hashes are confirmed, a collision must not drop a change from the patch */
+    return lept_hash_tree(a, 0, &d->hashes) == lept_hash_tree(b, 0, &d->hashes) && lept_is_equal(a, b);
+}
+
+/* Containers of the same type are queued to be compared member by member, anything else is replaced */
+static void lept_diff_child(lept_diff_context* d, const lept_value* a, const lept_value* b, const char* key, size_t klen, size_t index) {
+    size_t parent = d->path.top;
+    if (lept_diff_same(d, a, b, 0))
+        return;
+    if (a->type == b->type && (a->type == LEPT_ARRAY || a->type == LEPT_OBJECT)) {
+        lept_diff_item* item = (lept_diff_item*)lept_context_push(&d->items, sizeof(lept_diff_item));
+        item->a = a;
+        item->b = b;
+        item->parent = parent;
+        item->key = key;
+        item->klen = klen;
+        item->index = index;
+        return;
+    }
+    lept_diff_path(&d->path, parent, key, klen, index);
+    lept_diff_op(d, "replace", b);
+    d->path.top = parent;
+}
+
+static const lept_value* lept_diff_element(const lept_value* v, size_t index, lept_value* n) {
+    if (!LEPT_IS_PACKED(v))
+        return &v->u.a.e[index];
+    n->type = LEPT_NUMBER;
+    n->u.n = LEPT_ARRAY_DOUBLES(v)[index];
+    return n;
+}
+
+/*
+ * Elements equal at both ends are skipped, the rest are compared pairwise and the
+ * surplus is removed or added at the end of the changed range. This is linear and
+ * finds single insertions and deletions, but not moves.
+ */
+static void lept_diff_array(lept_diff_context* d, const lept_value* a, const lept_value* b) {
+    size_t na = LEPT_ARRAY_SIZE(a), nb = LEPT_ARRAY_SIZE(b), head = 0, tail = 0, i, n, parent = d->path.top;
+    lept_value x, y;
+    while (head < na && head < nb && lept_diff_same(d, lept_diff_element(a, head, &x), lept_diff_element(b, head, &y), 1))
+        head++;
+    while (tail < na - head && tail < nb - head &&
+        lept_diff_same(d, lept_diff_element(a, na - 1 - tail, &x), lept_diff_element(b, nb - 1 - tail, &y), 1))
+        tail++;
+    n = (na < nb ? na : nb) - tail;
+    for (i = head; i < n; i++)
+        lept_diff_child(d, lept_diff_element(a, i, &x), lept_diff_element(b, i, &y), NULL, 0, i);
+    for (i = na - tail; i-- > n; ) {
+        lept_diff_path(&d->path, parent, NULL, 0, i);
+        lept_diff_op(d, "remove", NULL);
+    }
+    for (i = n; i < nb - tail; i++) {
+        lept_diff_path(&d->path, parent, NULL, 0, i);
+        lept_diff_op(d, "add", lept_diff_element(b, i, &y));
+    }
+    d->path.top = parent;
+}
+
+static void lept_diff_object(lept_diff_context* d, const lept_value* a, const lept_value* b) {
+    size_t na = LEPT_OBJECT_SIZE(a), nb = LEPT_OBJECT_SIZE(b), i, parent = d->path.top;
+    size_t* map = (size_t*)LEPT_MALLOC((na + 1) * sizeof(size_t));
+    unsigned char* paired = (unsigned char*)lept_calloc(nb + 1, 1);
+    lept_pair_object_members(a, b, map);
+    for (i = 0; i < na; i++) {
+        const lept_member* m = &a->u.o.m[i];
+        if (map[i] == LEPT_KEY_NOT_EXIST) {
+            lept_diff_path(&d->path, parent, m->k, m->klen, 0);
+            lept_diff_op(d, "remove", NULL);
+            d->path.top = parent;
+        }
+        else {
+            paired[map[i]] = 1;
+            lept_diff_child(d, &m->v, &b->u.o.m[map[i]].v, m->k, m->klen, 0);
+        }
+    }
+    for (i = 0; i < nb; i++)
+        if (!paired[i]) {
+            const lept_member* m = &b->u.o.m[i];
+            lept_diff_path(&d->path, parent, m->k, m->klen, 0);
+            lept_diff_op(d, "add", &m->v);
+            d->path.top = parent;
+        }
+    LEPT_FREE(map);
+    LEPT_FREE(paired);
+}
+
+void lept_diff(const lept_value* a, const lept_value* b, lept_value* patch) {
+    lept_diff_context d;
+    assert(a != NULL && b != NULL && patch != NULL && patch != a && patch != b);
+    d.items.stack = d.path.stack = NULL;
+    d.items.size = d.items.top = d.path.size = d.path.top = 0;
+    d.hashes.e = NULL;
+    d.hashes.mask = d.hashes.count = 0;
+    d.patch = patch;
+    lept_set_array(patch, 0);
+    lept_diff_child(&d, a, b, NULL, 0, LEPT_KEY_NOT_EXIST);
+    while (d.items.top > 0) {
+        lept_diff_item item = *(lept_diff_item*)lept_context_pop(&d.items, sizeof(lept_diff_item));
+        lept_diff_path(&d.path, item.parent, item.key, item.klen, item.index);
+        if (item.a->type == LEPT_ARRAY)
+            lept_diff_array(&d, item.a, item.b);
+        else
+            lept_diff_object(&d, item.a, item.b);
+    }
+    LEPT_FREE(d.items.stack);
+    LEPT_FREE(d.path.stack);
+    LEPT_FREE(d.hashes.e);
 }
@@ -2,6 +2,7 @@
 #define LEPTJSON_H__
 
 #include <stddef.h> /* size_t */
+#include <stdint.h> /* int64_t, uint64_t */
 
 typedef enum { LEPT_NULL, LEPT_FALSE, LEPT_TRUE, LEPT_NUMBER, LEPT_STRING, LEPT_ARRAY, LEPT_OBJECT } lept_type;
 
@@ -10,6 +11,24 @@ typedef enum { LEPT_NULL, LEPT_FALSE, LEPT_TRUE, LEPT_NUMBER, LEPT_STRING, LEPT_
 typedef struct lept_value lept_value;
 typedef struct lept_member lept_member;
 
+#ifdef LEPT_COMPACT_VALUE
+/*
+ * 16-byte layout: the length / element count lives next to the pointer and the
+ * capacity of arrays and objects is stored in their heap buffer, which limits
+ * lengths and capacities to UINT_MAX.
+ */
+struct lept_value {
+    union {
+        struct { lept_member* m; }o;    /* object: members */
+        struct { lept_value*  e; }a;    /* array:  elements */
+        struct { char* s; }s;           /* string: null-terminated string */
+        double n;                       /* number */
+    }u;
+    unsigned size;                      /* string length, element count or member count */
+    unsigned char type;                 /* lept_type */
+    unsigned char flags;                /* internal representation flags */
+};
+#else
 struct lept_value {
     union {
         struct { lept_member* m; size_t size, capacity; }o; /* object: members, member count, capacity */
@@ -18,7 +37,9 @@ struct lept_value {
         double n;                                           /* number */
     }u;
     lept_type type;
+    unsigned char flags;                                    /* internal representation flags */
 };
+#endif
 
 struct lept_member {
     char* k; size_t klen;   /* member key string, key string length */
@@ -39,14 +60,152 @@ enum {
     LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET,
     LEPT_PARSE_MISS_KEY,
     LEPT_PARSE_MISS_COLON,
-    LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET
+    LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET,
+    LEPT_PARSE_DEPTH_EXCEEDED,
+    LEPT_PARSE_FILE_ERROR
 };
 
+#define LEPT_PARSE_PACK_NUMBERS 0x1  /* store arrays holding only numbers as a packed double[] */
+
+/*
+ * Filled in when leptjson.c is built with LEPT_PARSE_STATS, and only zeroed otherwise.
+ * The times also need LEPT_PARSE_STATS_TIMING, which reads the clock around every string and number.
+ */
+typedef struct {
+    size_t bytes;               /* input consumed, up to the error if parsing failed */
+    size_t values[LEPT_OBJECT + 1];     /* values parsed, by lept_type; keys are not values */
+    size_t max_depth;           /* deepest nesting of arrays and objects, the smallest max_depth that accepts the input */
+    size_t stack_reallocs;      /* allocations of the parse stack */
+    size_t stack_peak;          /* most bytes in use on the parse stack */
+    size_t allocs, alloc_bytes; /* allocations for the stack and the value tree, and their requested sizes */
+    double string_seconds;      /* decoding strings and keys */
+    double number_seconds;      /* converting numbers */
+    double structure_seconds;   /* everything else: whitespace, literals, brackets and building containers */
+}lept_parse_stats;
+
+typedef struct {
+    size_t max_depth;   /* maximum nesting of arrays and objects, 0 for unlimited */
+    unsigned flags;     /* LEPT_PARSE_* */
+    lept_parse_stats* stats;    /* receives the statistics of the parse, or NULL */
+}lept_parse_options;
+
+#define lept_init_parse_options(o) do { (o)->max_depth = 0; (o)->flags = 0; (o)->stats = NULL; } while(0)
+
 #define lept_init(v) do { (v)->type = LEPT_NULL; } while(0)
 
 int lept_parse(lept_value* v, const char* json);
+int lept_parse_ex(lept_value* v, const char* json, const lept_parse_options* options);
+/* maps or reads the file without an extra copy, LEPT_PARSE_FILE_ERROR if it cannot be read */
+int lept_parse_file(lept_value* v, const char* path, const lept_parse_options* options);
+/* parse a JSON array of numbers into out[0..cap), *n receives the element count which may exceed cap */
+int lept_parse_number_array(const char* json, size_t len, double* out, size_t cap, size_t* n);
+int lept_parse_int64_array(const char* json, size_t len, int64_t* out, size_t cap, size_t* n);
+/* the returned string is released with lept_free_buffer() */
 char* lept_stringify(const lept_value* v, size_t* length);
+/* releases a buffer returned by the library through its allocator, see LEPT_MALLOC */
+void lept_free_buffer(void* p);
+
+/* receives the output in pieces, a non-zero return value is reported by lept_stringify_to() */
+typedef int (*lept_write_fn)(void* sink, const char* data, size_t len);
+int lept_stringify_to(const lept_value* v, lept_write_fn write_fn, void* sink);
+int lept_stringify_fd(const lept_value* v, int fd);
+/*
+ * Exact length of the output. lept_stringify_into() writes at most capacity bytes, without a terminating '\0',
+ * straight into buffer and returns the full length; only documents nested more than 32 levels deep allocate.
+ */
+size_t lept_stringify_size(const lept_value* v);
+size_t lept_stringify_into(const lept_value* v, char* buffer, size_t capacity);
+
+typedef struct {
+    const char* base;
+    size_t len;
+}lept_iovec;
+
+/*
+ * Output as a list of pieces for writev(): long strings are referenced in place and must
+ * outlive the list, which is a single allocation to be released with lept_free_buffer().
+ */
+lept_iovec* lept_stringify_iov(const lept_value* v, size_t* count);
+
+/* binary encodings, written through the same writer as lept_stringify_to(), decoded with lept_parse() error codes */
+int lept_encode_cbor(const lept_value* v, lept_write_fn write_fn, void* sink);
+int lept_decode_cbor(lept_value* v, const void* data, size_t len);
+int lept_encode_msgpack(const lept_value* v, lept_write_fn write_fn, void* sink);
+int lept_decode_msgpack(lept_value* v, const void* data, size_t len);
 
+/*
+ * Binary image of a tree that links nodes by relative offsets, so a mapped file is used in place
+ * with the read-only lept_snapshot_get_*() accessors. Images are only readable on the same byte order.
+ */
+typedef struct lept_snapshot lept_snapshot;
+typedef struct lept_snapshot_value lept_snapshot_value;
+
+int lept_snapshot_write(const lept_value* v, int fd);
+/*
+ * NULL if the file cannot be read, fails the version / size / checksum checks or has a node whose string or
+ * children lie outside it; the checksum is lept_hash() of the bytes after the 32-byte header as a string value
+ */
+lept_snapshot* lept_snapshot_map(const char* path);
+void lept_snapshot_unmap(lept_snapshot* s);
+const lept_snapshot_value* lept_snapshot_root(const lept_snapshot* s);
+
+lept_type lept_snapshot_get_type(const lept_snapshot_value* v);
+int lept_snapshot_get_boolean(const lept_snapshot_value* v);
+double lept_snapshot_get_number(const lept_snapshot_value* v);
+const char* lept_snapshot_get_string(const lept_snapshot_value* v);
+size_t lept_snapshot_get_string_length(const lept_snapshot_value* v);
+size_t lept_snapshot_get_array_size(const lept_snapshot_value* v);
+const lept_snapshot_value* lept_snapshot_get_array_element(const lept_snapshot_value* v, size_t index);
+size_t lept_snapshot_get_object_size(const lept_snapshot_value* v);
+const char* lept_snapshot_get_object_key(const lept_snapshot_value* v, size_t index);
+size_t lept_snapshot_get_object_key_length(const lept_snapshot_value* v, size_t index);
+const lept_snapshot_value* lept_snapshot_get_object_value(const lept_snapshot_value* v, size_t index);
+size_t lept_snapshot_find_object_index(const lept_snapshot_value* v, const char* key, size_t klen);
+const lept_snapshot_value* lept_snapshot_find_object_value(const lept_snapshot_value* v, const char* key, size_t klen);
+
+/*
+ * Thread-safe cache of parsed documents keyed by their input bytes, evicting the least recently
+ * used entries once the cached inputs exceed max_bytes. Documents are shared and read-only:
+ * any number of threads may read one through the const getters, lept_stringify*(), lept_hash()
+ * and lept_is_equal(). lept_copy() and lept_diff() share its buffers and need LEPT_ATOMIC_REFCOUNT.
+ */
+typedef struct lept_cache lept_cache;
+
+typedef struct {
+    size_t hits, misses, evictions;
+    size_t count, bytes;    /* documents and input bytes currently cached */
+}lept_cache_stats;
+
+lept_cache* lept_cache_create(size_t max_bytes);
+/* every document must have been released */
+void lept_cache_destroy(lept_cache* cache);
+/* NULL with *error set if json does not parse, otherwise a document to hand back to lept_cache_release() */
+const lept_value* lept_cache_parse(lept_cache* cache, const char* json, size_t len, int* error);
+void lept_cache_release(lept_cache* cache, const lept_value* v);
+void lept_cache_get_stats(lept_cache* cache, lept_cache_stats* stats);
+
+enum {
+    LEPT_PATCH_OK = 0,
+    LEPT_PATCH_INVALID_OPERATION,
+    LEPT_PATCH_INVALID_POINTER,
+    LEPT_PATCH_PATH_NOT_FOUND,
+    LEPT_PATCH_TEST_FAILED
+};
+
+/* JSON Patch (RFC 6902) applied in place, v is left unchanged unless every operation succeeds */
+int lept_patch_apply(lept_value* v, const lept_value* patch);
+/* JSON Merge Patch (RFC 7396) */
+void lept_merge_patch_apply(lept_value* v, const lept_value* patch);
+/*
+ * JSON Patch turning a into b. Containers sharing a buffer are skipped in O(1), array elements are
+ * aligned by lept_hash() values, object members are paired by key and added values share b's buffers.
+ */
+void lept_diff(const lept_value* a, const lept_value* b, lept_value* patch);
+
+/*
+ * Shares strings, arrays and objects with src in O(1); each side copies what it modifies, one level at a time.
+ * Copies handed to other threads need LEPT_ATOMIC_REFCOUNT.
+ */
 void lept_copy(lept_value* dst, const lept_value* src);
 void lept_move(lept_value* dst, lept_value* src);
 void lept_swap(lept_value* lhs, lept_value* rhs);
@@ -55,6 +214,33 @@ void lept_free(lept_value* v);
 
 lept_type lept_get_type(const lept_value* v);
 int lept_is_equal(const lept_value* lhs, const lept_value* rhs);
+/* equal values hash equally; the values may change between releases and are not meant to be stored */
+uint64_t lept_hash(const lept_value* v, uint64_t seed);
+
+/*
+ * Heap bytes held by a tree, not counting the root lept_value itself. A buffer reached twice is counted once.
+ * overhead covers reference count / capacity headers and an estimate of the allocator's own cost per block.
+ */
+typedef struct {
+    size_t nodes;       /* elements and members in use, doubles of packed arrays */
+    size_t slack;       /* unused array and object capacity */
+    size_t strings;     /* string bytes including terminators */
+    size_t keys;        /* key bytes including terminators */
+    size_t overhead;
+    size_t total;       /* sum of the above */
+    size_t shared;      /* part of total in buffers with more than one reference, which freeing the tree may not release */
+    size_t blocks;      /* heap allocations */
+}lept_memory_stats;
+
+void lept_memory_usage(const lept_value* v, lept_memory_stats* stats);
+/* Trims every array and object in the tree to its size and returns the bytes of capacity released; buffers shared with copies are left as they are */
+size_t lept_shrink_to_fit_recursive(lept_value* v);
+/*
+ * Deep copy of src into a single allocation: arrays and objects in preorder, so that a container is followed
+ * by its first child, then the strings, then the keys. Buffers shared within src stay shared. The block is
+ * never written; mutators copy out what they change one level at a time, as for copies. dst may be src.
+ */
+void lept_compact(lept_value* dst, const lept_value* src);
 
 #define lept_set_null(v) lept_free(v)
 
@@ -74,7 +260,11 @@ size_t lept_get_array_capacity(const lept_value* v);
 void lept_reserve_array(lept_value* v, size_t capacity);
 void lept_shrink_array(lept_value* v);
 void lept_clear_array(lept_value* v);
-lept_value* lept_get_array_element(lept_value* v, size_t index);
+/* reads in place, a packed array is read with lept_get_array_doubles() */
+const lept_value* lept_get_array_element(const lept_value* v, size_t index);
+/* the element to modify, after copying the array if it is shared or packed */
+lept_value* lept_set_array_element(lept_value* v, size_t index);
+const double* lept_get_array_doubles(const lept_value* v, size_t* size);
 lept_value* lept_pushback_array_element(lept_value* v);
 void lept_popback_array_element(lept_value* v);
 lept_value* lept_insert_array_element(lept_value* v, size_t index);
@@ -88,9 +278,10 @@ void lept_shrink_object(lept_value* v);
 void lept_clear_object(lept_value* v);
 const char* lept_get_object_key(const lept_value* v, size_t index);
 size_t lept_get_object_key_length(const lept_value* v, size_t index);
-lept_value* lept_get_object_value(lept_value* v, size_t index);
+const lept_value* lept_get_object_value(const lept_value* v, size_t index);
 size_t lept_find_object_index(const lept_value* v, const char* key, size_t klen);
-lept_value* lept_find_object_value(lept_value* v, const char* key, size_t klen);
+const lept_value* lept_find_object_value(const lept_value* v, const char* key, size_t klen);
+/* the value to modify, an existing one or a new null member, after copying the object if it is shared */
 lept_value* lept_set_object_value(lept_value* v, const char* key, size_t klen);
 void lept_remove_object_value(lept_value* v, size_t index);
 
@@ -1,6 +1,8 @@
 #ifdef _WINDOWS
 #define _CRTDBG_MAP_ALLOC
 #include <crtdbg.h>
+#else
+#define _POSIX_C_SOURCE 200112L /* fileno() */
 #endif
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,6 +13,39 @@ static int main_ret = 0;
 static int test_count = 0;
 static int test_pass = 0;
 
+/* test.c is compiled together with its own copy of leptjson.c which allocates through these */
+static size_t test_allocs = 0;
+static size_t test_frees = 0;
+static int test_alloc_fails = 0;
+
+/* blocks start TEST_ALLOC_HEADER bytes into the malloc() block, so releasing one with free() fails */
+#define TEST_ALLOC_HEADER 16
+
+void* lept_test_malloc(size_t size) {
+    char* p;
+    test_allocs++;
+    if (test_alloc_fails || (p = (char*)malloc(size + TEST_ALLOC_HEADER)) == NULL)
+        return NULL;
+    return p + TEST_ALLOC_HEADER;
+}
+
+void* lept_test_realloc(void* p, size_t size) {
+    char* q;
+    if (p == NULL)
+        return lept_test_malloc(size);
+    test_allocs++;
+    if (test_alloc_fails || (q = (char*)realloc((char*)p - TEST_ALLOC_HEADER, size + TEST_ALLOC_HEADER)) == NULL)
+        return NULL;
+    return q + TEST_ALLOC_HEADER;
+}
+
+void lept_test_free(void* p) {
+    if (p != NULL) {
+        test_frees++;
+        free((char*)p - TEST_ALLOC_HEADER);
+    }
+}
+
 #define EXPECT_EQ_BASE(equality, expect, actual, format) \
     do {\
         test_count++;\
@@ -155,11 +190,11 @@ static void test_parse_array() {
     EXPECT_EQ_INT(LEPT_ARRAY, lept_get_type(&v));
     EXPECT_EQ_SIZE_T(4, lept_get_array_size(&v));
     for (i = 0; i < 4; i++) {
-        lept_value* a = lept_get_array_element(&v, i);
+        const lept_value* a = lept_get_array_element(&v, i);
         EXPECT_EQ_INT(LEPT_ARRAY, lept_get_type(a));
         EXPECT_EQ_SIZE_T(i, lept_get_array_size(a));
         for (j = 0; j < i; j++) {
-            lept_value* e = lept_get_array_element(a, j);
+            const lept_value* e = lept_get_array_element(a, j);
             EXPECT_EQ_INT(LEPT_NUMBER, lept_get_type(e));
             EXPECT_EQ_DOUBLE((double)j, lept_get_number(e));
         }
@@ -207,16 +242,16 @@ static void test_parse_object() {
     EXPECT_EQ_INT(LEPT_ARRAY, lept_get_type(lept_get_object_value(&v, 5)));
     EXPECT_EQ_SIZE_T(3, lept_get_array_size(lept_get_object_value(&v, 5)));
     for (i = 0; i < 3; i++) {
-        lept_value* e = lept_get_array_element(lept_get_object_value(&v, 5), i);
+        const lept_value* e = lept_get_array_element(lept_get_object_value(&v, 5), i);
         EXPECT_EQ_INT(LEPT_NUMBER, lept_get_type(e));
         EXPECT_EQ_DOUBLE(i + 1.0, lept_get_number(e));
     }
     EXPECT_EQ_STRING("o", lept_get_object_key(&v, 6), lept_get_object_key_length(&v, 6));
     {
-        lept_value* o = lept_get_object_value(&v, 6);
+        const lept_value* o = lept_get_object_value(&v, 6);
         EXPECT_EQ_INT(LEPT_OBJECT, lept_get_type(o));
         for (i = 0; i < 3; i++) {
-            lept_value* ov = lept_get_object_value(o, i);
+            const lept_value* ov = lept_get_object_value(o, i);
             EXPECT_TRUE('1' + i == lept_get_object_key(o, i)[0]);
             EXPECT_EQ_SIZE_T(1, lept_get_object_key_length(o, i));
             EXPECT_EQ_INT(LEPT_NUMBER, lept_get_type(ov));
@@ -345,6 +380,279 @@ static void test_parse_miss_comma_or_curly_bracket() {
     TEST_PARSE_ERROR(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":{}");
 }
 
+#define TEST_PARSE_DEPTH(error, depth, json)\
+    do {\
+        lept_value v;\
+        lept_parse_options options;\
+        lept_init_parse_options(&options);\
+        options.max_depth = depth;\
+        lept_init(&v);\
+        v.type = LEPT_FALSE;\
+        EXPECT_EQ_INT(error, lept_parse_ex(&v, json, &options));\
+        if (error != LEPT_PARSE_OK)\
+            EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));\
+        lept_free(&v);\
+    } while(0)
+
+static void test_parse_depth() {
+    lept_value v;
+    char* json;
+    size_t i, n = 100000;
+
+    TEST_PARSE_DEPTH(LEPT_PARSE_OK, 1, "[]");
+    TEST_PARSE_DEPTH(LEPT_PARSE_OK, 2, "[1,{},[]]");
+    TEST_PARSE_DEPTH(LEPT_PARSE_DEPTH_EXCEEDED, 1, "[[]]");
+    TEST_PARSE_DEPTH(LEPT_PARSE_OK, 2, "[[1],[2]]");
+    TEST_PARSE_DEPTH(LEPT_PARSE_DEPTH_EXCEEDED, 2, "[[1],[2,[]]]");
+    TEST_PARSE_DEPTH(LEPT_PARSE_OK, 3, "{\"a\":{\"b\":[]}}");
+    TEST_PARSE_DEPTH(LEPT_PARSE_DEPTH_EXCEEDED, 2, "{\"a\":{\"b\":[]}}");
+    TEST_PARSE_DEPTH(LEPT_PARSE_OK, 0, "[[[[[[[[[[[[[[[[[[[[1]]]]]]]]]]]]]]]]]]]]");
+
+    /* deeply nested input must not overflow the call stack */
+    json = (char*)malloc(n * 2 + 1);
+    for (i = 0; i < n; i++) {
+        json[i] = '[';
+        json[n * 2 - 1 - i] = ']';
+    }
+    json[n * 2] = '\0';
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+    EXPECT_EQ_INT(LEPT_ARRAY, lept_get_type(&v));
+    lept_free(&v);
+    TEST_PARSE_DEPTH(LEPT_PARSE_DEPTH_EXCEEDED, 1000, json);
+    json[n] = '\0';
+    TEST_PARSE_ERROR(LEPT_PARSE_EXPECT_VALUE, json);
+    json[n] = '1';
+    json[n + 1] = '\0';
+    TEST_PARSE_ERROR(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, json);
+    free(json);
+}
+
+#define TEST_PARSE_PACKED(json)\
+    do {\
+        lept_value v1, v2;\
+        lept_parse_options options;\
+        char* json2;\
+        size_t length;\
+        lept_init_parse_options(&options);\
+        options.flags = LEPT_PARSE_PACK_NUMBERS;\
+        lept_init(&v1);\
+        lept_init(&v2);\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v1, json, &options));\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v2, json));\
+        EXPECT_TRUE(lept_is_equal(&v1, &v2));\
+        EXPECT_TRUE(lept_is_equal(&v2, &v1));\
+        EXPECT_TRUE(lept_hash(&v1, 0) == lept_hash(&v2, 0));\
+        json2 = lept_stringify(&v1, &length);\
+        EXPECT_EQ_STRING(json, json2, length);\
+        EXPECT_EQ_SIZE_T(length, lept_stringify_size(&v1));\
+        lept_free_buffer(json2);\
+        lept_copy(&v2, &v1);\
+        EXPECT_TRUE(lept_is_equal(&v1, &v2));\
+        lept_free(&v1);\
+        lept_free(&v2);\
+    } while(0)
+
+static void test_parse_packed() {
+    lept_value v;
+    lept_parse_options options;
+    const double* d;
+    size_t size;
+
+    TEST_PARSE_PACKED("[]");
+    TEST_PARSE_PACKED("[1,2,3]");
+    TEST_PARSE_PACKED("[1,\"a\",3]");
+    TEST_PARSE_PACKED("[[1.5,-2],[],[true,3],{\"a\":[0,1e+20]}]");
+    TEST_PARSE_PACKED("{\"x\":[1,2],\"y\":[[3],[4,null]]}");
+
+    lept_init_parse_options(&options);
+    options.flags = LEPT_PARSE_PACK_NUMBERS;
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, "[0.5,1,-2]", &options));
+    d = lept_get_array_doubles(&v, &size);
+    EXPECT_TRUE(d != NULL);
+    EXPECT_EQ_SIZE_T(3, size);
+    EXPECT_EQ_DOUBLE(0.5, d[0]);
+    EXPECT_EQ_DOUBLE(1.0, d[1]);
+    EXPECT_EQ_DOUBLE(-2.0, d[2]);
+
+    /* writing an element turns the array back into lept_value elements */
+    EXPECT_EQ_DOUBLE(1.0, lept_get_number(lept_set_array_element(&v, 1)));
+    EXPECT_TRUE(lept_get_array_doubles(&v, &size) == NULL);
+    EXPECT_EQ_SIZE_T(3, size);
+    lept_set_string(lept_pushback_array_element(&v), "a", 1);
+    EXPECT_EQ_SIZE_T(4, lept_get_array_size(&v));
+    EXPECT_EQ_DOUBLE(-2.0, lept_get_number(lept_get_array_element(&v, 2)));
+    lept_free(&v);
+
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "[1,2]"));
+    EXPECT_TRUE(lept_get_array_doubles(&v, NULL) == NULL);
+    lept_free(&v);
+}
+
+static void test_parse_stats() {
+    static const char json[] = " {\"a\":[1,2,\"xy\"],\"b\":{},\"c\":[3,[]]} ";
+    lept_value v;
+    lept_parse_options options;
+    lept_parse_stats stats;
+
+    lept_init_parse_options(&options);
+    options.stats = &stats;
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, json, &options));
+#ifdef LEPT_PARSE_STATS
+    EXPECT_EQ_SIZE_T(sizeof(json) - 1, stats.bytes);
+    EXPECT_EQ_SIZE_T(0, stats.values[LEPT_NULL]);
+    EXPECT_EQ_SIZE_T(3, stats.values[LEPT_NUMBER]);
+    EXPECT_EQ_SIZE_T(1, stats.values[LEPT_STRING]);
+    EXPECT_EQ_SIZE_T(3, stats.values[LEPT_ARRAY]);
+    EXPECT_EQ_SIZE_T(2, stats.values[LEPT_OBJECT]);
+    EXPECT_EQ_SIZE_T(3, stats.max_depth);
+    EXPECT_TRUE(stats.stack_reallocs >= 1);
+    EXPECT_TRUE(stats.stack_peak > 2 * sizeof(lept_member) + 3 * sizeof(lept_value));
+    /* the stack, three keys, "xy", two non-empty arrays and the root object */
+    EXPECT_EQ_SIZE_T(stats.stack_reallocs + 7, stats.allocs);
+    EXPECT_TRUE(stats.alloc_bytes > 256 + 3 * sizeof(lept_member) + 5 * sizeof(lept_value));
+    EXPECT_TRUE(stats.string_seconds >= 0.0 && stats.number_seconds >= 0.0);
+    lept_free(&v);
+
+    /* a deep stack and a failed parse */
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, lept_parse_ex(&v, "[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[1,2}", &options));
+    EXPECT_EQ_SIZE_T(33, stats.bytes);
+    EXPECT_EQ_SIZE_T(2, stats.values[LEPT_NUMBER]);
+    EXPECT_EQ_SIZE_T(0, stats.values[LEPT_ARRAY]);
+    EXPECT_EQ_SIZE_T(30, stats.max_depth);
+    EXPECT_TRUE(stats.stack_reallocs > 1);
+    EXPECT_TRUE(stats.stack_peak > 30 * sizeof(lept_value));
+
+    /* a packed array is a single allocation */
+    options.flags = LEPT_PARSE_PACK_NUMBERS;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, "[1,2,3]", &options));
+    EXPECT_EQ_SIZE_T(3, stats.values[LEPT_NUMBER]);
+    EXPECT_EQ_SIZE_T(1, stats.values[LEPT_ARRAY]);
+    EXPECT_EQ_SIZE_T(stats.stack_reallocs + 1, stats.allocs);
+#else
+    /* without LEPT_PARSE_STATS the statistics are only cleared */
+    EXPECT_EQ_SIZE_T(0, stats.bytes);
+    EXPECT_EQ_SIZE_T(0, stats.values[LEPT_OBJECT]);
+    EXPECT_EQ_SIZE_T(0, stats.allocs);
+#endif
+    lept_free(&v);
+}
+
+#define TEST_NUMBER_ARRAY(error, expect_n, json)\
+    do {\
+        double d[8];\
+        size_t n = 99;\
+        EXPECT_EQ_INT(error, lept_parse_number_array(json, sizeof(json) - 1, d, 8, &n));\
+        EXPECT_EQ_SIZE_T(expect_n, n);\
+    } while(0)
+
+static void test_parse_number_array() {
+    static const char json[] = " [ 0, -0.5 ,1e10,123456789012345678, 3.1415926535897932384626 ,1E-400, 12345678.87654321e-3]x";
+    double d[7], big[1];
+    int64_t i[4];
+    size_t n, k;
+    lept_value v;
+
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_number_array(json, sizeof(json) - 2, d, 7, &n));
+    EXPECT_EQ_SIZE_T(7, n);
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "[0,-0.5,1e10,123456789012345678,3.1415926535897932384626,1E-400,12345678.87654321e-3]"));
+    for (k = 0; k < n; k++)
+        EXPECT_EQ_DOUBLE(lept_get_number(lept_get_array_element(&v, k)), d[k]);
+    lept_free(&v);
+
+    /* the count is reported even when it exceeds the buffer */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_number_array("[1,2,3]", 7, big, 1, &n));
+    EXPECT_EQ_SIZE_T(3, n);
+    EXPECT_EQ_DOUBLE(1.0, big[0]);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_number_array("[1,2,3]", 7, NULL, 0, &n));
+    EXPECT_EQ_SIZE_T(3, n);
+
+    TEST_NUMBER_ARRAY(LEPT_PARSE_OK, 0, "[ ]");
+    TEST_NUMBER_ARRAY(LEPT_PARSE_EXPECT_VALUE, 0, " ");
+    TEST_NUMBER_ARRAY(LEPT_PARSE_EXPECT_VALUE, 0, "[1,");
+    TEST_NUMBER_ARRAY(LEPT_PARSE_INVALID_VALUE, 0, "1");
+    TEST_NUMBER_ARRAY(LEPT_PARSE_INVALID_VALUE, 0, "[1,]");
+    TEST_NUMBER_ARRAY(LEPT_PARSE_INVALID_VALUE, 0, "[null]");
+    TEST_NUMBER_ARRAY(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, 0, "[01]");
+    TEST_NUMBER_ARRAY(LEPT_PARSE_INVALID_VALUE, 0, "[1.]");
+    TEST_NUMBER_ARRAY(LEPT_PARSE_INVALID_VALUE, 0, "[1e]");
+    TEST_NUMBER_ARRAY(LEPT_PARSE_INVALID_VALUE, 0, "[.5]");
+    TEST_NUMBER_ARRAY(LEPT_PARSE_NUMBER_TOO_BIG, 0, "[1e309]");
+    TEST_NUMBER_ARRAY(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, 0, "[1 2]");
+    TEST_NUMBER_ARRAY(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, 0, "[1");
+    TEST_NUMBER_ARRAY(LEPT_PARSE_ROOT_NOT_SINGULAR, 0, "[1] 2");
+
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_int64_array("[0,-1,1234567890123,9223372036854775807]", 40, i, 4, &n));
+    EXPECT_EQ_SIZE_T(4, n);
+    EXPECT_TRUE(i[0] == 0 && i[1] == -1 && i[2] == INT64_C(1234567890123) && i[3] == INT64_MAX);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_int64_array("[-9223372036854775808]", 22, i, 4, &n));
+    EXPECT_TRUE(n == 1 && i[0] == INT64_MIN);
+    EXPECT_EQ_INT(LEPT_PARSE_NUMBER_TOO_BIG, lept_parse_int64_array("[9223372036854775808]", 21, i, 4, &n));
+    EXPECT_EQ_INT(LEPT_PARSE_NUMBER_TOO_BIG, lept_parse_int64_array("[100000000000000000000]", 23, i, 4, &n));
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_VALUE, lept_parse_int64_array("[1.5]", 5, i, 4, &n));
+}
+
+static void test_write_file(const char* path, const char* data, size_t len) {
+    FILE* f = fopen(path, "wb");
+    if (f != NULL) {
+        fwrite(data, 1, len, f);
+        fclose(f);
+    }
+}
+
+#define TEST_PARSE_FILE(error, json, len)\
+    do {\
+        lept_value v;\
+        test_write_file(path, json, len);\
+        lept_init(&v);\
+        EXPECT_EQ_INT(error, lept_parse_file(&v, path, NULL));\
+        lept_free(&v);\
+    } while(0)
+
+static void test_parse_file() {
+    const char* path = "leptjson_test.json";
+    lept_value v, expect;
+    size_t i, n = 65536;    /* whole pages, and one byte short of them */
+    char* json = (char*)malloc(n);
+
+    json[0] = '[';
+    for (i = 1; i < n - 2; i += 2) {
+        json[i] = (char)('0' + i % 10);
+        json[i + 1] = ',';
+    }
+    json[n - 3] = '1';
+    json[n - 2] = ']';
+    json[n - 1] = '\n';
+    for (i = n - 1; i <= n; i++) {
+        char* s = (char*)malloc(i + 1);
+        memcpy(s, json, i);
+        s[i] = '\0';
+        lept_init(&expect);
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&expect, s));
+        test_write_file(path, json, i);
+        lept_init(&v);
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_file(&v, path, NULL));
+        EXPECT_TRUE(lept_is_equal(&expect, &v));
+        lept_free(&v);
+        lept_free(&expect);
+        free(s);
+    }
+    free(json);
+
+    TEST_PARSE_FILE(LEPT_PARSE_OK, " {\"a\":[true]} ", 14);
+    TEST_PARSE_FILE(LEPT_PARSE_EXPECT_VALUE, "", 0);
+    TEST_PARSE_FILE(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[1", 2);
+    TEST_PARSE_FILE(LEPT_PARSE_ROOT_NOT_SINGULAR, "1\0 2", 4);
+    remove(path);
+
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_FILE_ERROR, lept_parse_file(&v, path, NULL));
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+}
+
 static void test_parse() {
     test_parse_null();
     test_parse_true();
@@ -367,6 +675,11 @@ static void test_parse() {
     test_parse_miss_key();
     test_parse_miss_colon();
     test_parse_miss_comma_or_curly_bracket();
+    test_parse_depth();
+    test_parse_packed();
+    test_parse_stats();
+    test_parse_number_array();
+    test_parse_file();
 }
 
 #define TEST_ROUNDTRIP(json)\
@@ -378,8 +691,9 @@ static void test_parse() {
         EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));\
         json2 = lept_stringify(&v, &length);\
         EXPECT_EQ_STRING(json, json2, length);\
+        EXPECT_EQ_SIZE_T(length, lept_stringify_size(&v));\
         lept_free(&v);\
-        free(json2);\
+        lept_free_buffer(json2);\
     } while(0)
 
 static void test_stringify_number() {
@@ -394,23 +708,98 @@ static void test_stringify_number() {
     TEST_ROUNDTRIP("1.234e+20");
     TEST_ROUNDTRIP("1.234e-20");
 
+    TEST_ROUNDTRIP("0.1");
+    TEST_ROUNDTRIP("0.0001");
+    TEST_ROUNDTRIP("1e-05");
+    TEST_ROUNDTRIP("12345678901234568");
+    TEST_ROUNDTRIP("1e+17");
+    TEST_ROUNDTRIP("1.5e+300");
+
     TEST_ROUNDTRIP("1.0000000000000002"); /* the smallest number > 1 */
-    TEST_ROUNDTRIP("4.9406564584124654e-324"); /* minimum denormal */
-    TEST_ROUNDTRIP("-4.9406564584124654e-324");
-    TEST_ROUNDTRIP("2.2250738585072009e-308");  /* Max subnormal double */
-    TEST_ROUNDTRIP("-2.2250738585072009e-308");
+    TEST_ROUNDTRIP("5e-324"); /* minimum denormal */
+    TEST_ROUNDTRIP("-5e-324");
+    TEST_ROUNDTRIP("2.225073858507201e-308");  /* Max subnormal double */
+    TEST_ROUNDTRIP("-2.225073858507201e-308");
     TEST_ROUNDTRIP("2.2250738585072014e-308");  /* Min normal positive double */
     TEST_ROUNDTRIP("-2.2250738585072014e-308");
     TEST_ROUNDTRIP("1.7976931348623157e+308");  /* Max double */
     TEST_ROUNDTRIP("-1.7976931348623157e+308");
 }
 
+static void test_stringify_number_random() {
+    unsigned long x = 2463534242UL;
+    uint64_t u;
+    double n, m;
+    int i, failures = 0;
+    lept_value v;
+    char* json;
+    size_t length;
+    lept_init(&v);
+    for (i = 0; i < 100000; i++) {
+        /* xorshift32, two draws per bit pattern */
+        x ^= (x << 13) & 0xFFFFFFFFUL; x ^= x >> 17; x ^= (x << 5) & 0xFFFFFFFFUL;
+        u = (uint64_t)x << 32;
+        x ^= (x << 13) & 0xFFFFFFFFUL; x ^= x >> 17; x ^= (x << 5) & 0xFFFFFFFFUL;
+        u |= x;
+        memcpy(&n, &u, sizeof(n));
+        if (n - n != 0)
+            continue;   /* inf and nan */
+        lept_set_number(&v, n);
+        json = lept_stringify(&v, &length);
+        if (lept_parse(&v, json) != LEPT_PARSE_OK || (m = lept_get_number(&v), memcmp(&n, &m, sizeof(n)) != 0))
+            failures++;
+        lept_free_buffer(json);
+    }
+    EXPECT_EQ_INT(0, failures);
+}
+
 static void test_stringify_string() {
     TEST_ROUNDTRIP("\"\"");
     TEST_ROUNDTRIP("\"Hello\"");
     TEST_ROUNDTRIP("\"Hello\\nWorld\"");
     TEST_ROUNDTRIP("\"\\\" \\\\ / \\b \\f \\n \\r \\t\"");
     TEST_ROUNDTRIP("\"Hello\\u0000World\"");
+    TEST_ROUNDTRIP("\"0123456789abcdef\\\"0123456789abcdef\\\\\"");
+    TEST_ROUNDTRIP("\"\xC3\xA9t\xC3\xA9 caf\xC3\xA9 na\xC3\xAFve\\u001F\"");
+}
+
+static void test_stringify_string_escape() {
+    static const char alphabet[] = "abcdefgh\"\\\x01\x1F \x7F\x80\xFF\n";
+    unsigned long x = 88675123UL;
+    char s[64], expect[64 * 6 + 2], *json, *p;
+    size_t i, j, len, length;
+    int failures = 0;
+    lept_value v;
+    lept_init(&v);
+    for (i = 0; i < 10000; i++) {
+        x ^= (x << 13) & 0xFFFFFFFFUL; x ^= x >> 17; x ^= (x << 5) & 0xFFFFFFFFUL;
+        len = x % sizeof(s);
+        for (j = 0; j < len; j++) {
+            x ^= (x << 13) & 0xFFFFFFFFUL; x ^= x >> 17; x ^= (x << 5) & 0xFFFFFFFFUL;
+            s[j] = (x % 16 < 12) ? 'a' : alphabet[x % (sizeof(alphabet) - 1)];
+        }
+        p = expect;
+        *p++ = '"';
+        for (j = 0; j < len; j++) {
+            unsigned char ch = (unsigned char)s[j];
+            if (ch == '"' || ch == '\\')
+                p += sprintf(p, "\\%c", ch);
+            else if (ch == '\n')
+                p += sprintf(p, "\\n");
+            else if (ch < 0x20)
+                p += sprintf(p, "\\u%04X", ch);
+            else
+                *p++ = (char)ch;
+        }
+        *p++ = '"';
+        lept_set_string(&v, s, len);
+        json = lept_stringify(&v, &length);
+        if (length != (size_t)(p - expect) || memcmp(json, expect, length) != 0 || lept_stringify_size(&v) != length)
+            failures++;
+        lept_free_buffer(json);
+    }
+    EXPECT_EQ_INT(0, failures);
+    lept_free(&v);
 }
 
 static void test_stringify_array() {
@@ -423,14 +812,171 @@ static void test_stringify_object() {
     TEST_ROUNDTRIP("{\"n\":null,\"f\":false,\"t\":true,\"i\":123,\"s\":\"abc\",\"a\":[1,2,3],\"o\":{\"1\":1,\"2\":2,\"3\":3}}");
 }
 
+typedef struct {
+    char* data;
+    size_t len, calls, max_write;
+    int result;
+}test_sink;
+
+static int test_write(void* sink, const char* data, size_t len) {
+    test_sink* t = (test_sink*)sink;
+    t->data = (char*)realloc(t->data, t->len + len);
+    memcpy(t->data + t->len, data, len);
+    t->len += len;
+    t->calls++;
+    if (len > t->max_write)
+        t->max_write = len;
+    return t->result;
+}
+
+static void test_stringify_to() {
+    lept_value v;
+    test_sink t;
+    char* json, *s;
+    size_t i, length, n = 20000;
+    FILE* f;
+
+    /* a long string and many small values, both larger than the flush size */
+    lept_init(&v);
+    lept_set_array(&v, 0);
+    s = (char*)malloc(n);
+    for (i = 0; i < n; i++)
+        s[i] = (char)(i % 64 == 0 ? '\n' : 'a' + i % 26);
+    lept_set_string(lept_pushback_array_element(&v), s, n);
+    for (i = 0; i < n; i++)
+        lept_set_number(lept_pushback_array_element(&v), (double)i);
+    free(s);
+
+    json = lept_stringify(&v, &length);
+    memset(&t, 0, sizeof(t));
+    EXPECT_EQ_INT(0, lept_stringify_to(&v, test_write, &t));
+    EXPECT_EQ_SIZE_T(length, t.len);
+    EXPECT_TRUE(memcmp(json, t.data, length) == 0);
+    EXPECT_TRUE(t.calls > 1);
+    EXPECT_TRUE(t.max_write < 8 * 4096);
+    free(t.data);
+
+    /* the first failure is reported and nothing more is written */
+    memset(&t, 0, sizeof(t));
+    t.result = -2;
+    EXPECT_EQ_INT(-2, lept_stringify_to(&v, test_write, &t));
+    EXPECT_EQ_SIZE_T(1, t.calls);
+    free(t.data);
+
+    if ((f = tmpfile()) != NULL) {
+        EXPECT_EQ_INT(0, lept_stringify_fd(&v, fileno(f)));
+        s = (char*)malloc(length + 1);
+        rewind(f);
+        EXPECT_EQ_SIZE_T(length, fread(s, 1, length + 1, f));
+        EXPECT_TRUE(memcmp(json, s, length) == 0);
+        free(s);
+        fclose(f);
+    }
+    lept_free_buffer(json);
+    lept_free(&v);
+}
+
+static void test_stringify_into() {
+    static const char json[] = "{\"a\":[1.5,\"\\n\\u0001\",null],\"b\":{}}";
+    static const char packed[] = "[[1e-07,2.5,-3],\"\\u0000x\",{\"k\\\"\":123456789012}]";
+    lept_value v;
+    lept_parse_options options;
+    char buffer[sizeof(packed) + 1];
+    size_t i;
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+    EXPECT_EQ_SIZE_T(sizeof(json) - 1, lept_stringify_size(&v));
+    memset(buffer, '#', sizeof(buffer));
+    EXPECT_EQ_SIZE_T(sizeof(json) - 1, lept_stringify_into(&v, buffer, sizeof(json) - 1));
+    EXPECT_TRUE(memcmp(json, buffer, sizeof(json) - 1) == 0);
+    EXPECT_EQ_INT('#', buffer[sizeof(json) - 1]);
+
+    /* too small: the required length is returned and only capacity bytes are written */
+    memset(buffer, '#', sizeof(buffer));
+    EXPECT_EQ_SIZE_T(sizeof(json) - 1, lept_stringify_into(&v, buffer, 4));
+    EXPECT_TRUE(memcmp(json, buffer, 4) == 0);
+    EXPECT_EQ_INT('#', buffer[4]);
+    EXPECT_EQ_SIZE_T(sizeof(json) - 1, lept_stringify_into(&v, NULL, 0));
+
+    /* the output goes straight into the buffer, nothing is allocated on the way */
+    test_allocs = 0;
+    test_alloc_fails = 1;
+    memset(buffer, '#', sizeof(buffer));
+    EXPECT_EQ_SIZE_T(sizeof(json) - 1, lept_stringify_into(&v, buffer, sizeof(buffer)));
+    EXPECT_TRUE(memcmp(json, buffer, sizeof(json) - 1) == 0);
+    EXPECT_EQ_SIZE_T(sizeof(json) - 1, lept_stringify_into(&v, buffer, 7));
+    EXPECT_EQ_SIZE_T(sizeof(json) - 1, lept_stringify_into(&v, buffer, 30));
+    EXPECT_TRUE(memcmp(json, buffer, sizeof(json) - 1) == 0);
+    test_alloc_fails = 0;
+    EXPECT_EQ_SIZE_T(0, test_allocs);
+    lept_free(&v);
+
+    /* cut at every length */
+    lept_init_parse_options(&options);
+    options.flags = LEPT_PARSE_PACK_NUMBERS;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, packed, &options));
+    for (i = 0; i < sizeof(packed); i++) {
+        memset(buffer, '#', sizeof(buffer));
+        EXPECT_EQ_SIZE_T(sizeof(packed) - 1, lept_stringify_into(&v, buffer, i));
+        EXPECT_TRUE(memcmp(packed, buffer, i) == 0 && buffer[i] == '#');
+    }
+    lept_free(&v);
+}
+
+static void test_stringify_iov() {
+    lept_value v;
+    lept_iovec* iov;
+    char* json, *s, *p;
+    const char* blob, *parsed;
+    size_t i, n, count, length, referenced = 0;
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "{\"blob\":null,\"n\":1.5,\"a\":"
+        "[\"short\",\"0123456789012345678901234567890123456789012345678901234567890123456789\",true]}"));
+    s = (char*)malloc(n = 1000);
+    for (i = 0; i < n; i++)
+        s[i] = (char)(i == 500 ? '"' : 'A' + i % 26);
+    lept_set_string(lept_set_object_value(&v, "blob", 4), s, n);
+    free(s);
+    blob = lept_get_string(lept_get_object_value(&v, 0));
+    parsed = lept_get_string(lept_get_array_element(lept_get_object_value(&v, 2), 1));
+
+    json = lept_stringify(&v, &length);
+    iov = lept_stringify_iov(&v, &count);
+    for (i = 0, n = 0; i < count; i++)
+        n += iov[i].len;
+    EXPECT_EQ_SIZE_T(length, n);
+    p = s = (char*)malloc(n);
+    for (i = 0; i < count; i++) {
+        memcpy(p, iov[i].base, iov[i].len);
+        p += iov[i].len;
+        if (iov[i].base == blob || iov[i].base == blob + 501 || iov[i].base == parsed)
+            referenced++;
+    }
+    EXPECT_TRUE(memcmp(json, s, length) == 0);
+    /* both halves of the blob around the escaped quote and the long parsed string are referenced in place */
+    EXPECT_EQ_SIZE_T(3, referenced);
+    free(s);
+    /* the list goes back to the library's allocator in one piece */
+    n = test_frees;
+    lept_free_buffer(iov);
+    EXPECT_EQ_SIZE_T(n + 1, test_frees);
+    lept_free_buffer(json);
+    lept_free(&v);
+}
+
 static void test_stringify() {
     TEST_ROUNDTRIP("null");
     TEST_ROUNDTRIP("false");
     TEST_ROUNDTRIP("true");
     test_stringify_number();
+    test_stringify_number_random();
     test_stringify_string();
+    test_stringify_string_escape();
     test_stringify_array();
     test_stringify_object();
+    test_stringify_to();
+    test_stringify_into();
+    test_stringify_iov();
 }
 
 #define TEST_EQUAL(json1, json2, equality) \
@@ -469,6 +1015,683 @@ static void test_equal() {
     TEST_EQUAL("{\"a\":1,\"b\":2}", "{\"a\":1,\"b\":2,\"c\":3}", 0);
     TEST_EQUAL("{\"a\":{\"b\":{\"c\":{}}}}", "{\"a\":{\"b\":{\"c\":{}}}}", 1);
     TEST_EQUAL("{\"a\":{\"b\":{\"c\":{}}}}", "{\"a\":{\"b\":{\"c\":[]}}}", 0);
+    TEST_EQUAL("{\"a\":1,\"a\":2}", "{\"a\":1,\"a\":2}", 1);
+    TEST_EQUAL("{\"a\":1,\"a\":1}", "{\"a\":1,\"a\":2}", 0);
+    TEST_EQUAL("{\"a\":1,\"b\":2,\"a\":3}", "{\"b\":2,\"a\":1,\"a\":3}", 1);
+}
+
+static void test_equal_large_object() {
+    char json1[1024], json2[1024], *p1, *p2;
+    int i, n = 64;
+    p1 = json1 + sprintf(json1, "{");
+    p2 = json2 + sprintf(json2, "{");
+    for (i = 0; i < n; i++) {
+        p1 += sprintf(p1, "%s\"k%d\":%d", i > 0 ? "," : "", i, i);
+        p2 += sprintf(p2, "%s\"k%d\":%d", i > 0 ? "," : "", n - 1 - i, n - 1 - i);
+    }
+    strcpy(p1, "}");
+    strcpy(p2, "}");
+    TEST_EQUAL(json1, json2, 1);
+    json2[strlen(json2) - 2] = '9'; /* "k0":0 -> "k0":9 */
+    TEST_EQUAL(json1, json2, 0);
+    json2[strlen(json2) - 2] = '0';
+    json2[strlen(json2) - 5] = 'x'; /* "k0":0 -> "kx":0 */
+    TEST_EQUAL(json1, json2, 0);
+}
+
+#define TEST_HASH(json1, json2, equality) \
+    do {\
+        lept_value v1, v2;\
+        lept_init(&v1);\
+        lept_init(&v2);\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v1, json1));\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v2, json2));\
+        EXPECT_EQ_INT(equality, lept_hash(&v1, 0) == lept_hash(&v2, 0));\
+        EXPECT_EQ_INT(equality, lept_hash(&v1, 12345) == lept_hash(&v2, 12345));\
+        lept_free(&v1);\
+        lept_free(&v2);\
+    } while(0)
+
+static void test_hash() {
+    lept_value v;
+    TEST_HASH("null", "null", 1);
+    TEST_HASH("null", "false", 0);
+    TEST_HASH("true", "false", 0);
+    TEST_HASH("0", "-0", 1);
+    TEST_HASH("1", "1.0", 1);
+    TEST_HASH("1", "2", 0);
+    TEST_HASH("\"abc\"", "\"abc\"", 1);
+    TEST_HASH("\"abc\"", "\"abd\"", 0);
+    TEST_HASH("\"abcdefghijklmnopqrstuvwxyz0123456789\"", "\"abcdefghijklmnopqrstuvwxyz0123456789\"", 1);
+    TEST_HASH("\"abcdefghijklmnopqrstuvwxyz0123456789\"", "\"abcdefghijklmnopqrstuvwxyz0123456788\"", 0);
+    TEST_HASH("[]", "{}", 0);
+    TEST_HASH("0", "{}", 0);
+    TEST_HASH("0", "[]", 0);
+    TEST_HASH("[1,2,3]", "[1,2,3]", 1);
+    TEST_HASH("[1,2,3]", "[3,2,1]", 0);
+    TEST_HASH("[[1],2]", "[1,[2]]", 0);
+    TEST_HASH("{\"a\":1,\"b\":[2,{\"c\":3}]}", "{\"b\":[2,{\"c\":3}],\"a\":1}", 1);
+    TEST_HASH("{\"a\":1,\"b\":2}", "{\"a\":2,\"b\":1}", 0);
+    TEST_HASH("{\"a\":1}", "{\"a\":1,\"a\":1}", 0);
+
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "{\"a\":[1,2,3]}"));
+    EXPECT_TRUE(lept_hash(&v, 0) != lept_hash(&v, 1));
+    lept_free(&v);
+}
+
+#define TEST_ENCODE(codec, json, bytes)\
+    do {\
+        lept_value v1, v2;\
+        test_sink t;\
+        lept_init(&v1);\
+        lept_init(&v2);\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v1, json));\
+        memset(&t, 0, sizeof(t));\
+        EXPECT_EQ_INT(0, lept_encode_##codec(&v1, test_write, &t));\
+        EXPECT_EQ_SIZE_T(sizeof(bytes) - 1, t.len);\
+        EXPECT_TRUE(t.len == sizeof(bytes) - 1 && memcmp(bytes, t.data, t.len) == 0);\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_decode_##codec(&v2, bytes, sizeof(bytes) - 1));\
+        EXPECT_TRUE(lept_is_equal(&v1, &v2));\
+        free(t.data);\
+        lept_free(&v1);\
+        lept_free(&v2);\
+    } while(0)
+
+#define TEST_DECODE_ERROR(codec, error, bytes)\
+    do {\
+        lept_value v;\
+        lept_init(&v);\
+        EXPECT_EQ_INT(error, lept_decode_##codec(&v, bytes, sizeof(bytes) - 1));\
+        EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));\
+    } while(0)
+
+#define TEST_CODEC_ROUNDTRIP(codec, v)\
+    do {\
+        lept_value v2;\
+        test_sink t;\
+        memset(&t, 0, sizeof(t));\
+        lept_init(&v2);\
+        EXPECT_EQ_INT(0, lept_encode_##codec(v, test_write, &t));\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_decode_##codec(&v2, t.data, t.len));\
+        EXPECT_TRUE(lept_is_equal(v, &v2));\
+        free(t.data);\
+        lept_free(&v2);\
+    } while(0)
+
+static void test_cbor() {
+    lept_value v;
+    lept_parse_options options;
+    size_t i;
+    char* s;
+
+    /* RFC 8949 appendix A, except that 1.5 is sent as a float32 rather than a float16 */
+    TEST_ENCODE(cbor, "0", "\x00");
+    TEST_ENCODE(cbor, "23", "\x17");
+    TEST_ENCODE(cbor, "24", "\x18\x18");
+    TEST_ENCODE(cbor, "1000", "\x19\x03\xe8");
+    TEST_ENCODE(cbor, "1000000", "\x1a\x00\x0f\x42\x40");
+    TEST_ENCODE(cbor, "1000000000000", "\x1b\x00\x00\x00\xe8\xd4\xa5\x10\x00");
+    TEST_ENCODE(cbor, "-1", "\x20");
+    TEST_ENCODE(cbor, "-1000", "\x39\x03\xe7");
+    TEST_ENCODE(cbor, "-0", "\xfa\x80\x00\x00\x00");
+    TEST_ENCODE(cbor, "1.5", "\xfa\x3f\xc0\x00\x00");
+    TEST_ENCODE(cbor, "1.1", "\xfb\x3f\xf1\x99\x99\x99\x99\x99\x9a");
+    TEST_ENCODE(cbor, "false", "\xf4");
+    TEST_ENCODE(cbor, "true", "\xf5");
+    TEST_ENCODE(cbor, "null", "\xf6");
+    TEST_ENCODE(cbor, "\"\"", "\x60");
+    TEST_ENCODE(cbor, "\"\\u00fc\"", "\x62\xc3\xbc");
+    TEST_ENCODE(cbor, "[]", "\x80");
+    TEST_ENCODE(cbor, "[1,[2,3],[4,5]]", "\x83\x01\x82\x02\x03\x82\x04\x05");
+    TEST_ENCODE(cbor, "{\"a\":1,\"b\":[2,3]}", "\xa2\x61\x61\x01\x61\x62\x82\x02\x03");
+
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_decode_cbor(&v, "\xf9\x3e\x00", 3));
+    EXPECT_EQ_DOUBLE(1.5, lept_get_number(&v));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_decode_cbor(&v, "\xf9\x00\x01", 3));
+    EXPECT_EQ_DOUBLE(5.960464477539063e-8, lept_get_number(&v));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_decode_cbor(&v, "\xc1\x1a\x51\x4b\x67\xb0", 6)); /* tagged epoch time */
+    EXPECT_EQ_DOUBLE(1363896240.0, lept_get_number(&v));
+
+    TEST_DECODE_ERROR(cbor, LEPT_PARSE_EXPECT_VALUE, "");
+    TEST_DECODE_ERROR(cbor, LEPT_PARSE_EXPECT_VALUE, "\x19\x03");
+    TEST_DECODE_ERROR(cbor, LEPT_PARSE_EXPECT_VALUE, "\x83\x01\x02");
+    TEST_DECODE_ERROR(cbor, LEPT_PARSE_EXPECT_VALUE, "\x9b\xff\xff\xff\xff\xff\xff\xff\xff\x01");
+    TEST_DECODE_ERROR(cbor, LEPT_PARSE_EXPECT_VALUE, "\x65\x61\x62");
+    TEST_DECODE_ERROR(cbor, LEPT_PARSE_INVALID_VALUE, "\x41\x61");      /* byte string */
+    TEST_DECODE_ERROR(cbor, LEPT_PARSE_INVALID_VALUE, "\x9f\x01\xff");  /* indefinite length */
+    TEST_DECODE_ERROR(cbor, LEPT_PARSE_INVALID_VALUE, "\xf7");          /* undefined */
+    TEST_DECODE_ERROR(cbor, LEPT_PARSE_MISS_KEY, "\xa1\x01\x02");
+    TEST_DECODE_ERROR(cbor, LEPT_PARSE_ROOT_NOT_SINGULAR, "\x01\x02");
+
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "{\"n\":[0,-1,255,-256,65536,-65537,4294967296,1e300,-1e-300,0.1],"
+        "\"s\":[\"\",\"a\",\"\\u0000\"],\"o\":{\"\":{},\"x\":[[],null,true,false]}}"));
+    TEST_CODEC_ROUNDTRIP(cbor, &v);
+    lept_free(&v);
+    lept_init_parse_options(&options);
+    options.flags = LEPT_PARSE_PACK_NUMBERS;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, "[[1.5,2,-3],{\"a\":[4,5]}]", &options));
+    TEST_CODEC_ROUNDTRIP(cbor, &v);
+
+    /* lengths beyond the one-byte forms */
+    lept_set_array(&v, 0);
+    s = (char*)malloc(70000);
+    memset(s, 'x', 70000);
+    lept_set_string(lept_pushback_array_element(&v), s, 300);
+    lept_set_string(lept_pushback_array_element(&v), s, 70000);
+    for (i = 0; i < 70000; i++)
+        lept_set_number(lept_pushback_array_element(&v), (double)i);
+    free(s);
+    TEST_CODEC_ROUNDTRIP(cbor, &v);
+    lept_free(&v);
+}
+
+static void test_msgpack() {
+    lept_value v;
+    lept_parse_options options;
+    size_t i;
+    char* s;
+
+    TEST_ENCODE(msgpack, "0", "\x00");
+    TEST_ENCODE(msgpack, "127", "\x7f");
+    TEST_ENCODE(msgpack, "128", "\xcc\x80");
+    TEST_ENCODE(msgpack, "256", "\xcd\x01\x00");
+    TEST_ENCODE(msgpack, "65536", "\xce\x00\x01\x00\x00");
+    TEST_ENCODE(msgpack, "4294967296", "\xcf\x00\x00\x00\x01\x00\x00\x00\x00");
+    TEST_ENCODE(msgpack, "-1", "\xff");
+    TEST_ENCODE(msgpack, "-32", "\xe0");
+    TEST_ENCODE(msgpack, "-33", "\xd0\xdf");
+    TEST_ENCODE(msgpack, "-129", "\xd1\xff\x7f");
+    TEST_ENCODE(msgpack, "-32769", "\xd2\xff\xff\x7f\xff");
+    TEST_ENCODE(msgpack, "-2147483649", "\xd3\xff\xff\xff\xff\x7f\xff\xff\xff");
+    TEST_ENCODE(msgpack, "1.5", "\xca\x3f\xc0\x00\x00");
+    TEST_ENCODE(msgpack, "1.1", "\xcb\x3f\xf1\x99\x99\x99\x99\x99\x9a");
+    TEST_ENCODE(msgpack, "null", "\xc0");
+    TEST_ENCODE(msgpack, "false", "\xc2");
+    TEST_ENCODE(msgpack, "true", "\xc3");
+    TEST_ENCODE(msgpack, "\"a\"", "\xa1\x61");
+    TEST_ENCODE(msgpack, "\"0123456789012345678901234567890123\"",
+        "\xd9\x22" "0123456789012345678901234567890123");
+    TEST_ENCODE(msgpack, "[]", "\x90");
+    TEST_ENCODE(msgpack, "[1,[2,3]]", "\x92\x01\x92\x02\x03");
+    TEST_ENCODE(msgpack, "[1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16]",
+        "\xdc\x00\x10\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f\x10");
+    TEST_ENCODE(msgpack, "{\"a\":1,\"b\":[2,3]}", "\x82\xa1\x61\x01\xa1\x62\x92\x02\x03");
+
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_decode_msgpack(&v, "\xd3\x80\x00\x00\x00\x00\x00\x00\x00", 9));
+    EXPECT_EQ_DOUBLE(-9223372036854775808.0, lept_get_number(&v));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_decode_msgpack(&v, "\xd0\x7f", 2));
+    EXPECT_EQ_DOUBLE(127.0, lept_get_number(&v));
+
+    TEST_DECODE_ERROR(msgpack, LEPT_PARSE_EXPECT_VALUE, "");
+    TEST_DECODE_ERROR(msgpack, LEPT_PARSE_EXPECT_VALUE, "\xcd\x01");
+    TEST_DECODE_ERROR(msgpack, LEPT_PARSE_EXPECT_VALUE, "\x93\x01\x02");
+    TEST_DECODE_ERROR(msgpack, LEPT_PARSE_EXPECT_VALUE, "\xdd\xff\xff\xff\xff\x01");
+    TEST_DECODE_ERROR(msgpack, LEPT_PARSE_EXPECT_VALUE, "\xa3\x61");
+    TEST_DECODE_ERROR(msgpack, LEPT_PARSE_INVALID_VALUE, "\xc4\x01\x61");  /* bin 8 */
+    TEST_DECODE_ERROR(msgpack, LEPT_PARSE_INVALID_VALUE, "\xc1");
+    TEST_DECODE_ERROR(msgpack, LEPT_PARSE_MISS_KEY, "\x81\x01\x02");
+    TEST_DECODE_ERROR(msgpack, LEPT_PARSE_ROOT_NOT_SINGULAR, "\xc0\xc0");
+
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "{\"n\":[0,-1,255,-256,65536,-65537,4294967296,1e300,-1e-300,0.1,-0],"
+        "\"s\":[\"\",\"a\",\"\\u0000\"],\"o\":{\"\":{},\"x\":[[],null,true,false]}}"));
+    TEST_CODEC_ROUNDTRIP(msgpack, &v);
+    lept_free(&v);
+    lept_init_parse_options(&options);
+    options.flags = LEPT_PARSE_PACK_NUMBERS;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, "[[1.5,2,-3],{\"a\":[4,5]}]", &options));
+    TEST_CODEC_ROUNDTRIP(msgpack, &v);
+
+    lept_set_array(&v, 0);
+    s = (char*)malloc(70000);
+    memset(s, 'x', 70000);
+    lept_set_string(lept_pushback_array_element(&v), s, 300);
+    lept_set_string(lept_pushback_array_element(&v), s, 70000);
+    for (i = 0; i < 70000; i++)
+        lept_set_number(lept_pushback_array_element(&v), -(double)i);
+    free(s);
+    TEST_CODEC_ROUNDTRIP(msgpack, &v);
+    lept_free(&v);
+}
+
+static size_t test_cache_walk(const lept_value* v) {
+    size_t i, n = 1;
+    if (lept_get_type(v) == LEPT_ARRAY)
+        for (i = 0; i < lept_get_array_size(v); i++)
+            n += test_cache_walk(lept_get_array_element(v, i));
+    else if (lept_get_type(v) == LEPT_OBJECT)
+        for (i = 0; i < lept_get_object_size(v); i++)
+            n += test_cache_walk(lept_get_object_value(v, i));
+    return n;
+}
+
+static void test_cache() {
+    static const char doc[] = "{\"a\":[1,\"x\",{\"k\":[true]}],\"o\":{},\"s\":\"str\"}";
+    lept_cache* cache = lept_cache_create(16);
+    lept_cache_stats stats;
+    lept_memory_stats before, after;
+    const lept_value* a, *b, *c, *e;
+    char json[16];  /* room for "INT_MIN" */
+    int error, i;
+
+    a = lept_cache_parse(cache, "[1,2]", 5, &error);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, error);
+    EXPECT_EQ_INT(LEPT_ARRAY, lept_get_type(a));
+    EXPECT_EQ_SIZE_T(2, lept_get_array_size(a));
+    b = lept_cache_parse(cache, "[1,2] trailing", 5, &error);   /* only len bytes count */
+    EXPECT_TRUE(a == b);
+    c = lept_cache_parse(cache, "[1,3]", 5, &error);
+    EXPECT_TRUE(a != c);
+    lept_cache_get_stats(cache, &stats);
+    EXPECT_EQ_SIZE_T(1, stats.hits);
+    EXPECT_EQ_SIZE_T(2, stats.misses);
+    EXPECT_EQ_SIZE_T(2, stats.count);
+    EXPECT_EQ_SIZE_T(10, stats.bytes);
+    lept_cache_release(cache, b);
+    lept_cache_release(cache, c);
+
+    /* parse errors are reported and not cached */
+    EXPECT_TRUE(lept_cache_parse(cache, "[1,", 3, &error) == NULL);
+    EXPECT_EQ_INT(LEPT_PARSE_EXPECT_VALUE, error);
+    EXPECT_TRUE(lept_cache_parse(cache, "1 2", 3, &error) == NULL);
+    EXPECT_EQ_INT(LEPT_PARSE_ROOT_NOT_SINGULAR, error);
+
+    /* the least recently used document goes first, a document in use stays valid */
+    for (i = 0; i < 5; i++) {
+        sprintf(json, "\"%d\"", i);
+        lept_cache_release(cache, lept_cache_parse(cache, json, 3, &error));
+    }
+    lept_cache_get_stats(cache, &stats);
+    EXPECT_EQ_SIZE_T(5, stats.count);
+    EXPECT_EQ_SIZE_T(15, stats.bytes);
+    EXPECT_EQ_SIZE_T(2, stats.evictions);
+    EXPECT_EQ_SIZE_T(2, lept_get_array_size(a));
+    b = lept_cache_parse(cache, "[1,2]", 5, &error);
+    EXPECT_TRUE(a != b);
+    lept_cache_release(cache, a);
+    lept_cache_release(cache, b);
+    lept_cache_get_stats(cache, &stats);
+    EXPECT_EQ_SIZE_T(1, stats.hits);
+    EXPECT_EQ_SIZE_T(4, stats.count);
+    EXPECT_EQ_SIZE_T(14, stats.bytes);
+    EXPECT_EQ_SIZE_T(4, stats.evictions);
+
+    /* a document larger than the cache is returned without being cached */
+    a = lept_cache_parse(cache, "\"0123456789abcdef\"", 18, &error);
+    EXPECT_EQ_STRING("0123456789abcdef", lept_get_string(a), lept_get_string_length(a));
+    lept_cache_get_stats(cache, &stats);
+    EXPECT_TRUE(stats.bytes <= 16);
+    lept_cache_release(cache, a);
+    lept_cache_destroy(cache);
+
+    /* walking a cached document through the getters leaves the shared entry as it was */
+    cache = lept_cache_create(1024);
+    a = lept_cache_parse(cache, doc, sizeof(doc) - 1, &error);
+    e = lept_get_array_element(lept_find_object_value(a, "a", 1), 2);
+    lept_memory_usage(a, &before);
+    EXPECT_EQ_SIZE_T(9, test_cache_walk(a));
+    b = lept_cache_parse(cache, doc, sizeof(doc) - 1, &error);
+    EXPECT_TRUE(a == b);
+    EXPECT_EQ_SIZE_T(9, test_cache_walk(b));
+    lept_memory_usage(a, &after);
+    EXPECT_EQ_SIZE_T(before.total, after.total);
+    EXPECT_EQ_SIZE_T(before.blocks, after.blocks);
+    EXPECT_TRUE(lept_get_array_element(lept_find_object_value(b, "a", 1), 2) == e);
+    EXPECT_TRUE(lept_find_object_value(e, "k", 1) == lept_get_object_value(e, 0));
+    lept_cache_release(cache, a);
+    lept_cache_release(cache, b);
+    lept_cache_destroy(cache);
+}
+
+static int test_snapshot_equal(const lept_snapshot_value* s, const lept_value* v) {
+    const double* d;
+    size_t i, n;
+    if (lept_snapshot_get_type(s) != lept_get_type(v))
+        return 0;
+    switch (lept_get_type(v)) {
+        case LEPT_NUMBER:
+            return lept_snapshot_get_number(s) == lept_get_number(v);
+        case LEPT_STRING:
+            return lept_snapshot_get_string_length(s) == lept_get_string_length(v) &&
+                memcmp(lept_snapshot_get_string(s), lept_get_string(v), lept_get_string_length(v) + 1) == 0;
+        case LEPT_ARRAY:
+            if (lept_snapshot_get_array_size(s) != lept_get_array_size(v))
+                return 0;
+            d = lept_get_array_doubles(v, &n);
+            for (i = 0; i < n; i++)
+                if (d != NULL ? lept_snapshot_get_number(lept_snapshot_get_array_element(s, i)) != d[i] :
+                    !test_snapshot_equal(lept_snapshot_get_array_element(s, i), lept_get_array_element(v, i)))
+                    return 0;
+            return 1;
+        case LEPT_OBJECT:
+            if (lept_snapshot_get_object_size(s) != lept_get_object_size(v))
+                return 0;
+            for (i = 0; i < lept_get_object_size(v); i++)
+                if (lept_snapshot_get_object_key_length(s, i) != lept_get_object_key_length(v, i) ||
+                    memcmp(lept_snapshot_get_object_key(s, i), lept_get_object_key(v, i), lept_get_object_key_length(v, i) + 1) != 0 ||
+                    !test_snapshot_equal(lept_snapshot_get_object_value(s, i), lept_get_object_value(v, i)))
+                    return 0;
+            return 1;
+        default:
+            return 1;
+    }
+}
+
+static void test_snapshot() {
+    const char* path = "leptjson_test.snapshot";
+    lept_parse_options options;
+    const lept_snapshot_value* root, *e;
+    lept_snapshot* s;
+    lept_value v;
+    FILE* f;
+    char* image;
+    long size;
+
+    lept_init(&v);
+    lept_init_parse_options(&options);
+    options.flags = LEPT_PARSE_PACK_NUMBERS;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, " { "
+        "\"n\" : null , \"f\" : false , \"t\" : true , \"i\" : 123 , \"s\" : \"abc\\u0000d\","
+        "\"a\" : [ 1, 2, 3 ], \"m\" : [ \"x\", [], {}, -0.5 ],"
+        "\"o\" : { \"1\" : 1, \"\" : \"\", \"3\" : { \"deep\" : [[[1e300]]] } }"
+        " } ", &options));
+    if ((f = fopen(path, "wb")) != NULL) {
+        EXPECT_EQ_INT(0, lept_snapshot_write(&v, fileno(f)));
+        fclose(f);
+    }
+    s = lept_snapshot_map(path);
+    EXPECT_TRUE(s != NULL);
+    if (s != NULL) {
+        root = lept_snapshot_root(s);
+        EXPECT_TRUE(test_snapshot_equal(root, &v));
+        EXPECT_EQ_SIZE_T(8, lept_snapshot_get_object_size(root));
+        EXPECT_EQ_SIZE_T(5, lept_snapshot_find_object_index(root, "a", 1));
+        EXPECT_EQ_SIZE_T(LEPT_KEY_NOT_EXIST, lept_snapshot_find_object_index(root, "z", 1));
+        EXPECT_TRUE(lept_snapshot_find_object_value(root, "z", 1) == NULL);
+        EXPECT_FALSE(lept_snapshot_get_boolean(lept_snapshot_find_object_value(root, "f", 1)));
+        EXPECT_TRUE(lept_snapshot_get_boolean(lept_snapshot_find_object_value(root, "t", 1)));
+        e = lept_snapshot_find_object_value(root, "s", 1);
+        EXPECT_EQ_SIZE_T(5, lept_snapshot_get_string_length(e));
+        EXPECT_TRUE(memcmp("abc\0d", lept_snapshot_get_string(e), 6) == 0);
+        e = lept_snapshot_find_object_value(lept_snapshot_find_object_value(root, "o", 1), "3", 1);
+        e = lept_snapshot_get_array_element(lept_snapshot_find_object_value(e, "deep", 4), 0);
+        EXPECT_EQ_DOUBLE(1e300, lept_snapshot_get_number(lept_snapshot_get_array_element(lept_snapshot_get_array_element(e, 0), 0)));
+        lept_snapshot_unmap(s);
+    }
+    lept_free(&v);
+
+    /* scalar root */
+    lept_set_string(&v, "", 0);
+    if ((f = fopen(path, "wb")) != NULL) {
+        EXPECT_EQ_INT(0, lept_snapshot_write(&v, fileno(f)));
+        fclose(f);
+    }
+    EXPECT_TRUE((s = lept_snapshot_map(path)) != NULL);
+    if (s != NULL) {
+        EXPECT_TRUE(test_snapshot_equal(lept_snapshot_root(s), &v));
+        lept_snapshot_unmap(s);
+    }
+    lept_free(&v);
+
+    /* a damaged or truncated image is refused */
+    if ((f = fopen(path, "rb")) != NULL) {
+        fseek(f, 0, SEEK_END);
+        size = ftell(f);
+        image = (char*)malloc((size_t)size);
+        rewind(f);
+        EXPECT_EQ_SIZE_T((size_t)size, fread(image, 1, (size_t)size, f));
+        fclose(f);
+        image[size - 1] ^= 1;
+        if ((f = fopen(path, "wb")) != NULL) {
+            fwrite(image, 1, (size_t)size, f);
+            fclose(f);
+        }
+        EXPECT_TRUE(lept_snapshot_map(path) == NULL);
+        image[size - 1] ^= 1;
+        image[8] ^= 1;  /* version */
+        if ((f = fopen(path, "wb")) != NULL) {
+            fwrite(image, 1, (size_t)size, f);
+            fclose(f);
+        }
+        EXPECT_TRUE(lept_snapshot_map(path) == NULL);
+        image[8] ^= 1;
+        if ((f = fopen(path, "wb")) != NULL) {
+            fwrite(image, 1, (size_t)size - 8, f);
+            fclose(f);
+        }
+        EXPECT_TRUE(lept_snapshot_map(path) == NULL);
+        free(image);
+    }
+    remove(path);
+    EXPECT_TRUE(lept_snapshot_map(path) == NULL);
+}
+
+/* maps image with the node at offset at replaced and the checksum recomputed, as a crafted file would be */
+static int test_snapshot_map_tampered(const char* path, const char* image, size_t size, size_t at, uint64_t head, uint64_t u) {
+    lept_snapshot* s;
+    lept_value body;
+    uint64_t checksum;
+    char* copy = (char*)malloc(size);
+    FILE* f;
+    memcpy(copy, image, size);
+    memcpy(copy + at, &head, sizeof(head));
+    memcpy(copy + at + 8, &u, sizeof(u));
+    lept_init(&body);
+    lept_set_string(&body, copy + 32, size - 32);
+    checksum = lept_hash(&body, 0);
+    memcpy(copy + 24, &checksum, sizeof(checksum));
+    lept_free(&body);
+    if ((f = fopen(path, "wb")) != NULL) {
+        fwrite(copy, 1, size, f);
+        fclose(f);
+    }
+    free(copy);
+    if ((s = lept_snapshot_map(path)) == NULL)
+        return 0;
+    lept_snapshot_unmap(s);
+    return 1;
+}
+
+static void test_snapshot_tampered() {
+    const char* path = "leptjson_test.snapshot";
+    const lept_snapshot_value* root;
+    lept_snapshot* s;
+    lept_value v;
+    FILE* f;
+    char* image;
+    size_t size, a, str, key;
+    uint64_t ahead, au, shead, su, khead, ku;
+
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "{\"k\":[\"ab\",1]}"));
+    if ((f = fopen(path, "wb")) != NULL) {
+        EXPECT_EQ_INT(0, lept_snapshot_write(&v, fileno(f)));
+        fclose(f);
+    }
+    lept_free(&v);
+    if ((f = fopen(path, "rb")) == NULL || (s = lept_snapshot_map(path)) == NULL) {
+        EXPECT_TRUE(0);
+        if (f != NULL)
+            fclose(f);
+        return;
+    }
+    fseek(f, 0, SEEK_END);
+    size = (size_t)ftell(f);
+    image = (char*)malloc(size);
+    rewind(f);
+    EXPECT_EQ_SIZE_T(size, fread(image, 1, size, f));
+    fclose(f);
+
+    /* offsets of the array, its string element and the key "k", which precedes the array in its member */
+    root = lept_snapshot_root(s);
+    a = (size_t)((const char*)lept_snapshot_find_object_value(root, "k", 1) - (const char*)root) + 32;
+    str = (size_t)((const char*)lept_snapshot_get_array_element(lept_snapshot_find_object_value(root, "k", 1), 0) - (const char*)root) + 32;
+    key = a - 16;
+    lept_snapshot_unmap(s);
+    memcpy(&ahead, image + a, 8);
+    memcpy(&au, image + a + 8, 8);
+    memcpy(&shead, image + str, 8);
+    memcpy(&su, image + str + 8, 8);
+    memcpy(&khead, image + key, 8);
+    memcpy(&ku, image + key + 8, 8);
+
+    /* a matching checksum alone does not get an image mapped */
+    EXPECT_TRUE(test_snapshot_map_tampered(path, image, size, a, ahead, au));
+    EXPECT_FALSE(test_snapshot_map_tampered(path, image, size, a, ahead + ((uint64_t)1000 << 8), au));
+    EXPECT_FALSE(test_snapshot_map_tampered(path, image, size, a, ahead, (uint64_t)size));
+    EXPECT_FALSE(test_snapshot_map_tampered(path, image, size, a, ahead, au + 4));
+    EXPECT_FALSE(test_snapshot_map_tampered(path, image, size, a, ahead, 0));  /* contains itself */
+    EXPECT_FALSE(test_snapshot_map_tampered(path, image, size, a, (ahead & ~(uint64_t)0xff) | 7, au));
+    EXPECT_FALSE(test_snapshot_map_tampered(path, image, size, str, shead + ((uint64_t)100 << 8), su));
+    EXPECT_FALSE(test_snapshot_map_tampered(path, image, size, str, shead - ((uint64_t)1 << 8), su));  /* no '\0' */
+    EXPECT_FALSE(test_snapshot_map_tampered(path, image, size, str, shead, (uint64_t)size));
+    EXPECT_FALSE(test_snapshot_map_tampered(path, image, size, key, (khead & ~(uint64_t)0xff) | LEPT_NUMBER, ku));
+    free(image);
+    remove(path);
+}
+
+#define TEST_PATCH(error, json, patch_json, expect_json)\
+    do {\
+        lept_value v, patch, expect;\
+        lept_init(&v);\
+        lept_init(&patch);\
+        lept_init(&expect);\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&patch, patch_json));\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&expect, expect_json));\
+        EXPECT_EQ_INT(error, lept_patch_apply(&v, &patch));\
+        EXPECT_TRUE(lept_is_equal(&expect, &v));\
+        lept_free(&v);\
+        lept_free(&patch);\
+        lept_free(&expect);\
+    } while(0)
+
+static void test_patch() {
+    lept_value v, v2, patch;
+    lept_parse_options options;
+
+    /* RFC 6902 appendix A */
+    TEST_PATCH(LEPT_PATCH_OK, "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz\",\"value\":\"qux\"}]", "{\"baz\":\"qux\",\"foo\":\"bar\"}");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"foo\":[\"bar\",\"baz\"]}", "[{\"op\":\"add\",\"path\":\"/foo/1\",\"value\":\"qux\"}]", "{\"foo\":[\"bar\",\"qux\",\"baz\"]}");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"remove\",\"path\":\"/baz\"}]", "{\"foo\":\"bar\"}");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"foo\":[\"bar\",\"qux\",\"baz\"]}", "[{\"op\":\"remove\",\"path\":\"/foo/1\"}]", "{\"foo\":[\"bar\",\"baz\"]}");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"replace\",\"path\":\"/baz\",\"value\":\"boo\"}]", "{\"baz\":\"boo\",\"foo\":\"bar\"}");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"foo\":{\"bar\":\"baz\",\"waldo\":\"fred\"},\"qux\":{\"corge\":\"grault\"}}",
+        "[{\"op\":\"move\",\"from\":\"/foo/waldo\",\"path\":\"/qux/thud\"}]",
+        "{\"foo\":{\"bar\":\"baz\"},\"qux\":{\"corge\":\"grault\",\"thud\":\"fred\"}}");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"foo\":[\"all\",\"grass\",\"cows\",\"eat\"]}", "[{\"op\":\"move\",\"from\":\"/foo/1\",\"path\":\"/foo/3\"}]", "{\"foo\":[\"all\",\"cows\",\"eat\",\"grass\"]}");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}",
+        "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"qux\"},{\"op\":\"test\",\"path\":\"/foo/1\",\"value\":2}]",
+        "{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}");
+    TEST_PATCH(LEPT_PATCH_TEST_FAILED, "{\"baz\":\"qux\"}", "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"bar\"}]", "{\"baz\":\"qux\"}");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/child\",\"value\":{\"grandchild\":{}}}]", "{\"foo\":\"bar\",\"child\":{\"grandchild\":{}}}");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz\",\"value\":\"qux\",\"xyz\":123}]", "{\"foo\":\"bar\",\"baz\":\"qux\"}");
+    TEST_PATCH(LEPT_PATCH_PATH_NOT_FOUND, "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz/bat\",\"value\":\"qux\"}]", "{\"foo\":\"bar\"}");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"/\":9,\"~1\":10}", "[{\"op\":\"test\",\"path\":\"/~01\",\"value\":10}]", "{\"/\":9,\"~1\":10}");
+    TEST_PATCH(LEPT_PATCH_TEST_FAILED, "{\"/\":9,\"~1\":10}", "[{\"op\":\"test\",\"path\":\"/~01\",\"value\":\"10\"}]", "{\"/\":9,\"~1\":10}");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"foo\":[\"bar\"]}", "[{\"op\":\"add\",\"path\":\"/foo/-\",\"value\":[\"abc\",\"def\"]}]", "{\"foo\":[\"bar\",[\"abc\",\"def\"]]}");
+
+    /* whole document, copy, moving to the same place */
+    TEST_PATCH(LEPT_PATCH_OK, "{\"a\":1}", "[{\"op\":\"replace\",\"path\":\"\",\"value\":[1]}]", "[1]");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"a\":{\"b\":[1,2]}}", "[{\"op\":\"copy\",\"from\":\"/a/b\",\"path\":\"/c\"},{\"op\":\"add\",\"path\":\"/c/0\",\"value\":0}]", "{\"a\":{\"b\":[1,2]},\"c\":[0,1,2]}");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"a\":1}", "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/a\"}]", "{\"a\":1}");
+    TEST_PATCH(LEPT_PATCH_OK, "[]", "[]", "[]");
+    TEST_PATCH(LEPT_PATCH_OK, "[1,2,3]", "[{\"op\":\"replace\",\"path\":\"/1\",\"value\":9}]", "[1,9,3]");
+    TEST_PATCH(LEPT_PATCH_PATH_NOT_FOUND, "[1,2,3]", "[{\"op\":\"replace\",\"path\":\"/-\",\"value\":9}]", "[1,2,3]");
+
+    /* nothing is changed unless every operation succeeds */
+    TEST_PATCH(LEPT_PATCH_PATH_NOT_FOUND, "{\"a\":[1,2],\"b\":{\"c\":3},\"d\":4}",
+        "[{\"op\":\"add\",\"path\":\"/a/-\",\"value\":3},{\"op\":\"remove\",\"path\":\"/b\"},{\"op\":\"replace\",\"path\":\"/d\",\"value\":5},"
+        "{\"op\":\"move\",\"from\":\"/a/0\",\"path\":\"/e\"},{\"op\":\"add\",\"path\":\"/x\",\"value\":0},{\"op\":\"remove\",\"path\":\"/a/5\"}]",
+        "{\"a\":[1,2],\"b\":{\"c\":3},\"d\":4}");
+    TEST_PATCH(LEPT_PATCH_TEST_FAILED, "{\"a\":1,\"b\":2,\"c\":3}",
+        "[{\"op\":\"remove\",\"path\":\"/a\"},{\"op\":\"remove\",\"path\":\"/b\"},{\"op\":\"test\",\"path\":\"/c\",\"value\":0}]",
+        "{\"a\":1,\"b\":2,\"c\":3}");
+    lept_init(&v);
+    lept_init(&patch);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "{\"a\":1,\"b\":2,\"c\":3}"));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&patch, "[{\"op\":\"remove\",\"path\":\"/a\"},{\"op\":\"test\",\"path\":\"/a\",\"value\":1}]"));
+    EXPECT_EQ_INT(LEPT_PATCH_PATH_NOT_FOUND, lept_patch_apply(&v, &patch));
+    EXPECT_EQ_STRING("a", lept_get_object_key(&v, 0), lept_get_object_key_length(&v, 0));  /* members keep their order */
+    lept_free(&patch);
+
+    /* a shared document is copied along the changed path only */
+    lept_init(&v2);
+    lept_copy(&v2, &v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&patch, "[{\"op\":\"replace\",\"path\":\"/b\",\"value\":0}]"));
+    EXPECT_EQ_INT(LEPT_PATCH_OK, lept_patch_apply(&v2, &patch));
+    EXPECT_EQ_DOUBLE(2.0, lept_get_number(lept_find_object_value(&v, "b", 1)));
+    EXPECT_EQ_DOUBLE(0.0, lept_get_number(lept_find_object_value(&v2, "b", 1)));
+    lept_free(&patch);
+    lept_free(&v2);
+    lept_free(&v);
+
+    /* packed numbers are read in place and unpacked on the first change */
+    lept_init_parse_options(&options);
+    options.flags = LEPT_PARSE_PACK_NUMBERS;
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, "[1,2,3]", &options));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&patch, "[{\"op\":\"test\",\"path\":\"/1\",\"value\":2},{\"op\":\"add\",\"path\":\"/0\",\"value\":\"a\"}]"));
+    EXPECT_EQ_INT(LEPT_PATCH_OK, lept_patch_apply(&v, &patch));
+    EXPECT_EQ_SIZE_T(4, lept_get_array_size(&v));
+    EXPECT_EQ_STRING("a", lept_get_string(lept_get_array_element(&v, 0)), 1);
+    EXPECT_EQ_DOUBLE(3.0, lept_get_number(lept_get_array_element(&v, 3)));
+    lept_free(&patch);
+    lept_free(&v);
+
+    /* malformed patches are refused before anything is applied */
+    TEST_PATCH(LEPT_PATCH_INVALID_OPERATION, "{}", "{}", "{}");
+    TEST_PATCH(LEPT_PATCH_INVALID_OPERATION, "{}", "[{\"op\":\"add\",\"path\":\"/a\",\"value\":1},{\"op\":\"bad\",\"path\":\"/a\"}]", "{}");
+    TEST_PATCH(LEPT_PATCH_INVALID_OPERATION, "{}", "[{\"path\":\"/a\",\"value\":1}]", "{}");
+    TEST_PATCH(LEPT_PATCH_INVALID_OPERATION, "{}", "[{\"op\":\"add\",\"path\":\"/a\"}]", "{}");
+    TEST_PATCH(LEPT_PATCH_INVALID_OPERATION, "{}", "[{\"op\":\"copy\",\"path\":\"/a\"}]", "{}");
+    TEST_PATCH(LEPT_PATCH_INVALID_OPERATION, "{}", "[{\"op\":\"remove\",\"path\":1}]", "{}");
+    TEST_PATCH(LEPT_PATCH_INVALID_OPERATION, "{\"a\":{}}", "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/a/b\"}]", "{\"a\":{}}");
+    TEST_PATCH(LEPT_PATCH_INVALID_POINTER, "{}", "[{\"op\":\"add\",\"path\":\"a\",\"value\":1}]", "{}");
+    TEST_PATCH(LEPT_PATCH_INVALID_POINTER, "{}", "[{\"op\":\"add\",\"path\":\"/~2\",\"value\":1}]", "{}");
+    TEST_PATCH(LEPT_PATCH_PATH_NOT_FOUND, "[1]", "[{\"op\":\"add\",\"path\":\"/01\",\"value\":1}]", "[1]");
+    TEST_PATCH(LEPT_PATCH_PATH_NOT_FOUND, "[1]", "[{\"op\":\"add\",\"path\":\"/2\",\"value\":1}]", "[1]");
+    TEST_PATCH(LEPT_PATCH_PATH_NOT_FOUND, "[1]", "[{\"op\":\"remove\",\"path\":\"/-\"}]", "[1]");
+    TEST_PATCH(LEPT_PATCH_PATH_NOT_FOUND, "[1]", "[{\"op\":\"remove\",\"path\":\"/18446744073709551617\"}]", "[1]");
+    TEST_PATCH(LEPT_PATCH_PATH_NOT_FOUND, "{}", "[{\"op\":\"remove\",\"path\":\"\"}]", "{}");
+}
+
+#define TEST_MERGE_PATCH(json, patch_json, expect_json)\
+    do {\
+        lept_value v, patch, expect;\
+        lept_init(&v);\
+        lept_init(&patch);\
+        lept_init(&expect);\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&patch, patch_json));\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&expect, expect_json));\
+        lept_merge_patch_apply(&v, &patch);\
+        EXPECT_TRUE(lept_is_equal(&expect, &v));\
+        lept_free(&v);\
+        lept_free(&patch);\
+        lept_free(&expect);\
+    } while(0)
+
+static void test_merge_patch() {
+    /* RFC 7396 appendix A */
+    TEST_MERGE_PATCH("{\"a\":\"b\"}", "{\"a\":\"c\"}", "{\"a\":\"c\"}");
+    TEST_MERGE_PATCH("{\"a\":\"b\"}", "{\"b\":\"c\"}", "{\"a\":\"b\",\"b\":\"c\"}");
+    TEST_MERGE_PATCH("{\"a\":\"b\"}", "{\"a\":null}", "{}");
+    TEST_MERGE_PATCH("{\"a\":\"b\",\"b\":\"c\"}", "{\"a\":null}", "{\"b\":\"c\"}");
+    TEST_MERGE_PATCH("{\"a\":[\"b\"]}", "{\"a\":\"c\"}", "{\"a\":\"c\"}");
+    TEST_MERGE_PATCH("{\"a\":\"c\"}", "{\"a\":[\"b\"]}", "{\"a\":[\"b\"]}");
+    TEST_MERGE_PATCH("{\"a\":{\"b\":\"c\"}}", "{\"a\":{\"b\":\"d\",\"c\":null}}", "{\"a\":{\"b\":\"d\"}}");
+    TEST_MERGE_PATCH("{\"a\":[{\"b\":\"c\"}]}", "{\"a\":[1]}", "{\"a\":[1]}");
+    TEST_MERGE_PATCH("[\"a\",\"b\"]", "[\"c\",\"d\"]", "[\"c\",\"d\"]");
+    TEST_MERGE_PATCH("{\"a\":\"b\"}", "[\"c\"]", "[\"c\"]");
+    TEST_MERGE_PATCH("{\"a\":\"foo\"}", "null", "null");
+    TEST_MERGE_PATCH("{\"a\":\"foo\"}", "\"bar\"", "\"bar\"");
+    TEST_MERGE_PATCH("{\"e\":null}", "{\"a\":1}", "{\"e\":null,\"a\":1}");
+    TEST_MERGE_PATCH("[1,2]", "{\"a\":\"b\",\"c\":null}", "{\"a\":\"b\"}");
+    TEST_MERGE_PATCH("{}", "{\"a\":{\"bb\":{\"ccc\":null}}}", "{\"a\":{\"bb\":{}}}");
+    TEST_MERGE_PATCH("{\"a\":{\"x\":1},\"b\":2}", "{\"a\":{\"y\":{\"z\":[3]}},\"b\":{\"c\":4},\"d\":5}", "{\"a\":{\"x\":1,\"y\":{\"z\":[3]}},\"b\":{\"c\":4},\"d\":5}");
 }
 
 static void test_copy() {
@@ -482,6 +1705,423 @@ static void test_copy() {
     lept_free(&v2);
 }
 
+static void test_copy_deep() {
+    lept_value v1, v2;
+    char* json;
+    size_t i, n = 100000;
+
+    /* [{"a":[{"a":...0...,"b":1}],"b":1}] nested well beyond what recursion could handle */
+    json = (char*)malloc(n * 14 + 2);
+    for (i = 0; i < n; i++) {
+        memcpy(json + i * 6, "[{\"a\":", 6);
+        memcpy(json + n * 6 + 1 + i * 8, ",\"b\":1}]", 8);
+    }
+    json[n * 6] = '0';
+    json[n * 14 + 1] = '\0';
+    lept_init(&v1);
+    lept_init(&v2);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v1, json));
+    lept_copy(&v2, &v1);
+    EXPECT_TRUE(lept_is_equal(&v1, &v2));
+    lept_set_number(lept_set_object_value(lept_set_array_element(&v2, 0), "b", 1), 2.0);
+    EXPECT_FALSE(lept_is_equal(&v1, &v2));
+    lept_free(&v1);
+    lept_free(&v2);
+    free(json);
+}
+
+static void test_stringify_deep() {
+    lept_value v;
+    char* json, *json2;
+    size_t i, length, n = 100000;
+
+    /* what parses without recursion is written back without it */
+    json = (char*)malloc(n * 14 + 2);
+    for (i = 0; i < n; i++) {
+        memcpy(json + i * 6, "[{\"a\":", 6);
+        memcpy(json + n * 6 + 1 + i * 8, ",\"b\":1}]", 8);
+    }
+    json[n * 6] = '0';
+    json[n * 14 + 1] = '\0';
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+    json2 = lept_stringify(&v, &length);
+    EXPECT_EQ_SIZE_T(n * 14 + 1, length);
+    EXPECT_TRUE(memcmp(json, json2, length + 1) == 0);
+    EXPECT_EQ_SIZE_T(length, lept_stringify_size(&v));
+    lept_free_buffer(json2);
+    TEST_CODEC_ROUNDTRIP(cbor, &v);
+    TEST_CODEC_ROUNDTRIP(msgpack, &v);
+    lept_free(&v);
+
+    for (i = 0; i < n; i++) {
+        json[i] = '[';
+        json[n * 2 - 1 - i] = ']';
+    }
+    json[n * 2] = '\0';
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+    json2 = lept_stringify(&v, &length);
+    EXPECT_EQ_SIZE_T(n * 2, length);
+    EXPECT_TRUE(memcmp(json, json2, length + 1) == 0);
+    lept_free_buffer(json2);
+    lept_free(&v);
+    free(json);
+}
+
+#define TEST_STRINGIFY_VALUE(json, v)\
+    do {\
+        char* json2;\
+        size_t length;\
+        json2 = lept_stringify(v, &length);\
+        EXPECT_EQ_STRING(json, json2, length);\
+        lept_free_buffer(json2);\
+    } while(0)
+
+static void test_copy_on_write() {
+    lept_value v1, v2, v3;
+    lept_parse_options options;
+    lept_memory_stats m;
+    lept_value* a;
+    const lept_value* e;
+    const double* d;
+
+    lept_init(&v1);
+    lept_init(&v2);
+    lept_init(&v3);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v1, "{\"s\":\"abc\",\"a\":[1,[2],\"x\"],\"o\":{\"k\":null}}"));
+    lept_copy(&v2, &v1);
+    lept_copy(&v3, &v2);
+    EXPECT_TRUE(lept_get_string(lept_find_object_value(&v1, "s", 1)) == lept_get_string(lept_find_object_value(&v2, "s", 1)));
+
+    /* writing through one copy leaves the others alone and keeps untouched subtrees shared */
+    a = lept_set_object_value(&v2, "a", 1);
+    lept_set_string(lept_set_array_element(a, 2), "y", 1);
+    lept_pushback_array_element(lept_set_array_element(a, 1));
+    lept_set_boolean(lept_set_object_value(lept_set_object_value(&v3, "o", 1), "k", 1), 1);
+    EXPECT_TRUE(lept_get_string(lept_find_object_value(&v1, "s", 1)) == lept_get_string(lept_find_object_value(&v2, "s", 1)));
+    EXPECT_TRUE(lept_get_string(lept_find_object_value(&v1, "s", 1)) == lept_get_string(lept_find_object_value(&v3, "s", 1)));
+    TEST_STRINGIFY_VALUE("{\"s\":\"abc\",\"a\":[1,[2],\"x\"],\"o\":{\"k\":null}}", &v1);
+    TEST_STRINGIFY_VALUE("{\"s\":\"abc\",\"a\":[1,[2,null],\"y\"],\"o\":{\"k\":null}}", &v2);
+    TEST_STRINGIFY_VALUE("{\"s\":\"abc\",\"a\":[1,[2],\"x\"],\"o\":{\"k\":true}}", &v3);
+
+    /* the original can go first */
+    lept_free(&v1);
+    lept_set_number(lept_set_array_element(lept_set_object_value(&v3, "a", 1), 0), 5.0);
+    TEST_STRINGIFY_VALUE("{\"s\":\"abc\",\"a\":[5,[2],\"x\"],\"o\":{\"k\":true}}", &v3);
+    lept_free(&v3);
+    TEST_STRINGIFY_VALUE("{\"s\":\"abc\",\"a\":[1,[2,null],\"y\"],\"o\":{\"k\":null}}", &v2);
+    lept_free(&v2);
+
+    /* packed arrays */
+    lept_init_parse_options(&options);
+    options.flags = LEPT_PARSE_PACK_NUMBERS;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v1, "[1,2,3]", &options));
+    lept_copy(&v2, &v1);
+    EXPECT_TRUE(lept_get_array_doubles(&v1, NULL) == lept_get_array_doubles(&v2, NULL));
+    lept_set_number(lept_set_array_element(&v2, 1), 0.0);
+    EXPECT_TRUE(lept_get_array_doubles(&v1, NULL) != NULL);
+    TEST_STRINGIFY_VALUE("[1,2,3]", &v1);
+    TEST_STRINGIFY_VALUE("[1,0,3]", &v2);
+    lept_copy(&v1, &v2);
+    lept_free(&v2);
+    TEST_STRINGIFY_VALUE("[1,0,3]", &v1);
+    lept_free(&v1);
+
+    /* reading a copy leaves everything shared, so pointers taken before stay valid */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v1, "{\"a\":[true,\"x\"],\"o\":{\"k\":null},\"p\":[1,2]}", &options));
+    e = lept_get_array_element(lept_find_object_value(&v1, "a", 1), 1);
+    d = lept_get_array_doubles(lept_find_object_value(&v1, "p", 1), NULL);
+    lept_copy(&v2, &v1);
+    EXPECT_TRUE(lept_get_array_element(lept_find_object_value(&v2, "a", 1), 1) == e);
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(lept_get_object_value(lept_find_object_value(&v2, "o", 1), 0)));
+    EXPECT_TRUE(lept_get_array_doubles(lept_find_object_value(&v2, "p", 1), NULL) == d);
+    lept_memory_usage(&v2, &m);
+    EXPECT_EQ_SIZE_T(m.total, m.shared);
+    EXPECT_EQ_STRING("x", lept_get_string(e), lept_get_string_length(e));
+    EXPECT_EQ_DOUBLE(2.0, d[1]);
+    lept_free(&v1);
+    lept_free(&v2);
+}
+
+#define TEST_DIFF(json1, json2, count)\
+    do {\
+        lept_value a, b, patch;\
+        lept_init(&a);\
+        lept_init(&b);\
+        lept_init(&patch);\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&a, json1));\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&b, json2));\
+        lept_diff(&a, &b, &patch);\
+        EXPECT_EQ_SIZE_T(count, lept_get_array_size(&patch));\
+        EXPECT_EQ_INT(LEPT_PATCH_OK, lept_patch_apply(&a, &patch));\
+        EXPECT_TRUE(lept_is_equal(&a, &b));\
+        lept_free(&a);\
+        lept_free(&b);\
+        lept_free(&patch);\
+    } while(0)
+
+#define EXPECT_MEMORY_TOTAL(m)\
+    EXPECT_EQ_SIZE_T((m).nodes + (m).slack + (m).strings + (m).keys + (m).overhead, (m).total)
+
+static void test_memory_usage() {
+    lept_value v, c;
+    lept_parse_options options;
+    lept_memory_stats m;
+
+    lept_init(&v);
+    lept_set_number(&v, 1.0);
+    lept_memory_usage(&v, &m);
+    EXPECT_EQ_SIZE_T(0, m.total);
+    EXPECT_EQ_SIZE_T(0, m.blocks);
+
+    lept_set_string(&v, "abc", 3);
+    lept_memory_usage(&v, &m);
+    EXPECT_EQ_SIZE_T(4, m.strings);
+    EXPECT_EQ_SIZE_T(1, m.blocks);
+    EXPECT_TRUE(m.overhead >= sizeof(size_t));
+    EXPECT_MEMORY_TOTAL(m);
+    lept_free(&v);
+
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "[1,\"ab\",{\"k\":null},[]]"));
+    lept_memory_usage(&v, &m);
+    EXPECT_EQ_SIZE_T(4 * sizeof(lept_value) + sizeof(lept_member), m.nodes);
+    EXPECT_EQ_SIZE_T(0, m.slack);
+    EXPECT_EQ_SIZE_T(3, m.strings);
+    EXPECT_EQ_SIZE_T(2, m.keys);
+    EXPECT_EQ_SIZE_T(0, m.shared);
+    EXPECT_EQ_SIZE_T(4, m.blocks);
+    EXPECT_MEMORY_TOTAL(m);
+
+    /* reserved capacity shows up as slack */
+    lept_reserve_array(&v, 10);
+    lept_memory_usage(&v, &m);
+    EXPECT_EQ_SIZE_T(6 * sizeof(lept_value), m.slack);
+    EXPECT_MEMORY_TOTAL(m);
+
+    /* copies share their buffers, which are counted once per tree */
+    lept_copy(&c, &v);
+    lept_memory_usage(&c, &m);
+    EXPECT_EQ_SIZE_T(m.total, m.shared);
+    lept_free(&c);
+    lept_set_array(&c, 2);
+    lept_copy(lept_pushback_array_element(&c), &v);
+    lept_copy(lept_pushback_array_element(&c), &v);
+    lept_memory_usage(&c, &m);
+    EXPECT_EQ_SIZE_T(6 * sizeof(lept_value) + sizeof(lept_member), m.nodes);
+    EXPECT_EQ_SIZE_T(6 * sizeof(lept_value), m.slack);
+    EXPECT_EQ_SIZE_T(3, m.strings);
+    EXPECT_EQ_SIZE_T(5, m.blocks);
+    EXPECT_TRUE(m.shared > 0 && m.shared < m.total);
+    EXPECT_MEMORY_TOTAL(m);
+    lept_free(&c);
+    lept_free(&v);
+
+    /* packed arrays hold doubles */
+    lept_init_parse_options(&options);
+    options.flags = LEPT_PARSE_PACK_NUMBERS;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, "{\"xyz\":[1,2,3]}", &options));
+    lept_memory_usage(&v, &m);
+    EXPECT_EQ_SIZE_T(sizeof(lept_member) + 3 * sizeof(double), m.nodes);
+    EXPECT_EQ_SIZE_T(4, m.keys);
+    EXPECT_EQ_SIZE_T(3, m.blocks);
+    EXPECT_MEMORY_TOTAL(m);
+    lept_free(&v);
+}
+
+static void test_shrink_to_fit() {
+    lept_value v, c, e;
+    lept_memory_stats m;
+
+    lept_init(&v);
+    lept_set_array(&v, 4);
+    EXPECT_EQ_SIZE_T(4 * sizeof(lept_value), lept_shrink_to_fit_recursive(&v));
+    EXPECT_EQ_SIZE_T(0, lept_get_array_capacity(&v));
+    lept_free(&v);
+
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "{\"a\":[1,2],\"b\":{\"c\":[]}}"));
+    lept_copy(&e, &v);
+    lept_reserve_object(&v, 5);
+    lept_reserve_array(lept_set_object_value(&v, "a", 1), 8);
+    lept_reserve_object(lept_set_object_value(&v, "b", 1), 3);
+
+    /* nothing is trimmed while the buffers are shared */
+    lept_copy(&c, &v);
+    EXPECT_EQ_SIZE_T(0, lept_shrink_to_fit_recursive(&c));
+    EXPECT_EQ_SIZE_T(5, lept_get_object_capacity(&c));
+    lept_free(&c);
+
+    EXPECT_EQ_SIZE_T(6 * sizeof(lept_value) + 5 * sizeof(lept_member), lept_shrink_to_fit_recursive(&v));
+    EXPECT_EQ_SIZE_T(2, lept_get_object_capacity(&v));
+    EXPECT_EQ_SIZE_T(2, lept_get_array_capacity(lept_find_object_value(&v, "a", 1)));
+    EXPECT_TRUE(lept_is_equal(&v, &e));
+    lept_memory_usage(&v, &m);
+    EXPECT_EQ_SIZE_T(0, m.slack);
+    EXPECT_EQ_SIZE_T(0, lept_shrink_to_fit_recursive(&v));
+    lept_free(&e);
+    lept_free(&v);
+}
+
+#define TEST_COMPACT(json)\
+    do {\
+        lept_value v, c;\
+        lept_memory_stats m;\
+        lept_init(&v);\
+        lept_init(&c);\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));\
+        lept_compact(&c, &v);\
+        EXPECT_TRUE(lept_is_equal(&c, &v));\
+        TEST_STRINGIFY_VALUE(json, &c);\
+        lept_memory_usage(&c, &m);\
+        EXPECT_TRUE(m.blocks <= 1);\
+        EXPECT_EQ_SIZE_T(0, m.slack);\
+        EXPECT_EQ_SIZE_T(0, m.shared);\
+        lept_compact(&c, &c);\
+        TEST_STRINGIFY_VALUE(json, &c);\
+        lept_free(&v);\
+        lept_free(&c);\
+    } while(0)
+
+static void test_compact() {
+    lept_value v, c, d;
+    lept_parse_options options;
+    lept_memory_stats m;
+    lept_value* a;
+
+    TEST_COMPACT("null");
+    TEST_COMPACT("1.5");
+    TEST_COMPACT("\"\"");
+    TEST_COMPACT("\"a\\nb\"");
+    TEST_COMPACT("[]");
+    TEST_COMPACT("{}");
+    TEST_COMPACT("[[],{},[[]],\"\",0]");
+    TEST_COMPACT("{\"a\":[1,{\"b\":\"c\"},[2,[3]]],\"\":{\"d\":[]},\"e\":\"f\\\"g\"}");
+
+    /* the spare capacity of empty containers is dropped */
+    lept_init(&v);
+    lept_init(&c);
+    lept_set_array(&v, 4);
+    lept_set_object(lept_pushback_array_element(&v), 4);
+    lept_compact(&c, &v);
+    EXPECT_EQ_SIZE_T(1, lept_get_array_capacity(&c));
+    lept_memory_usage(&c, &m);
+    EXPECT_EQ_SIZE_T(0, m.slack);
+    EXPECT_EQ_SIZE_T(1, m.blocks);
+    lept_free(&v);
+
+    /* mutators copy out of the block, which lives as long as anything refers into it */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "{\"s\":\"abc\",\"a\":[1,[2],\"x\"],\"o\":{\"k\":null}}"));
+    lept_compact(&c, &v);
+    lept_copy(&d, &c);
+    lept_memory_usage(&d, &m);
+    EXPECT_EQ_SIZE_T(1, m.blocks);
+    EXPECT_EQ_SIZE_T(m.total, m.shared);
+    a = lept_set_object_value(&c, "a", 1);
+    lept_set_string(lept_set_array_element(a, 2), "y", 1);
+    lept_pushback_array_element(lept_set_array_element(a, 1));
+    lept_remove_object_value(&c, lept_find_object_index(&c, "o", 1));
+    TEST_STRINGIFY_VALUE("{\"s\":\"abc\",\"a\":[1,[2,null],\"y\"]}", &c);
+    TEST_STRINGIFY_VALUE("{\"s\":\"abc\",\"a\":[1,[2],\"x\"],\"o\":{\"k\":null}}", &d);
+    EXPECT_TRUE(lept_is_equal(&d, &v));
+    lept_memory_usage(&c, &m);
+    EXPECT_TRUE(m.shared > 0 && m.shared < m.total);
+    lept_free(&d);
+    lept_free(&v);
+    lept_memory_usage(&c, &m);
+    EXPECT_EQ_SIZE_T(0, m.shared);
+    lept_copy(&v, lept_find_object_value(&c, "s", 1));
+    lept_free(&c);
+    EXPECT_EQ_STRING("abc", lept_get_string(&v), lept_get_string_length(&v));
+    lept_free(&v);
+
+    /* buffers shared in the source stay shared, packed arrays stay packed */
+    lept_init_parse_options(&options);
+    options.flags = LEPT_PARSE_PACK_NUMBERS;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, "{\"p\":[1,2,3],\"o\":{\"k\":\"v\"}}", &options));
+    lept_copy(&c, lept_find_object_value(&v, "o", 1));
+    lept_move(lept_set_object_value(&v, "q", 1), &c);
+    lept_compact(&v, &v);
+    lept_memory_usage(&v, &m);
+    EXPECT_EQ_SIZE_T(3 * sizeof(lept_member) + 3 * sizeof(double) + sizeof(lept_member), m.nodes);
+    EXPECT_EQ_SIZE_T(2, m.strings);
+    EXPECT_TRUE(lept_get_array_doubles(lept_find_object_value(&v, "p", 1), NULL) != NULL);
+    lept_free(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&v, "[1,2,3]", &options));
+    lept_compact(&c, &v);
+    EXPECT_TRUE(lept_get_array_doubles(&c, NULL) != NULL);
+    EXPECT_TRUE(lept_is_equal(&c, &v));
+    lept_free(&c);
+    lept_free(&v);
+}
+
+static void test_diff() {
+    lept_value a, b, patch;
+    lept_parse_options options;
+    size_t i;
+    char key[8];
+
+    TEST_DIFF("null", "null", 0);
+    TEST_DIFF("1", "2", 1);
+    TEST_DIFF("[1]", "{}", 1);
+    TEST_DIFF("{\"a\":1,\"b\":[1,2]}", "{\"b\":[1,2],\"a\":1}", 0);
+    TEST_DIFF("{\"a\":1,\"b\":2}", "{\"a\":1,\"c\":2}", 2);
+    TEST_DIFF("{\"a\":{\"b\":{\"c\":[1,2,3]}},\"d\":0}", "{\"a\":{\"b\":{\"c\":[1,5,3]}},\"d\":0}", 1);
+    TEST_DIFF("[1,2,3,4]", "[1,2,9,3,4]", 1);
+    TEST_DIFF("[1,2,3,4]", "[1,4]", 2);
+    TEST_DIFF("[1,2,3]", "[4,5,6,7]", 4);
+    TEST_DIFF("[[1],[2],[3]]", "[[1],[2,0],[3]]", 1);
+    TEST_DIFF("[{\"a\":1},{\"b\":2}]", "[{\"b\":2}]", 1);
+    TEST_DIFF("{\"a/b\":1,\"c~d\":2}", "{\"a/b\":3,\"c~d\":4}", 2);
+    TEST_DIFF("{\"\":[]}", "{\"\":[null]}", 1);
+    TEST_DIFF("[0,-0]", "[-0,0]", 0);
+    TEST_DIFF("{\"a\":0}", "{\"a\":{}}", 1);
+
+    lept_init(&a);
+    lept_init(&b);
+    lept_init(&patch);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&a, "{\"x\":[1,2],\"y\":{\"z\":true},\"w~/\":0}"));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&b, "{\"x\":[1,3],\"w~/\":0,\"v\":\"s\"}"));
+    lept_diff(&a, &b, &patch);
+    TEST_STRINGIFY_VALUE("[{\"op\":\"remove\",\"path\":\"/y\"},{\"op\":\"add\",\"path\":\"/v\",\"value\":\"s\"},"
+        "{\"op\":\"replace\",\"path\":\"/x/1\",\"value\":3}]", &patch);
+
+    /* added values share their buffers with b */
+    lept_free(&a);
+    lept_parse(&a, "{}");
+    lept_diff(&a, &b, &patch);
+    EXPECT_TRUE(lept_get_object_value(lept_get_array_element(&patch, 0), 2)->u.a.e == b.u.o.m[0].v.u.a.e);
+
+    /* an edited copy is compared along the edited path only */
+    lept_set_object(&a, 0);
+    for (i = 0; i < 100; i++) {
+        sprintf(key, "k%d", (int)i);
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(lept_set_object_value(&a, key, strlen(key)), "{\"v\":[1,2,{\"w\":null}]}"));
+    }
+    lept_copy(&b, &a);
+    lept_set_number(lept_set_object_value(lept_set_object_value(&b, "k42", 3), "v", 1), 0.0);
+    lept_diff(&a, &b, &patch);
+    TEST_STRINGIFY_VALUE("[{\"op\":\"replace\",\"path\":\"/k42/v\",\"value\":0}]", &patch);
+    lept_diff(&b, &a, &patch);
+    EXPECT_EQ_INT(LEPT_PATCH_OK, lept_patch_apply(&b, &patch));
+    EXPECT_TRUE(lept_is_equal(&a, &b));
+
+    /* packed arrays */
+    lept_init_parse_options(&options);
+    options.flags = LEPT_PARSE_PACK_NUMBERS;
+    lept_free(&a);
+    lept_free(&b);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_ex(&a, "[1,2,3,4,5]", &options));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&b, "[1,2,\"3\",4]"));
+    lept_diff(&a, &b, &patch);
+    TEST_STRINGIFY_VALUE("[{\"op\":\"replace\",\"path\":\"/2\",\"value\":\"3\"},{\"op\":\"remove\",\"path\":\"/4\"}]", &patch);
+    lept_diff(&b, &a, &patch);
+    EXPECT_EQ_INT(LEPT_PATCH_OK, lept_patch_apply(&b, &patch));
+    EXPECT_TRUE(lept_is_equal(&a, &b));
+
+    lept_free(&a);
+    lept_free(&b);
+    lept_free(&patch);
+}
+
 static void test_move() {
     lept_value v1, v2, v3;
     lept_init(&v1);
@@ -591,14 +2231,12 @@ static void test_access_array() {
     for (i = 0; i < 6; i++)
         EXPECT_EQ_DOUBLE((double)i + 2, lept_get_number(lept_get_array_element(&a, i)));
 
-#if 0
     for (i = 0; i < 2; i++) {
         lept_init(&e);
         lept_set_number(&e, i);
         lept_move(lept_insert_array_element(&a, i), &e);
         lept_free(&e);
     }
-#endif
     
     EXPECT_EQ_SIZE_T(8, lept_get_array_size(&a));
     for (i = 0; i < 8; i++)
@@ -626,8 +2264,8 @@ static void test_access_array() {
 }
 
 static void test_access_object() {
-#if 0
-    lept_value o, v, *pv;
+    lept_value o, v;
+    const lept_value* pv;
     size_t i, j, index;
 
     lept_init(&o);
@@ -695,10 +2333,23 @@ static void test_access_object() {
     EXPECT_EQ_SIZE_T(0, lept_get_object_capacity(&o));
 
     lept_free(&o);
+}
+
+static void test_access_layout() {
+#ifdef LEPT_COMPACT_VALUE
+    lept_value a;
+    EXPECT_EQ_SIZE_T(16, sizeof(lept_value));
+    lept_init(&a);
+    lept_set_array(&a, 3);
+    EXPECT_EQ_SIZE_T(3, lept_get_array_capacity(&a));
+    lept_reserve_array(&a, 100);
+    EXPECT_EQ_SIZE_T(100, lept_get_array_capacity(&a));
+    lept_free(&a);
 #endif
 }
 
 static void test_access() {
+    test_access_layout();
     test_access_null();
     test_access_boolean();
     test_access_number();
@@ -714,7 +2365,23 @@ int main() {
     test_parse();
     test_stringify();
     test_equal();
+    test_equal_large_object();
+    test_hash();
+    test_cbor();
+    test_msgpack();
+    test_snapshot();
+    test_snapshot_tampered();
+    test_cache();
+    test_patch();
+    test_merge_patch();
+    test_diff();
     test_copy();
+    test_copy_deep();
+    test_stringify_deep();
+    test_copy_on_write();
+    test_memory_usage();
+    test_shrink_to_fit();
+    test_compact();
     test_move();
     test_swap();
     test_access();